@@ -0,0 +1,34 @@
+﻿#include "arena.h"
+
+namespace runtime {
+
+namespace {
+thread_local NodeArena* current_arena = nullptr;
+}  // namespace
+
+NodeArena::NodeArena()
+    : resource_(INITIAL_BLOCK_SIZE) {
+}
+
+void* NodeArena::Allocate(size_t size, size_t alignment) {
+    return resource_.allocate(size, alignment);
+}
+
+ArenaScope::ArenaScope(NodeArena& arena)
+    : previous_(current_arena) {
+    current_arena = &arena;
+}
+
+ArenaScope::~ArenaScope() {
+    current_arena = previous_;
+}
+
+NodeArena* ArenaScope::Current() {
+    return current_arena;
+}
+
+std::pmr::memory_resource* ArenaScope::CurrentResource() {
+    return current_arena != nullptr ? current_arena->Resource() : std::pmr::get_default_resource();
+}
+
+}  // namespace runtime
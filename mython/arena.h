@@ -0,0 +1,55 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace runtime {
+
+/*
+ * Арена для узлов синтаксического дерева и их массивов дочерних узлов.
+ * Память выделяется последовательно из больших блоков и освобождается целиком
+ * при разрушении арены. Арена не потокобезопасна: каждый поток разбора использует свою
+ */
+class NodeArena {
+public:
+    NodeArena();
+
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    void* Allocate(size_t size, size_t alignment);
+
+    std::pmr::memory_resource* Resource() {
+        return &resource_;
+    }
+
+private:
+    static constexpr size_t INITIAL_BLOCK_SIZE = 64 * 1024;
+
+    std::pmr::monotonic_buffer_resource resource_;
+};
+
+/*
+ * Пока объект существует, узлы, создаваемые в текущем потоке, размещаются в арене arena.
+ * Области могут быть вложенными: при разрушении восстанавливается предыдущая арена
+ */
+class ArenaScope {
+public:
+    explicit ArenaScope(NodeArena& arena);
+    ~ArenaScope();
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+    // Арена текущей области либо nullptr, если поток не находится в области
+    static NodeArena* Current();
+
+    // Ресурс памяти для массивов дочерних узлов: арена текущей области
+    // либо стандартный ресурс, если поток не находится в области
+    static std::pmr::memory_resource* CurrentResource();
+
+private:
+    NodeArena* previous_;
+};
+
+}  // namespace runtime
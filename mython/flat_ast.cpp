@@ -0,0 +1,578 @@
+﻿#include "flat_ast.h"
+
+#include <iostream>
+
+using namespace std;
+
+namespace ast::flat {
+
+using runtime::Closure;
+using runtime::Context;
+using runtime::ObjectHolder;
+
+namespace {
+const intern::Symbol INIT_METHOD{"__init__"sv};
+}  // namespace
+
+/*
+ * Строит плоское представление по дереву. Узлы добавляются в порядке обхода в глубину:
+ * сначала корень поддерева, затем его дочерние узлы
+ */
+class Lowering {
+public:
+    uint32_t Lower(Statement& statement) {
+        if (auto* node = dynamic_cast<MethodBody*>(&statement)) {
+            const uint32_t index = Emit(NodeKind::METHOD_BODY);
+            SetA(index, Lower(*node->body_));
+            return index;
+        }
+        if (auto* node = dynamic_cast<Compound*>(&statement)) {
+            const uint32_t index = Emit(NodeKind::COMPOUND);
+            SetA(index, LowerList(node->stmts_));
+            return index;
+        }
+        if (auto* node = dynamic_cast<Assignment*>(&statement)) {
+            const uint32_t index = Emit(NodeKind::ASSIGNMENT);
+            code_.nodes[index].a = AddSymbol(node->var_);
+            SetB(index, Lower(*node->rv_));
+            return index;
+        }
+        if (auto* node = dynamic_cast<VariableValue*>(&statement)) {
+            return LowerVariable(*node);
+        }
+        if (auto* node = dynamic_cast<FieldAssignment*>(&statement)) {
+            const uint32_t index = Emit(NodeKind::FIELD_ASSIGNMENT);
+            SetA(index, LowerVariable(node->object_));
+            code_.nodes[index].b = AddSymbol(node->field_name_);
+            code_.nodes[index].c = Lower(*node->rv_);
+            return index;
+        }
+        if (auto* node = dynamic_cast<MethodCall*>(&statement)) {
+            const uint32_t index = Emit(NodeKind::METHOD_CALL);
+            SetA(index, Lower(*node->object_));
+            code_.nodes[index].b = AddMethodSite(node->method_);
+            code_.nodes[index].c = LowerList(node->args_);
+            return index;
+        }
+        if (auto* node = dynamic_cast<NewInstance*>(&statement)) {
+            const uint32_t index = Emit(NodeKind::NEW_INSTANCE);
+            code_.nodes[index].a = static_cast<uint32_t>(code_.classes.size());
+            code_.classes.push_back(node->cls_);
+            // Вызов без скобок и вызов с пустым списком аргументов выполняются одинаково
+            SetB(index, node->args_ ? LowerList(*node->args_) : LowerList(StatementList{}));
+            code_.nodes[index].c = AddMethodSite(INIT_METHOD);
+            return index;
+        }
+        if (auto* node = dynamic_cast<Print*>(&statement)) {
+            if (node->argument_) {
+                const uint32_t index = Emit(NodeKind::PRINT_ONE);
+                SetA(index, Lower(**node->argument_));
+                return index;
+            }
+            const uint32_t index = Emit(NodeKind::PRINT);
+            SetA(index, node->args_ ? LowerList(*node->args_) : LowerList(StatementList{}));
+            return index;
+        }
+        if (auto* node = dynamic_cast<IfElse*>(&statement)) {
+            const uint32_t index = Emit(NodeKind::IF_ELSE);
+            SetA(index, Lower(*node->condition_));
+            SetB(index, Lower(*node->if_body_));
+            if (node->else_body_) {
+                code_.nodes[index].c = Lower(*node->else_body_);
+            }
+            return index;
+        }
+        if (auto* node = dynamic_cast<Return*>(&statement)) {
+            const uint32_t index = Emit(NodeKind::RETURN);
+            SetA(index, Lower(*node->statement_));
+            return index;
+        }
+        if (auto* node = dynamic_cast<Comparison*>(&statement)) {
+            // сравнение с произвольной функцией выполняется исходным узлом
+            if (!node->op_) {
+                return LowerOpaque(statement);
+            }
+            const uint32_t index = LowerBinary(NodeKind::COMPARISON, *node);
+            code_.nodes[index].c = static_cast<uint32_t>(*node->op_);
+            return index;
+        }
+        if (auto* node = dynamic_cast<Add*>(&statement)) {
+            return LowerBinary(NodeKind::ADD, *node);
+        }
+        if (auto* node = dynamic_cast<Sub*>(&statement)) {
+            return LowerBinary(NodeKind::SUB, *node);
+        }
+        if (auto* node = dynamic_cast<Mult*>(&statement)) {
+            return LowerBinary(NodeKind::MULT, *node);
+        }
+        if (auto* node = dynamic_cast<Div*>(&statement)) {
+            return LowerBinary(NodeKind::DIV, *node);
+        }
+        if (auto* node = dynamic_cast<Or*>(&statement)) {
+            return LowerBinary(NodeKind::OR, *node);
+        }
+        if (auto* node = dynamic_cast<And*>(&statement)) {
+            return LowerBinary(NodeKind::AND, *node);
+        }
+        if (auto* node = dynamic_cast<Stringify*>(&statement)) {
+            return LowerUnary(NodeKind::STRINGIFY, *node);
+        }
+        if (auto* node = dynamic_cast<Not*>(&statement)) {
+            return LowerUnary(NodeKind::NOT, *node);
+        }
+        if (auto* node = dynamic_cast<NumericConst*>(&statement)) {
+            return LowerConst(node->value_);
+        }
+        if (auto* node = dynamic_cast<StringConst*>(&statement)) {
+            return LowerConst(node->value_);
+        }
+        if (auto* node = dynamic_cast<BoolConst*>(&statement)) {
+            return LowerConst(node->value_);
+        }
+        if (dynamic_cast<None*>(&statement) != nullptr) {
+            return Emit(NodeKind::NONE);
+        }
+        if (auto* node = dynamic_cast<ClassDefinition*>(&statement)) {
+            LowerMethods(*node->cls_.TryAs<runtime::Class>());
+            return LowerOpaque(statement);
+        }
+        if (auto* node = dynamic_cast<Program*>(&statement)) {
+            return Lower(*node->body_);
+        }
+        return LowerOpaque(statement);
+    }
+
+    // Переводит тела собственных методов класса
+    void LowerMethods(runtime::Class& cls) {
+        cls.ForEachMethod([this](runtime::Method& method) {
+            // Тела, уже переведённые в другое представление, не трогаем
+            if (method.body && dynamic_cast<CompiledStatement*>(method.body.get()) == nullptr) {
+                const uint32_t root = Lower(*method.body);
+                methods_.push_back({&method, root});
+            }
+        });
+    }
+
+    Code& GetCode() {
+        code_.field_caches.resize(code_.symbols.size());
+        return code_;
+    }
+
+    vector<LoweredMethod>& GetMethods() {
+        return methods_;
+    }
+
+private:
+    uint32_t Emit(NodeKind kind) {
+        code_.nodes.push_back(Node{kind});
+        return static_cast<uint32_t>(code_.nodes.size() - 1);
+    }
+
+    // Операнды записываются по индексу: пока строится дочерний узел, массив может переехать
+    void SetA(uint32_t index, uint32_t value) {
+        code_.nodes[index].a = value;
+    }
+
+    void SetB(uint32_t index, uint32_t value) {
+        code_.nodes[index].b = value;
+    }
+
+    uint32_t AddSymbol(intern::Symbol symbol) {
+        code_.symbols.push_back(symbol);
+        return static_cast<uint32_t>(code_.symbols.size() - 1);
+    }
+
+    uint32_t AddMethodSite(intern::Symbol method) {
+        code_.method_sites.push_back({method, {}});
+        return static_cast<uint32_t>(code_.method_sites.size() - 1);
+    }
+
+    uint32_t LowerList(const StatementList& statements) {
+        const auto offset = static_cast<uint32_t>(code_.lists.size());
+        code_.lists.resize(offset + 1 + statements.size());
+        code_.lists[offset] = static_cast<uint32_t>(statements.size());
+        for (size_t i = 0; i < statements.size(); ++i) {
+            const uint32_t child = Lower(*statements[i]);
+            code_.lists[offset + 1 + i] = child;
+        }
+        return offset;
+    }
+
+    uint32_t LowerVariable(const VariableValue& variable) {
+        const uint32_t index = Emit(NodeKind::VARIABLE);
+        code_.nodes[index].a = static_cast<uint32_t>(code_.symbols.size());
+        code_.nodes[index].b = static_cast<uint32_t>(variable.dotted_ids_.size());
+        code_.symbols.insert(code_.symbols.end(), variable.dotted_ids_.begin(),
+                             variable.dotted_ids_.end());
+        return index;
+    }
+
+    uint32_t LowerBinary(NodeKind kind, BinaryOperation& operation) {
+        const uint32_t index = Emit(kind);
+        SetA(index, Lower(*operation.lhs_));
+        SetB(index, Lower(*operation.rhs_));
+        return index;
+    }
+
+    uint32_t LowerUnary(NodeKind kind, UnaryOperation& operation) {
+        const uint32_t index = Emit(kind);
+        SetA(index, Lower(*operation.argument_));
+        return index;
+    }
+
+    template <typename T>
+    uint32_t LowerConst(const T& value) {
+        const uint32_t index = Emit(NodeKind::CONST);
+        code_.nodes[index].a = static_cast<uint32_t>(code_.constants.size());
+        code_.constants.push_back(ObjectHolder::Own(T(value)));
+        return index;
+    }
+
+    uint32_t LowerOpaque(Statement& statement) {
+        const uint32_t index = Emit(NodeKind::OPAQUE);
+        code_.nodes[index].a = static_cast<uint32_t>(code_.opaque.size());
+        code_.opaque.push_back(&statement);
+        return index;
+    }
+
+    Code code_;
+    vector<LoweredMethod> methods_;
+};
+
+namespace {
+
+// Вычисляет узлы плоского представления одного вызова Evaluate
+class Evaluator {
+public:
+    Evaluator(const Code& code, Closure& closure, Context& context)
+        : code_(code)
+        , closure_(closure)
+        , context_(context) {
+    }
+
+    ObjectHolder Run(uint32_t root) {
+        // Тело метода вычисляется без лишнего кадра Eval
+        ObjectHolder result = code_.nodes[root].kind == NodeKind::METHOD_BODY
+                                  ? MethodBody(code_.nodes[root])
+                                  : Eval(root);
+        if (returning_) {
+            // return вне тела метода: дальше его обработает охватывающий MethodBody
+            throw ReturnException(std::move(return_value_));
+        }
+        return result;
+    }
+
+private:
+    // Ветви с несколькими временными значениями вынесены в отдельные функции:
+    // Eval вызывается рекурсивно, и его кадр стека должен оставаться маленьким
+    ObjectHolder Eval(uint32_t index) {
+        for (;;) {
+            const Node& node = code_.nodes[index];
+            switch (node.kind) {
+                case NodeKind::CONST:
+                    return code_.constants[node.a];
+                case NodeKind::NONE:
+                    return {};
+                case NodeKind::VARIABLE:
+                    return LookupVariable(closure_, &code_.symbols[node.a], node.b,
+                                          &code_.field_caches[node.a]);
+                case NodeKind::ASSIGNMENT:
+                    return Assign(node);
+                case NodeKind::FIELD_ASSIGNMENT:
+                    return AssignField(node);
+                case NodeKind::PRINT_ONE:
+                    return PrintOne(node);
+                case NodeKind::PRINT:
+                    return Print(node);
+                case NodeKind::METHOD_CALL:
+                    return CallMethod(node);
+                case NodeKind::NEW_INSTANCE:
+                    return NewInstance(node);
+                case NodeKind::STRINGIFY:
+                    return Stringify(node);
+                case NodeKind::OR:
+                case NodeKind::AND:
+                case NodeKind::NOT:
+                    return Logical(node);
+                case NodeKind::ADD:
+                case NodeKind::SUB:
+                case NodeKind::MULT:
+                case NodeKind::DIV:
+                case NodeKind::COMPARISON:
+                    return Binary(node);
+                case NodeKind::COMPOUND: {
+                    const uint32_t* list = &code_.lists[node.a];
+                    for (uint32_t i = 1; i <= list[0] && !returning_; ++i) {
+                        Eval(list[i]);
+                    }
+                    return {};
+                }
+                case NodeKind::METHOD_BODY:
+                    return MethodBody(node);
+                case NodeKind::RETURN:
+                    if (body_depth_ != 0
+                        && code_.nodes[node.a].kind == NodeKind::METHOD_CALL) {
+                        PrepareTailCall(code_.nodes[node.a]);
+                    } else {
+                        return_value_ = Eval(node.a);
+                    }
+                    returning_ = true;
+                    return {};
+                case NodeKind::IF_ELSE:
+                    // Выбранная ветка вычисляется в этом же кадре
+                    if (runtime::IsTrue(Eval(node.a))) {
+                        index = node.b;
+                        continue;
+                    }
+                    if (node.c != NO_NODE) {
+                        index = node.c;
+                        continue;
+                    }
+                    return {};
+                case NodeKind::OPAQUE:
+                    return code_.opaque[node.a]->Execute(closure_, context_);
+            }
+            throw logic_error("Unknown flat node kind"s);
+        }
+    }
+
+    [[gnu::noinline]] ObjectHolder Assign(const Node& node) {
+        ObjectHolder value = Eval(node.b);
+        return closure_[code_.symbols[node.a]] = std::move(value);
+    }
+
+    [[gnu::noinline]] ObjectHolder AssignField(const Node& node) {
+        ObjectHolder object = Eval(node.a);
+        if (auto* instance = object.TryAs<runtime::ClassInstance>()) {
+            ObjectHolder value = Eval(node.c);
+            return instance->Fields().Assign(code_.symbols[node.b], code_.field_caches[node.b])
+                   = std::move(value);
+        }
+        return {};
+    }
+
+    [[gnu::noinline]] ObjectHolder PrintOne(const Node& node) {
+        // Как и Print(argument), выражение вычисляется повторно для результата
+        PrintValue(Eval(node.a), context_);
+        context_.GetOutputStream() << endl;
+        return Eval(node.a);
+    }
+
+    [[gnu::noinline]] ObjectHolder Print(const Node& node) {
+        const uint32_t* list = &code_.lists[node.a];
+        for (uint32_t i = 1; i <= list[0]; ++i) {
+            ObjectHolder value = Eval(list[i]);
+            if (i > 1) {
+                context_.GetOutputStream() << " ";
+            }
+            PrintValue(value, context_);
+        }
+        context_.GetOutputStream() << endl;
+        return {};
+    }
+
+    [[gnu::noinline]] ObjectHolder CallMethod(const Node& node) {
+        ObjectHolder object = Eval(node.a);
+        if (auto* instance = object.TryAs<runtime::ClassInstance>()) {
+            const MethodSite& site = code_.method_sites[node.b];
+            runtime::Frame frame;
+            return instance->Call(site.cache, site.method, EvalList(node.c, frame.Values()),
+                                  context_);
+        }
+        return {};
+    }
+
+    [[gnu::noinline]] ObjectHolder Stringify(const Node& node) {
+        return StringifyValue(Eval(node.a));
+    }
+
+    // Второй аргумент or и and вычисляется, только если от него зависит результат
+    [[gnu::noinline]] ObjectHolder Logical(const Node& node) {
+        switch (node.kind) {
+            case NodeKind::OR:
+                return ObjectHolder::Own(
+                    runtime::Bool(runtime::IsTrue(Eval(node.a)) || runtime::IsTrue(Eval(node.b))));
+            case NodeKind::AND:
+                return ObjectHolder::Own(
+                    runtime::Bool(runtime::IsTrue(Eval(node.a)) && runtime::IsTrue(Eval(node.b))));
+            default:
+                return ObjectHolder::Own(runtime::Bool(!runtime::IsTrue(Eval(node.a))));
+        }
+    }
+
+    [[gnu::noinline]] ObjectHolder Binary(const Node& node) {
+        ObjectHolder lhs = Eval(node.a);
+        ObjectHolder rhs = Eval(node.b);
+        switch (node.kind) {
+            case NodeKind::ADD:
+                return AddValues(lhs, rhs, context_);
+            case NodeKind::SUB:
+                return SubValues(lhs, rhs);
+            case NodeKind::MULT:
+                return MultValues(lhs, rhs);
+            case NodeKind::DIV:
+                return DivValues(lhs, rhs);
+            default:
+                return ObjectHolder::Own(runtime::Bool(runtime::CompareValues(
+                    static_cast<runtime::CompareOp>(node.c), lhs, rhs, context_)));
+        }
+    }
+
+    // Вычисляет элементы списка в пустой массив values
+    const vector<ObjectHolder>& EvalList(uint32_t offset, vector<ObjectHolder>& values) {
+        const uint32_t* list = &code_.lists[offset];
+        for (uint32_t i = 1; i <= list[0]; ++i) {
+            values.push_back(Eval(list[i]));
+        }
+        return values;
+    }
+
+    [[gnu::noinline]] ObjectHolder NewInstance(const Node& node) {
+        ObjectHolder holder = ObjectHolder::Own(runtime::ClassInstance(*code_.classes[node.a]));
+        // Аргументы вычисляются, только если есть подходящий __init__
+        const MethodSite& site = code_.method_sites[node.c];
+        if (const runtime::Method* init =
+                site.cache.Find(*code_.classes[node.a], site.method, code_.lists[node.b])) {
+            runtime::Frame frame;
+            holder.As<runtime::ClassInstance>().Call(*init, EvalList(node.b, frame.Values()),
+                                                     context_);
+        }
+        return holder;
+    }
+
+    // Вычисляет объект и аргументы return obj.m(args) и откладывает вызов до выхода
+    // из тела метода
+    [[gnu::noinline]] void PrepareTailCall(const Node& node) {
+        return_value_ = {};
+        ObjectHolder object = Eval(node.a);
+        auto* instance = object.TryAs<runtime::ClassInstance>();
+        if (instance == nullptr) {
+            return;
+        }
+        // Аргументы собираются в своём кадре: их вычисление может само дойти до return
+        runtime::Frame frame;
+        const MethodSite& site = code_.method_sites[node.b];
+        const vector<ObjectHolder>& args = EvalList(node.c, frame.Values());
+        const runtime::Method* method
+            = site.cache.Find(instance->GetClass(), site.method, args.size());
+        if (method == nullptr) {
+            throw runtime_error("Not implemented"s);
+        }
+        runtime::PendingTailCall::Set(*method, std::move(object), frame.Values());
+    }
+
+    [[gnu::noinline]] ObjectHolder MethodBody(const Node& node) {
+        ObjectHolder result = ExecuteBody(node);
+        if (!runtime::PendingTailCall::IsSet()) {
+            return result;
+        }
+        // Хвостовые вызовы выполняются по очереди в одном кадре. Тело плоского метода
+        // вычисляет отдельный Evaluator без своего цикла, его отложенный вызов выполнится здесь
+        runtime::Frame frame;
+        ObjectHolder object;
+        while (const runtime::Method* method = runtime::PendingTailCall::Take(frame, object)) {
+            const auto* body = dynamic_cast<const FlatStatement*>(method->body.get());
+            if (body == nullptr
+                || body->GetCode().nodes[body->GetRoot()].kind != NodeKind::METHOD_BODY) {
+                result = object.As<runtime::ClassInstance>().Call(*method, frame.Values(),
+                                                                  context_);
+                continue;
+            }
+            runtime::PendingTailCall::BindFrame(*method, object, frame);
+            Evaluator callee(body->GetCode(), frame.GetClosure(), context_);
+            result = callee.ExecuteBody(body->GetCode().nodes[body->GetRoot()]);
+        }
+        return result;
+    }
+
+    ObjectHolder ExecuteBody(const Node& node) {
+        ++body_depth_;
+        try {
+            Eval(node.a);
+        } catch (ReturnException& r) {
+            // return из узла, выполненного через исходное дерево
+            --body_depth_;
+            return r.obj_;
+        }
+        --body_depth_;
+        if (returning_) {
+            returning_ = false;
+            return std::move(return_value_);
+        }
+        return ObjectHolder::None();
+    }
+
+    const Code& code_;
+    Closure& closure_;
+    Context& context_;
+    // Выполнена инструкция return, и её значение ещё не забрал узел METHOD_BODY
+    bool returning_ = false;
+    ObjectHolder return_value_;
+    // Число выполняемых узлов METHOD_BODY: return вне них выбрасывает ReturnException
+    uint32_t body_depth_ = 0;
+};
+
+// Заменяет тела переведённых методов плоскими и возвращает общий для них код
+shared_ptr<const Code> Install(Lowered lowered) {
+    auto code = make_shared<const Code>(std::move(lowered.code));
+    for (const auto& [method, method_root] : lowered.methods) {
+        method->body = make_unique<FlatStatement>(code, method_root, std::move(method->body));
+    }
+    return code;
+}
+
+unique_ptr<Statement> Build(Statement& tree, unique_ptr<Statement> source) {
+    Lowered lowered = Lower(tree);
+    const uint32_t root = lowered.root;
+    return make_unique<FlatStatement>(Install(std::move(lowered)), root, std::move(source));
+}
+
+}  // namespace
+
+Lowered Lower(Statement& tree) {
+    Lowering lowering;
+    Lowered result;
+    result.root = lowering.Lower(tree);
+    result.code = std::move(lowering.GetCode());
+    result.methods = std::move(lowering.GetMethods());
+    return result;
+}
+
+Lowered LowerMethods(runtime::Class& cls) {
+    Lowering lowering;
+    lowering.LowerMethods(cls);
+    Lowered result;
+    result.code = std::move(lowering.GetCode());
+    result.methods = std::move(lowering.GetMethods());
+    return result;
+}
+
+ObjectHolder Evaluate(const Code& code, uint32_t root, Closure& closure, Context& context) {
+    return Evaluator(code, closure, context).Run(root);
+}
+
+FlatStatement::FlatStatement(shared_ptr<const Code> code, uint32_t root,
+                             unique_ptr<Statement> source)
+    : source_(std::move(source))
+    , code_(std::move(code))
+    , root_(root) {
+}
+
+ObjectHolder FlatStatement::Execute(Closure& closure, Context& context) {
+    return Evaluate(*code_, root_, closure, context);
+}
+
+unique_ptr<Statement> Flatten(unique_ptr<Statement> tree) {
+    Statement& root = *tree;
+    return Build(root, std::move(tree));
+}
+
+unique_ptr<Statement> Flatten(Statement& tree) {
+    return Build(tree, nullptr);
+}
+
+void FlattenMethods(runtime::Class& cls) {
+    Install(LowerMethods(cls));
+}
+
+}  // namespace ast::flat
@@ -0,0 +1,137 @@
+﻿#pragma once
+
+#include "statement.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace ast::flat {
+
+// Вид узла плоского представления и смысл его операндов
+enum class NodeKind : uint8_t {
+    CONST,             // a - индекс в Code::constants
+    NONE,
+    VARIABLE,          // a - индекс первого имени в Code::symbols, b - длина цепочки имён
+    ASSIGNMENT,        // a - индекс имени переменной, b - значение
+    FIELD_ASSIGNMENT,  // a - объект (узел VARIABLE), b - индекс имени поля, c - значение
+    PRINT_ONE,         // a - аргумент команды print с единственным выражением
+    PRINT,             // a - список аргументов
+    METHOD_CALL,       // a - объект, b - индекс в Code::method_sites, c - список аргументов
+    NEW_INSTANCE,      // a - индекс в Code::classes, b - список аргументов,
+                       // c - индекс в Code::method_sites для __init__
+    STRINGIFY,         // a - аргумент
+    ADD,               // a, b - аргументы
+    SUB,               // a, b - аргументы
+    MULT,              // a, b - аргументы
+    DIV,               // a, b - аргументы
+    OR,                // a, b - аргументы
+    AND,               // a, b - аргументы
+    NOT,               // a - аргумент
+    COMPARISON,        // a, b - аргументы, c - операция runtime::CompareOp
+    COMPOUND,          // a - список инструкций
+    METHOD_BODY,       // a - тело метода
+    RETURN,            // a - возвращаемое выражение
+    IF_ELSE,           // a - условие, b - ветка if, c - ветка else либо NO_NODE
+    OPAQUE,            // a - индекс в Code::opaque, узел выполняется своим методом Execute
+};
+
+// Отсутствующий операнд
+inline constexpr uint32_t NO_NODE = UINT32_MAX;
+
+// Узел плоского представления. Дочерние узлы задаются индексами в Code::nodes
+struct Node {
+    NodeKind kind;
+    uint32_t a = NO_NODE;
+    uint32_t b = NO_NODE;
+    uint32_t c = NO_NODE;
+};
+
+// Точка вызова метода: имя метода и кеш его поиска по классу получателя.
+// Кеш меняется при выполнении кода, поэтому объявлен mutable
+struct MethodSite {
+    intern::Symbol method;
+    mutable runtime::MethodCache cache;
+};
+
+/*
+ * Плоское представление программы. Узлы всех инструкций лежат в одном массиве,
+ * и узлы каждого поддерева идут сразу за его корнем.
+ * Список узлов хранится в массиве lists: сначала длина списка, затем индексы его элементов
+ */
+struct Code {
+    std::vector<Node> nodes;
+    std::vector<uint32_t> lists;
+    std::vector<intern::Symbol> symbols;
+    std::vector<runtime::ObjectHolder> constants;
+    std::vector<const runtime::Class*> classes;
+    std::vector<MethodSite> method_sites;
+    // Кеши обращений к полям, по одному на каждое имя в symbols.
+    // Меняются при выполнении кода, поэтому объявлены mutable
+    mutable std::vector<runtime::FieldCache> field_caches;
+    // Узлы исходного дерева, у которых нет плоского аналога
+    std::vector<Statement*> opaque;
+};
+
+// Метод класса, тело которого переведено в плоское представление, но ещё не заменено
+struct LoweredMethod {
+    runtime::Method* method;
+    uint32_t root;
+};
+
+// Результат перевода: код, его корень и методы классов, объявленных в переведённом дереве
+struct Lowered {
+    Code code;
+    uint32_t root = NO_NODE;
+    std::vector<LoweredMethod> methods;
+};
+
+// Переводит дерево в плоское представление, не меняя тела методов классов.
+// Дерево должно пережить полученный код
+Lowered Lower(Statement& tree);
+
+// Переводит тела собственных методов класса cls, не заменяя их
+Lowered LowerMethods(runtime::Class& cls);
+
+// Вычисляет узел root плоского представления code.
+// Инструкция return вне тела метода выбрасывает ReturnException, как и в дереве
+runtime::ObjectHolder Evaluate(const Code& code, uint32_t root, runtime::Closure& closure,
+                               runtime::Context& context);
+
+// Инструкция, исполняемая не обходом дерева. Тела методов такого вида повторно не переводятся
+class CompiledStatement : public Statement {};
+
+// Инструкция, выполняемая по плоскому представлению
+class FlatStatement : public CompiledStatement {
+public:
+    // source - исходное дерево. Оно продолжает жить, пока на его узлы ссылается code
+    FlatStatement(std::shared_ptr<const Code> code, uint32_t root,
+                  std::unique_ptr<Statement> source);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+    [[nodiscard]] const Code& GetCode() const {
+        return *code_;
+    }
+
+    [[nodiscard]] uint32_t GetRoot() const {
+        return root_;
+    }
+
+private:
+    std::unique_ptr<Statement> source_;
+    std::shared_ptr<const Code> code_;
+    uint32_t root_;
+};
+
+// Переводит дерево в плоское представление. Тела методов классов, объявленных в дереве,
+// тоже заменяются плоскими. Результат владеет исходным деревом
+std::unique_ptr<Statement> Flatten(std::unique_ptr<Statement> tree);
+
+// То же, но дерево остаётся у вызывающего и должно пережить результат
+std::unique_ptr<Statement> Flatten(Statement& tree);
+
+// Переводит в плоское представление тела собственных методов класса cls
+void FlattenMethods(runtime::Class& cls);
+
+}  // namespace ast::flat
@@ -0,0 +1,173 @@
+﻿#include "flat_ast.h"
+#include "test_runner_p.h"
+
+using namespace std;
+
+namespace ast::flat {
+
+namespace {
+
+const string CLASSES_PROGRAM = R"(
+class Shape:
+  def __str__():
+    return "Shape"
+
+  def area():
+    return 'Not implemented'
+
+class Rect(Shape):
+  def __init__(w, h):
+    self.w = w
+    self.h = h
+
+  def __str__():
+    return "Rect(" + str(self.w) + 'x' + str(self.h) + ')'
+
+  def area():
+    return self.w * self.h
+
+  def __eq__(other):
+    return self.area() == other.area()
+
+  def __lt__(other):
+    return self.area() < other.area()
+
+class Counter:
+  def __init__():
+    self.value = 0
+
+  def add(step):
+    self.value = self.value + step
+    if self.value > 10:
+      return 'big'
+    else:
+      return 'small'
+
+class Fib:
+  def calc(n):
+    if n < 2:
+      return n
+    return self.calc(n - 1) + self.calc(n - 2)
+
+a = Rect(2, 3)
+b = Rect(3, 2)
+s = Shape()
+print a, b, s, a.area(), s.area()
+print a == b, a < b, a != b, a >= b, a <= b, a > b
+c = Counter()
+print c.add(4), c.add(4), c.add(4), c.value
+print str(c.value) + '!', str(None), not c.value, c.value or 0, c.value and 0
+f = Fib()
+print f.calc(15), 36 / 4 / 3 - 2 * 5
+x = None
+print x
+print
+)";
+
+void TestNodeLayout() {
+    static_assert(sizeof(Node) == 16);
+
+    auto flat = Flatten(ParseProgramFromString(CLASSES_PROGRAM));
+    const auto& statement = dynamic_cast<const FlatStatement&>(*flat);
+    const Code& code = statement.GetCode();
+
+    ASSERT(code.nodes[statement.GetRoot()].kind == NodeKind::COMPOUND);
+    // Узлы поддерева идут после своего корня
+    for (uint32_t i = 0; i < code.nodes.size(); ++i) {
+        const Node& node = code.nodes[i];
+        if (node.kind == NodeKind::ADD || node.kind == NodeKind::SUB
+            || node.kind == NodeKind::COMPARISON || node.kind == NodeKind::IF_ELSE) {
+            ASSERT(node.a > i && node.b > node.a);
+        }
+    }
+}
+
+void TestMethodBodiesAreFlattened() {
+    auto flat = Flatten(ParseProgramFromString(CLASSES_PROGRAM));
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    flat->Execute(closure, context);
+
+    const auto* cls = closure.at("Rect"s).TryAs<runtime::Class>();
+    ASSERT(cls != nullptr);
+    for (const char* name : {"__init__", "__str__", "area", "__eq__", "__lt__"}) {
+        const runtime::Method* method = cls->GetMethod(name);
+        ASSERT(method != nullptr);
+        ASSERT(dynamic_cast<const FlatStatement*>(method->body.get()) != nullptr);
+    }
+}
+
+void TestProgramsMatchTree() {
+    const string expected = "Rect(2x3) Rect(3x2) Shape 6 Not implemented\n"
+                            "True False False True True False\n"
+                            "small small big 12\n"
+                            "12! None False True False\n"
+                            "610 -7\n"
+                            "None\n"
+                            "\n"s;
+    ASSERT_EQUAL(RunProgram(CLASSES_PROGRAM), expected);
+    ASSERT_EQUAL(RunProgram(CLASSES_PROGRAM, Flatten), expected);
+}
+
+void TestTailCalls() {
+    // Без хвостовых вызовов такая глубина рекурсии переполнила бы стек
+    const string program = R"(
+class Counter:
+  def __init__():
+    self.calls = 0
+
+  def count(n):
+    if n == 0:
+      return self.calls
+    self.calls = self.calls + 1
+    return self.count(n - 1)
+
+  def even(n):
+    if n == 0:
+      return True
+    return self.odd(n - 1)
+
+  def odd(n):
+    if n == 0:
+      return False
+    return self.even(n - 1)
+
+  def missing():
+    return self.count()
+
+c = Counter()
+x = 1
+print c.count(200000), c.even(100001), x.count(1)
+)";
+    ASSERT_EQUAL(RunProgram(program), "200000 False None\n"s);
+    ASSERT_EQUAL(RunProgram(program, Flatten), "200000 False None\n"s);
+    ASSERT_THROWS(RunProgram(program + "c.missing()\n"s, Flatten), runtime_error);
+}
+
+void TestRuntimeErrors() {
+    ASSERT_THROWS(RunProgram("x = 'a' + 1\n"s, Flatten), runtime_error);
+    ASSERT_THROWS(RunProgram("print y\n"s, Flatten), runtime_error);
+    ASSERT_THROWS(RunProgram("class A:\n  def f():\n    return 1\n\na = A()\na.g()\n"s, Flatten),
+                  runtime_error);
+}
+
+void TestReturnOutsideMethod() {
+    Return statement(make_unique<NumericConst>(1));
+    auto flat = Flatten(statement);
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    ASSERT_THROWS(flat->Execute(closure, context), ReturnException);
+}
+
+}  // namespace
+
+void RunFlatTests(TestRunner& tr) {
+    RUN_TEST(tr, ast::flat::TestNodeLayout);
+    RUN_TEST(tr, ast::flat::TestMethodBodiesAreFlattened);
+    RUN_TEST(tr, ast::flat::TestProgramsMatchTree);
+    RUN_TEST(tr, ast::flat::TestTailCalls);
+    RUN_TEST(tr, ast::flat::TestRuntimeErrors);
+    RUN_TEST(tr, ast::flat::TestReturnOutsideMethod);
+}
+
+}  // namespace ast::flat
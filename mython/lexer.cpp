@@ -1,16 +1,105 @@
 ﻿#include "lexer.h"
+#include "token_ring.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <charconv>
-#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iterator>
 #include <iostream>
+#include <thread>
 
-#define COMP_ID_START ((cur >= 65 && cur <= 90) || (cur >= 97 && cur <= 122) ||  cur == '_')
-#define COMP_NUM (cur >= 48 && cur <= 57)
 using namespace std;
 
 namespace parse {
 
+namespace {
+
+// Классы символов для табличного сканера
+enum CharClass : uint8_t {
+    ID_START = 1 << 0,  // буква или '_': начало идентификатора
+    DIGIT = 1 << 1,     // десятичная цифра
+    OPERATOR = 1 << 2,  // символ, с которого начинается лексема-оператор
+};
+
+constexpr array<uint8_t, 256> MakeCharClasses() {
+    array<uint8_t, 256> classes{};
+    for (int c = 'a'; c <= 'z'; ++c) {
+        classes[c] |= ID_START;
+    }
+    for (int c = 'A'; c <= 'Z'; ++c) {
+        classes[c] |= ID_START;
+    }
+    classes['_'] |= ID_START;
+    for (int c = '0'; c <= '9'; ++c) {
+        classes[c] |= DIGIT;
+    }
+    for (char c : "+-*/().,:=<>!"sv) {
+        classes[static_cast<unsigned char>(c)] |= OPERATOR;
+    }
+    return classes;
+}
+
+constexpr array<uint8_t, 256> CHAR_CLASSES = MakeCharClasses();
+
+constexpr bool HasClass(char c, uint8_t char_class) {
+    return (CHAR_CLASSES[static_cast<unsigned char>(c)] & char_class) != 0;
+}
+
+// Ключевые слова. Порядок совпадает с порядком KEYWORD_TOKENS
+constexpr array<string_view, 12> KEYWORDS = {
+    "class"sv, "return"sv, "if"sv, "else"sv, "def"sv,  "print"sv,
+    "or"sv,    "None"sv,   "and"sv, "not"sv, "True"sv, "False"sv,
+};
+
+constexpr size_t MAX_KEYWORD_LENGTH = 6;
+constexpr size_t KEYWORD_SLOTS = 16;
+
+// Совершенный хеш ключевых слов по первому и последнему символу и длине слова
+constexpr size_t KeywordHash(string_view word) {
+    return (static_cast<unsigned char>(word.front()) * 6 + static_cast<unsigned char>(word.back()) * 8
+            + word.size())
+           % KEYWORD_SLOTS;
+}
+
+constexpr array<int8_t, KEYWORD_SLOTS> MakeKeywordSlots() {
+    array<int8_t, KEYWORD_SLOTS> slots{};
+    for (auto& slot : slots) {
+        slot = -1;
+    }
+    for (size_t i = 0; i < KEYWORDS.size(); ++i) {
+        slots[KeywordHash(KEYWORDS[i])] = static_cast<int8_t>(i);
+    }
+    return slots;
+}
+
+constexpr array<int8_t, KEYWORD_SLOTS> KEYWORD_SLOTS_TABLE = MakeKeywordSlots();
+
+constexpr bool KeywordHashIsPerfect() {
+    for (size_t i = 0; i < KEYWORDS.size(); ++i) {
+        if (KEYWORD_SLOTS_TABLE[KeywordHash(KEYWORDS[i])] != static_cast<int8_t>(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(KeywordHashIsPerfect(), "Keyword hash has collisions");
+
+const Token KEYWORD_TOKENS[] = {
+    token_type::Class{}, token_type::Return{}, token_type::If{},   token_type::Else{},
+    token_type::Def{},   token_type::Print{},  token_type::Or{},   token_type::None{},
+    token_type::And{},   token_type::Not{},    token_type::True{}, token_type::False{},
+};
+
+}  // namespace
+
+// Строковая константа хранит свой текст, остальные лексемы не больше указателя
+static_assert(sizeof(Token) <= sizeof(std::string) + sizeof(size_t), "Token must stay compact");
+
 bool operator==(const Token& lhs, const Token& rhs) {
     using namespace token_type;
 
@@ -78,12 +167,177 @@ std::ostream& operator<<(std::ostream& os, const Token& rhs) {
     return os << "Unknown token :("sv;
 }
 
-Lexer::Lexer(std::istream& input)
+void SourceCursor::SkipLine(char& cur) {
+    if (cur == '\n') {
+        return;
+    }
+    if (!Good()) {
+        fail_ = true;
+        return;
+    }
+    const char* newline = kernels_->find_newline(pos_, end_);
+    if (newline != end_) {
+        cur = '\n';
+        pos_ = newline + 1;
+        return;
+    }
+    if (pos_ != end_) {
+        cur = end_[-1];
+        pos_ = end_;
+    }
+    eof_ = fail_ = true;
+}
+
+int SourceCursor::CountSpaces(char& cur) {
+    if (!Good()) {
+        fail_ = true;
+        return 1;
+    }
+    const char* first_non_space = pos_ != end_ && *pos_ == ' '
+                                      ? kernels_->skip_spaces(pos_ + 1, end_)
+                                      : pos_;
+    int count = 1 + static_cast<int>(first_non_space - pos_);
+    pos_ = first_non_space;
+    Get(cur);
+    return count;
+}
+
+bool SourceCursor::ReadQuoted(char quote, std::string& out) {
+    if (!Good()) {
+        fail_ = true;
+        return false;
+    }
+    while (true) {
+        const char* stop = kernels_->find_quote_or_backslash(pos_, end_, quote);
+        out.append(pos_, stop);
+        if (stop == end_ || (*stop == '\\' && stop + 1 == end_)) {
+            pos_ = end_;
+            eof_ = fail_ = true;
+            return false;
+        }
+        if (*stop == quote) {
+            pos_ = stop + 1;
+            return true;
+        }
+        switch (stop[1]) {
+        case '"':
+            out += '"';
+            break;
+        case '\'':
+            out += '\'';
+            break;
+        case 't':
+            out += '\t';
+            break;
+        case 'n':
+            out += '\n';
+            break;
+        default:
+            break;
+        }
+        pos_ = stop + 2;
+    }
+}
+
+/*
+ * Поток, который заранее разбирает текст на токены отдельным лексером
+ * и складывает их в кольцевой буфер. Ошибка разбора сохраняется и выбрасывается
+ * читателю, когда он дойдёт до места ошибки, то есть в тот же момент, что и без конвейера
+ */
+class TokenPipeline {
+public:
+    explicit TokenPipeline(std::string_view text)
+        : producer_([this, text] {
+            Produce(text);
+        }) {
+    }
+
+    TokenPipeline(const TokenPipeline&) = delete;
+    TokenPipeline& operator=(const TokenPipeline&) = delete;
+
+    ~TokenPipeline() {
+        stop_.store(true, std::memory_order_relaxed);
+        producer_.join();
+    }
+
+    Token Pop() {
+        Token token;
+        while (!ring_.TryPop(token)) {
+            if (done_.load(std::memory_order_acquire)) {
+                if (ring_.TryPop(token)) {
+                    break;
+                }
+                if (error_) {
+                    std::rethrow_exception(error_);
+                }
+                return Token(token_type::Eof{});
+            }
+            std::this_thread::yield();
+        }
+        return token;
+    }
+
+private:
+    // Парсер обычно медленнее лексера, поэтому писатель, заполнивший буфер,
+    // не крутится в цикле, а засыпает: запаса токенов в буфере хватает надолго
+    static constexpr auto PRODUCER_BACKOFF = std::chrono::microseconds(50);
+    static constexpr size_t RING_CAPACITY = 4096;
+
+    // Выбрасывается в потоке писателя, если читатель больше не нуждается в токенах
+    struct Stopped {};
+
+    void Produce(std::string_view text) {
+        try {
+            Lexer lexer(text);
+            Push(lexer.CurrentToken());
+            while (!lexer.CurrentToken().Is<token_type::Eof>()) {
+                Push(lexer.NextToken());
+            }
+        } catch (const Stopped&) {
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+        done_.store(true, std::memory_order_release);
+    }
+
+    void Push(const Token& token) {
+        while (!ring_.TryPush(token)) {
+            if (stop_.load(std::memory_order_relaxed)) {
+                throw Stopped{};
+            }
+            std::this_thread::sleep_for(PRODUCER_BACKOFF);
+        }
+    }
+
+    SpscRing<Token, RING_CAPACITY> ring_;
+    std::exception_ptr error_;
+    std::atomic<bool> done_ = false;
+    std::atomic<bool> stop_ = false;
+    // Поток запускается последним, когда остальные поля уже созданы
+    std::thread producer_;
+};
+
+Lexer::Lexer(std::istream& input, LexerMode mode)
+    :buffer_(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>())
+    ,in_(buffer_)
+{
+    if(mode == LexerMode::PIPELINED) {
+        pipeline_ = std::make_unique<TokenPipeline>(buffer_);
+    }
+    NextToken();
+}
+
+Lexer::Lexer(std::string_view input, LexerMode mode)
     :in_(input)
 {
+    if(mode == LexerMode::PIPELINED) {
+        pipeline_ = std::make_unique<TokenPipeline>(input);
+    }
     NextToken();
 }
 
+Lexer::~Lexer() = default;
+
 const Token& Lexer::CurrentToken() const {
     if(token_.has_value()) {
         return token_.value();
@@ -92,6 +346,10 @@ const Token& Lexer::CurrentToken() const {
 }
 
 Token Lexer::NextToken() {
+    if(pipeline_) {
+        token_ = pipeline_->Pop();
+        return token_.value();
+    }
     if(auto result = Read(); result.has_value()) {
         token_ = std::move(result);
         return token_.value();
@@ -100,9 +358,8 @@ Token Lexer::NextToken() {
 }
 
 std::optional<Token> Lexer::Read() {
-    string result;
-    char cur;
-    in_.get(cur);
+    char cur = '\0';
+    in_.Get(cur);
     return Read(cur);
 }
 
@@ -118,135 +375,78 @@ std::optional<Token> Lexer::Read(char cur)
     }
     if(auto result = CheckAtChar(cur); result.has_value()) {
         return result.value();
-    } else if(auto word = ReadWord(cur); word.has_value()) {
-        if(auto spec_word = CheckAtSpecWord(word.value()); spec_word.has_value()) {
+    } else if(ReadWord(cur)) {
+        if(auto spec_word = CheckAtSpecWord(word_); spec_word.has_value()) {
             return spec_word.value();
         }
-        return Token(token_type::Id{std::move(word.value())});
-    } else if (auto result = ReadNumber(cur); result.has_value()) {
-        //const char* tmp = result.value().c_str();
-        return Token(token_type::Number{atoi(result.value().c_str())});
-    } else if (auto result = ReadString(cur); result.has_value()) {
-        return Token(token_type::String{std::move(result.value())});
+        return Token(token_type::Id{intern::Symbol(word_)});
+    } else if (ReadNumber(cur)) {
+        return Token(token_type::Number{atoi(word_.c_str())});
+    } else if (ReadString(cur)) {
+        return Token(token_type::String{word_});
     }
     return nullopt;
 }
 
-std::optional<string> Lexer::ReadWord(char cur) {
-    if(COMP_ID_START ) {
-        string result{cur};
-        in_.get(cur);
-        while(in_.good() && (COMP_ID_START || COMP_NUM) ) {
-            result += cur;
-            in_.get(cur);
+bool Lexer::ReadWord(char cur) {
+    if(HasClass(cur, ID_START)) {
+        word_.assign(1, cur);
+        in_.Get(cur);
+        while(in_.Good() && HasClass(cur, ID_START | DIGIT)) {
+            word_ += cur;
+            in_.Get(cur);
         }
-        in_.putback(cur);
-        return result;
+        in_.Putback(cur);
+        return true;
     }
-    return std::nullopt;
+    return false;
 }
 
-std::optional<string> Lexer::ReadNumber(char cur) {
-    if(COMP_NUM) {
-        string result;
-        while(in_.good() && COMP_NUM) {
-            result += cur;
-            in_.get(cur);
+bool Lexer::ReadNumber(char cur) {
+    if(HasClass(cur, DIGIT)) {
+        word_.clear();
+        while(in_.Good() && HasClass(cur, DIGIT)) {
+            word_ += cur;
+            in_.Get(cur);
         }
-        in_.putback(cur);
-        return result;
+        in_.Putback(cur);
+        return true;
     }
-    return std::nullopt;
+    return false;
 }
 
-std::optional<string> Lexer::ReadString(char cur) {
-    string result;
+bool Lexer::ReadString(char cur) {
     if((cur == '\"') || (cur == '\'')) {
-        char begin = cur;
-        in_.get(cur);
-        while((cur != begin)) {
-            if( cur == '\\' ) {
-                in_.get(cur);
-                if(cur == '"') {
-                    result += '"';
-                } else if(cur == '\'') {
-                    result += '\'';
-                } else if(cur == 't') {
-                    result += '\t';
-                } else if(cur == 'n') {
-                    result += '\n';
-                }
-                in_.get(cur);
-                continue;
-            }
-            result += cur;
-            in_.get(cur);
+        word_.clear();
+        if(!in_.ReadQuoted(cur, word_)) {
+            throw LexerError("Unterminated string literal"s);
         }
-        return result;
+        return true;
     }
-    return std::nullopt;
+    return false;
 }
 
 std::optional<Token> Lexer::CheckAtSpecWord(string_view word)
 {
-    static std::unordered_map<std::string_view, Token> tokens;
-    if(tokens.empty()) {
-        tokens.emplace("class"sv, token_type::Class{});
-        tokens.emplace("return"sv, token_type::Return{});
-        tokens.emplace("if"sv, token_type::If{});
-        tokens.emplace("else"sv, token_type::Else{});
-        tokens.emplace("def"sv, token_type::Def{});
-        tokens.emplace("print"sv, token_type::Print{});
-        tokens.emplace("or"sv, token_type::Or{});
-        tokens.emplace("None"sv, token_type::None{});
-        tokens.emplace("and"sv, token_type::And{});
-        tokens.emplace("not"sv, token_type::Not{});
-        tokens.emplace("True"sv, token_type::True{});
-        tokens.emplace("False"sv, token_type::False{});
-    }
-    if (tokens.count(word) != 0) {
-        return tokens.at(word);
+    if (word.empty() || word.size() > MAX_KEYWORD_LENGTH) {
+        return nullopt;
+    }
+    if (int8_t slot = KEYWORD_SLOTS_TABLE[KeywordHash(word)]; slot >= 0 && KEYWORDS[slot] == word) {
+        return KEYWORD_TOKENS[slot];
     }
     return nullopt;
 }
-//    if(word == "class"sv) {
-//        return Token(token_type::Class{});
-//    } else if (word == "return"sv) {
-//        return Token(token_type::Return{});
-//    } else if (word == "if"sv) {
-//        return Token(token_type::If{});
-//    } else if (word == "else"sv) {
-//        return Token(token_type::Else{});
-//    } else if (word == "def"sv) {
-//        return Token(token_type::Def{});
-//    } else if (word == "print"sv) {
-//        return Token(token_type::Print{});
-//    } else if (word == "or"sv) {
-//        return Token(token_type::Or{});
-//    } else if (word == "None"sv) {
-//        return Token(token_type::None{});
-//    } else if (word == "and"sv) {
-//        return Token(token_type::And{});
-//    } else if (word == "not"sv) {
-//        return Token(token_type::Not{});
-//    } else if (word == "True"sv) {
-//        return Token(token_type::True{});
-//    } else if (word == "False"sv) {
-//        return Token(token_type::False{});
-//    }
-//    return nullopt;
-
 
 std::optional<Token> Lexer::CheckAtIndent(char cur)
 {
     // если идет два переноса строки подряд
     if(token_.has_value() && (token_.value().Is<token_type::Newline>()) && cur == '\n') {
        // пропускаем идущие подряд перносы строк
-       while(cur == '\n' && !in_.eof()) {
-           in_.get(cur);
+       while(cur == '\n' && !in_.Eof()) {
+           in_.Get(cur);
        }
-       if(!in_.eof()) {
-          in_.putback(cur);
+       if(!in_.Eof()) {
+          in_.Putback(cur);
           cur = '\n';
        }
     }
@@ -254,48 +454,41 @@ std::optional<Token> Lexer::CheckAtIndent(char cur)
     if(!count_space_.has_value()) {
         count_space_ = cur == ' ' ? 1 : 0;
         if(cur == ' ') {
-            while (cur == ' ') {
-                ++count_space_.value();
-                in_.get(cur);
-            }
-            in_.putback(cur);
+            count_space_.value() += in_.CountSpaces(cur);
+            in_.Putback(cur);
         }
     }
     if(token_.has_value()
        && (token_.value().Is<token_type::Newline>() || count_consider_space_ > 0)
        && count_space_.has_value()
-       && (cur != '\n' || in_.eof()))
+       && (cur != '\n' || in_.Eof()))
     {
         int count_space = 0;
         if(cur == ' ') {
-            while (cur == ' ') {
-                ++count_space;
-                in_.get(cur);
-            }
-            //in_.putback(cur);
+            count_space = in_.CountSpaces(cur);
         }
         if(count_consider_space_ > 0) {
             count_consider_space_ -= 2;
             count_space_.value() -= 2;// моделирует сдвиг по одному отступу за проход
-            in_.putback(cur); // если остался не обработтанный дедента и начало строки
+            in_.Putback(cur); // если остался не обработтанный дедента и начало строки
             return Token(token_type::Dedent{});
         } else if((count_space - count_space_.value()) == 2) {
             count_space_ = count_space;
-            in_.putback(cur);
+            in_.Putback(cur);
             return Token(token_type::Indent{});
         } else if (count_space_.value() - count_space == 2) {
             count_space_ = count_space;
-            in_.putback(cur);
+            in_.Putback(cur);
             return Token(token_type::Dedent{});
         } else if (((count_space_.value() - count_space > 0))) {
             count_consider_space_ = count_space_.value() - count_space;
             count_consider_space_ -= 2;
             count_space_.value() -= 2;// моделирует сдвиг по одному отступу за проход
-            in_.putback(cur); // если два дедента подряд и начало строки
+            in_.Putback(cur); // если два дедента подряд и начало строки
             return Token(token_type::Dedent{});
         } else {
             if(count_space != 0) {
-                in_.putback(cur); // если пробелы были, но сдвига относительно прошлой строки не было
+                in_.Putback(cur); // если пробелы были, но сдвига относительно прошлой строки не было
             }
         }
 
@@ -304,54 +497,50 @@ std::optional<Token> Lexer::CheckAtIndent(char cur)
 }
 
 std::optional<Token> Lexer::CheckAtChar(char cur) {
-    if(cur == '+') {
-        return Token(token_type::Char{'+'});
-    } else if (cur == '-') {
-        return Token(token_type::Char{'-'});
-    } else if (cur == '*') {
-        return Token(token_type::Char{'*'});
-    } else if (cur == '/') {
-        return Token(token_type::Char{'/'});
-    } else if (cur == '(') {
-        return Token(token_type::Char{'('});
-    } else if (cur == ')') {
-        return Token(token_type::Char{')'});
-    } else if (cur == '.') {
-        return Token(token_type::Char{'.'});
-    } else if (cur == ',') {
-        return Token(token_type::Char{','});
-    } else if (cur == ':') {
-        return Token(token_type::Char{':'});
-    } else if (cur == '=') {
-        in_.get(cur);
-        if(cur == '=' && !in_.eof()) {
+    if(!HasClass(cur, OPERATOR)) {
+        return nullopt;
+    }
+    switch (cur) {
+    case '+':
+    case '-':
+    case '*':
+    case '/':
+    case '(':
+    case ')':
+    case '.':
+    case ',':
+    case ':':
+        return Token(token_type::Char{cur});
+    case '=':
+        in_.Get(cur);
+        if(cur == '=' && !in_.Eof()) {
             return Token(token_type::Eq{});
         }
-        in_.putback(cur);
+        in_.Putback(cur);
         return Token(token_type::Char{'='});
-    }
-    else if (cur == '>') {
-        in_.get(cur);
+    case '>':
+        in_.Get(cur);
         if(cur == '=') {
             return Token(token_type::GreaterOrEq{});
         }
-        in_.putback(cur);
+        in_.Putback(cur);
         return Token(token_type::Char{'>'});
-    }
-    else if (cur == '<') {
-        in_.get(cur);
+    case '<':
+        in_.Get(cur);
         if(cur == '=') {
             return Token(token_type::LessOrEq{});
         }
-        in_.putback(cur);
+        in_.Putback(cur);
         return Token(token_type::Char{'<'});
-    }
-    else if (cur == '!') {
-        in_.get(cur);
+    case '!':
+        in_.Get(cur);
         if(cur == '=') {
             return Token(token_type::NotEq{});
         }
-        in_.putback(cur);
+        in_.Putback(cur);
+        break;
+    default:
+        break;
     }
     return nullopt;
 }
@@ -359,11 +548,7 @@ std::optional<Token> Lexer::CheckAtChar(char cur) {
 void Lexer::SkipAtComment(char& cur)
 {
     if(cur == '#') {
-        string tmp;
-//        in_.ignore(numeric_limits<streamsize>::max(), '\n');
-        while (cur != '\n' &&  ! in_.eof()) {
-            in_.get(cur);
-        }
+        in_.SkipLine(cur);
     }
 }
 
@@ -373,24 +558,24 @@ std::optional<Token> Lexer::CheckAtSpecChar(char& cur)
         if(token_.has_value() && ! token_.value().Is<token_type::Newline>()) {
             return Token(token_type::Newline{});
         }
-        //in_.get(cur);
-        while(cur == '\n' && !in_.eof()) {
-            in_.get(cur);
+        //in_.Get(cur);
+        while(cur == '\n' && !in_.Eof()) {
+            in_.Get(cur);
         }
-        if(in_.eof()) {
+        if(in_.Eof()) {
             return Token(token_type::Eof{});
         }
         return Read(cur);
         // && token_.value().Is<token_type::Newline>()
     }
-    if (cur == '\0' || !in_.good()) {
+    if (cur == '\0' || !in_.Good()) {
         if(token_.has_value() && ! token_.value().Is<token_type::Newline>() && ! token_.value().Is<token_type::Eof>()
            && ! token_.value().Is<token_type::Dedent>()) {
             return Token(token_type::Newline{});
         }
         return Token(token_type::Eof{});
     }
-    if(in_.eof()) {
+    if(in_.Eof()) {
         return Token(token_type::Eof{});
     }
     return nullopt;
@@ -398,7 +583,7 @@ std::optional<Token> Lexer::CheckAtSpecChar(char& cur)
 
 void Lexer::SkipSpace(char& cur) {
     if(cur == ' ') {
-        in_ >> cur;
+        in_.GetSkippingSpaces(cur);
     }
 }
 
@@ -1,10 +1,15 @@
 ﻿#pragma once
 
+#include "scan.h"
+#include "symbol.h"
+
 #include <iosfwd>
+#include <memory>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <variant>
 
@@ -15,8 +20,8 @@ struct Number {  // Лексема «число»
     int value;   // число
 };
 
-struct Id {             // Лексема «идентификатор»
-    std::string value;  // Имя идентификатора
+struct Id {               // Лексема «идентификатор»
+    intern::Symbol value;  // Имя идентификатора
 };
 
 struct Char {    // Лексема «символ»
@@ -86,9 +91,123 @@ public:
     using std::runtime_error::runtime_error;
 };
 
+/*
+ * Курсор по непрерывному буферу с текстом программы.
+ * Читает символы простым указателем, но повторяет поведение get/putback/operator>>/eof/good
+ * потока std::istringstream, на которое опирается лексер: после неудачного чтения курсор
+ * переходит в состояние ошибки, putback сбрасывает признак конца файла, но не ошибку.
+ */
+class SourceCursor {
+public:
+    explicit SourceCursor(std::string_view text,
+                          const scan::Kernels& kernels = scan::ActiveKernels())
+        : begin_(text.data())
+        , pos_(text.data())
+        , end_(text.data() + text.size())
+        , kernels_(&kernels) {
+    }
+
+    // Аналог istream::get(char&): при неудаче cur не изменяется
+    void Get(char& cur) {
+        if (!Good()) {
+            fail_ = true;
+            return;
+        }
+        if (pos_ == end_) {
+            eof_ = fail_ = true;
+            return;
+        }
+        cur = *pos_++;
+    }
+
+    // Аналог istream::putback(char): вернуть можно только последний прочитанный символ
+    void Putback(char cur) {
+        eof_ = false;
+        if (fail_) {
+            return;
+        }
+        if (pos_ == begin_ || pos_[-1] != cur) {
+            fail_ = true;
+            return;
+        }
+        --pos_;
+    }
+
+    // Аналог istream::operator>>(char&): пропускает пробельные символы и читает следующий
+    void GetSkippingSpaces(char& cur) {
+        if (!Good()) {
+            fail_ = true;
+            return;
+        }
+        // Одиночный пробел между лексемами дешевле пропустить на месте
+        if (pos_ != end_ && IsSpace(*pos_)) {
+            ++pos_;
+            if (pos_ != end_ && IsSpace(*pos_)) {
+                pos_ = kernels_->skip_whitespace(pos_, end_);
+            }
+        }
+        Get(cur);
+    }
+
+    // Аналог цикла while (cur != '\n' && !Eof()) Get(cur): дочитывает строку до '\n' включительно
+    void SkipLine(char& cur);
+
+    // Аналог цикла while (cur == ' ') Get(cur) для уже прочитанного cur == ' '.
+    // Возвращает длину серии пробелов. Если серия доходит до конца текста, cur остаётся ' '
+    int CountSpaces(char& cur);
+
+    // Дочитывает строковую константу после открывающей кавычки quote до закрывающей
+    // и сохраняет в out её значение с раскрытыми escape-последовательностями.
+    // Возвращает false, если текст закончился раньше закрывающей кавычки
+    bool ReadQuoted(char quote, std::string& out);
+
+    [[nodiscard]] bool Eof() const {
+        return eof_;
+    }
+
+    [[nodiscard]] bool Good() const {
+        return !eof_ && !fail_;
+    }
+
+private:
+    static bool IsSpace(char c) {
+        return c == ' ' || (static_cast<unsigned char>(c) - 9U) <= 4U;
+    }
+
+    const char* begin_;
+    const char* pos_;
+    const char* end_;
+    const scan::Kernels* kernels_;
+    bool eof_ = false;
+    bool fail_ = false;
+};
+
+// Способ чтения токенов лексером
+enum class LexerMode {
+    // Токен читается из текста при каждом вызове NextToken
+    INLINE,
+    // Текст разбирается на токены в отдельном потоке, который опережает парсер
+    // и передаёт ему токены через кольцевой буфер. Имеет смысл для больших программ
+    PIPELINED,
+};
+
+class TokenPipeline;
+
 class Lexer {
 public:
-    explicit Lexer(std::istream& input);
+    // Считывает поток целиком в собственный буфер и разбирает его
+    explicit Lexer(std::istream& input, LexerMode mode = LexerMode::INLINE);
+
+    // Разбирает непрерывный буфер без копирования (например, содержимое файла,
+    // отображённого в память). Буфер должен оставаться валидным всё время жизни лексера
+    explicit Lexer(std::string_view input, LexerMode mode = LexerMode::INLINE);
+
+    // Курсор ссылается на буфер лексера, поэтому лексер не копируется
+    Lexer(const Lexer&) = delete;
+    Lexer& operator=(const Lexer&) = delete;
+
+    // Останавливает поток чтения токенов, если он запущен
+    ~Lexer();
 
     // Возвращает ссылку на текущий токен или token_type::Eof, если поток токенов закончился
     [[nodiscard]] const Token& CurrentToken() const;
@@ -146,22 +265,32 @@ private:
     // сам токен
     std::optional<Token> token_;
 
-    // ссылка на входной поток
-    std::istream& in_;
+    // текст программы, считанный из потока (пуст, если лексер создан над внешним буфером)
+    std::string buffer_;
+
+    // курсор по тексту программы
+    SourceCursor in_;
 
     std::optional<int> count_space_;
 
     int count_consider_space_ = 0;
 
+    // буфер для текста текущей лексемы, переиспользуется между вызовами
+    std::string word_;
+
+    // поток чтения токенов в режиме LexerMode::PIPELINED
+    std::unique_ptr<TokenPipeline> pipeline_;
+
     std::optional<Token> Read();
 
     std::optional<Token> Read(char cur);
 
-    std::optional<std::string> ReadWord(char cur);
+    // Методы Read* сохраняют прочитанную лексему в word_ и возвращают true, если она найдена
+    bool ReadWord(char cur);
 
-    std::optional<std::string> ReadNumber(char cur);
+    bool ReadNumber(char cur);
 
-    std::optional<std::string> ReadString(char cur);
+    bool ReadString(char cur);
 
     std::optional<Token> CheckAtSpecWord(std::string_view word);
 
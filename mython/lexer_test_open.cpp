@@ -1,8 +1,12 @@
 ﻿#include "lexer.h"
+#include "scan.h"
 #include "test_runner_p.h"
 
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 using namespace std;
 
@@ -412,6 +416,198 @@ class Triangle(Shape):
     lexer.NextToken();
     lexer.NextToken();
 }
+
+void TestIdsAreInterned() {
+    istringstream input("value other value 'value' 'literal is not a symbol'"s);
+    Lexer lexer(input);
+
+    const intern::Symbol first = lexer.Expect<token_type::Id>().value;
+    const intern::Symbol other = lexer.ExpectNext<token_type::Id>().value;
+    const intern::Symbol second = lexer.ExpectNext<token_type::Id>().value;
+
+    ASSERT(first == second);
+    ASSERT(first != other);
+    ASSERT_EQUAL(&first.Name(), &second.Name());
+    ASSERT_EQUAL(first.Id(), intern::Symbol("value"sv).Id());
+    ASSERT_EQUAL(first, "value"s);
+
+    // Строковые константы не попадают в таблицу символов
+    ASSERT_EQUAL(lexer.ExpectNext<token_type::String>().value, "value"s);
+    const size_t symbols = intern::SymbolTable::Global().Size();
+    ASSERT_EQUAL(lexer.ExpectNext<token_type::String>().value, "literal is not a symbol"s);
+    ASSERT_EQUAL(intern::SymbolTable::Global().Size(), symbols);
+}
+
+void TestSymbolsAreSharedAcrossThreads() {
+    // Потоки находят символы через свои кеши, но получают одни и те же записи таблицы
+    const vector<string> names = {"alpha"s, "beta"s, "gamma"s, "alpha"s, ""s};
+    vector<vector<intern::Symbol>> results(4);
+    vector<thread> threads;
+    for (auto& result : results) {
+        threads.emplace_back([&names, &result] {
+            for (const string& name : names) {
+                result.emplace_back(name);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (const auto& result : results) {
+        for (size_t i = 0; i < names.size(); ++i) {
+            ASSERT(result[i] == intern::Symbol(names[i]));
+        }
+    }
+    ASSERT(intern::Symbol() == intern::Symbol(""sv));
+}
+
+// Разбирает program лексером над буфером и лексером над потоком
+// и сравнивает токены каждого с ожидаемыми
+void CheckTokens(const string& program, const vector<Token>& expected) {
+    istringstream input(program);
+    Lexer stream_lexer(input);
+    Lexer buffer_lexer(string_view{program});
+    for (Lexer* lexer : {&buffer_lexer, &stream_lexer}) {
+        ASSERT_EQUAL(lexer->CurrentToken(), expected.front());
+        for (size_t i = 1; i < expected.size(); ++i) {
+            ASSERT_EQUAL(lexer->NextToken(), expected[i]);
+        }
+        ASSERT_EQUAL(lexer->NextToken(), Token(token_type::Eof{}));
+    }
+}
+
+void TestBufferLexerTokens() {
+    using namespace token_type;
+    CheckTokens("x = 42\n"s, {Id{"x"s}, Char{'='}, Number{42}, Newline{}, Eof{}});
+    CheckTokens("a b"s, {Id{"a"s}, Id{"b"s}, Newline{}, Eof{}});
+    // Отступ первой строки не даёт Indent, а возврат из него - два Dedent, как у исходного лексера
+    CheckTokens("  x   y\n\n\nz\n"s, {Id{"x"s}, Id{"y"s}, Newline{}, Dedent{}, Dedent{},
+                                         Id{"z"s}, Newline{}, Eof{}});
+    CheckTokens(R"(
+class Counter:
+  def __init__():
+    self.value = 0 # comment
+
+  def add(x, y):
+    if x >= y and not x != y:
+      return 'a\'b' + "c\"d\n"
+    else:
+      self.value = self.value * -1
+
+
+print Counter().add(1, 2)
+#)"s,
+                {Class{},     Id{"Counter"s}, Char{':'},   Newline{},    Indent{},
+                 Def{},       Id{"__init__"s}, Char{'('},  Char{')'},    Char{':'},
+                 Newline{},   Indent{},      Id{"self"s},  Char{'.'},    Id{"value"s},
+                 Char{'='},   Number{0},     Newline{},    Dedent{},     Def{},
+                 Id{"add"s},  Char{'('},     Id{"x"s},     Char{','},    Id{"y"s},
+                 Char{')'},   Char{':'},     Newline{},    Indent{},     If{},
+                 Id{"x"s},    GreaterOrEq{}, Id{"y"s},     And{},        Not{},
+                 Id{"x"s},    NotEq{},       Id{"y"s},     Char{':'},    Newline{},
+                 Indent{},    Return{},      String{"a'b"s}, Char{'+'},  String{"c\"d\n"s},
+                 Newline{},   Dedent{},      Else{},       Char{':'},    Newline{},
+                 Indent{},    Id{"self"s},   Char{'.'},    Id{"value"s}, Char{'='},
+                 Id{"self"s}, Char{'.'},     Id{"value"s}, Char{'*'},    Char{'-'},
+                 Number{1},   Newline{},     Dedent{},     Dedent{},     Dedent{},
+                 Print{},     Id{"Counter"s}, Char{'('},   Char{')'},    Char{'.'},
+                 Id{"add"s},  Char{'('},     Number{1},    Char{','},    Number{2},
+                 Char{')'},   Newline{},     Eof{}});
+    CheckTokens(R"(
+if x:
+  if y:
+    if z:
+      print 1
+print 2   )"s,
+                {If{},      Id{"x"s},  Char{':'}, Newline{}, Indent{},  If{},      Id{"y"s},
+                 Char{':'}, Newline{}, Indent{},  If{},      Id{"z"s},  Char{':'}, Newline{},
+                 Indent{},  Print{},   Number{1}, Newline{}, Dedent{},  Dedent{},  Dedent{},
+                 Print{},   Number{2}, Newline{}, Eof{}});
+}
+
+void TestScanKernelsMatchScalar() {
+    using namespace scan;
+    const Kernels& scalar = GetKernels(Isa::SCALAR);
+    const string alphabet = "  \n\t\r\v\f'\"\\ab#"s;
+    mt19937 gen(42);
+    uniform_int_distribution<size_t> pick(0, alphabet.size() - 1);
+
+    for (Isa isa : {Isa::SSE2, Isa::AVX2}) {
+        if (!IsSupported(isa)) {
+            continue;
+        }
+        const Kernels& kernels = GetKernels(isa);
+        for (size_t size = 0; size < 100; ++size) {
+            string text(size, ' ');
+            for (char& c : text) {
+                // Длинные серии пробелов, чтобы совпадение попадало в разные блоки
+                c = pick(gen) < 4 ? alphabet[pick(gen)] : ' ';
+            }
+            for (size_t offset = 0; offset <= size && offset < 40; ++offset) {
+                const char* begin = text.data() + offset;
+                const char* end = text.data() + size;
+                ASSERT_EQUAL(kernels.find_newline(begin, end), scalar.find_newline(begin, end));
+                ASSERT_EQUAL(kernels.skip_spaces(begin, end), scalar.skip_spaces(begin, end));
+                ASSERT_EQUAL(kernels.skip_whitespace(begin, end),
+                             scalar.skip_whitespace(begin, end));
+                for (char quote : {'\'', '"'}) {
+                    ASSERT_EQUAL(kernels.find_quote_or_backslash(begin, end, quote),
+                                 scalar.find_quote_or_backslash(begin, end, quote));
+                }
+            }
+        }
+    }
+}
+
+void TestUnterminatedInput() {
+    ASSERT_THROWS(Lexer("'abc"sv), LexerError);
+    ASSERT_THROWS(Lexer("\"abc\\"sv), LexerError);
+    {
+        Lexer lexer("x = 'abc\n"sv);
+        lexer.NextToken();
+        ASSERT_THROWS(lexer.NextToken(), LexerError);
+    }
+
+    // Пробелы в конце текста не должны приводить к зацикливанию
+    for (string_view program : {"x\n  "sv, "  "sv, "x   "sv, "# comment"sv}) {
+        Lexer lexer(program);
+        for (int i = 0; i < 10 && !lexer.CurrentToken().Is<token_type::Eof>(); ++i) {
+            lexer.NextToken();
+        }
+        ASSERT_EQUAL(lexer.CurrentToken(), Token(token_type::Eof{}));
+    }
+}
+
+void TestPipelinedLexerMatchesInline() {
+    string program;
+    for (int i = 0; i < 2000; ++i) {
+        program += "class C"s + to_string(i) + ":\n  def m(x):\n    return 'v' + x # c\n\n"s;
+        program += "print C"s + to_string(i) + "().m(\"s\"), "s + to_string(i) + "\n"s;
+    }
+
+    Lexer inline_lexer(string_view{program});
+    Lexer pipelined_lexer(string_view{program}, LexerMode::PIPELINED);
+    ASSERT_EQUAL(inline_lexer.CurrentToken(), pipelined_lexer.CurrentToken());
+    while (!inline_lexer.CurrentToken().Is<token_type::Eof>()) {
+        ASSERT_EQUAL(inline_lexer.NextToken(), pipelined_lexer.NextToken());
+    }
+    ASSERT_EQUAL(pipelined_lexer.NextToken(), Token(token_type::Eof{}));
+
+    istringstream input("x = 1\nprint x\n"s);
+    Lexer stream_lexer(input, LexerMode::PIPELINED);
+    ASSERT_EQUAL(stream_lexer.Expect<token_type::Id>().value, "x"s);
+    stream_lexer.ExpectNext<token_type::Char>('=');
+    ASSERT_EQUAL(stream_lexer.ExpectNext<token_type::Number>().value, 1);
+
+    // Ошибка выбрасывается на том же токене, что и без конвейера
+    Lexer broken("x = 'abc\n"sv, LexerMode::PIPELINED);
+    broken.NextToken();
+    ASSERT_THROWS(broken.NextToken(), LexerError);
+
+    // Лексер можно уничтожить, не дочитав токены
+    Lexer unfinished(string_view{program}, LexerMode::PIPELINED);
+    unfinished.NextToken();
+}
 }  // namespace
 
 void RunOpenLexerTests(TestRunner& tr) {
@@ -430,6 +626,12 @@ void RunOpenLexerTests(TestRunner& tr) {
     RUN_TEST(tr, parse::TestCommentsAreIgnored);
     RUN_TEST(tr, parse::TestIfElse);
     RUN_TEST(tr, parse::TestCl);
+    RUN_TEST(tr, parse::TestBufferLexerTokens);
+    RUN_TEST(tr, parse::TestIdsAreInterned);
+    RUN_TEST(tr, parse::TestSymbolsAreSharedAcrossThreads);
+    RUN_TEST(tr, parse::TestScanKernelsMatchScalar);
+    RUN_TEST(tr, parse::TestUnterminatedInput);
+    RUN_TEST(tr, parse::TestPipelinedLexerMatchesInline);
 }
 
 }  // namespace parse
@@ -1,10 +1,20 @@
-﻿#include "lexer.h"
+﻿#include "flat_ast.h"
+#include "lexer.h"
 #include "parse.h"
+#include "program_cache.h"
 #include "runtime.h"
 #include "statement.h"
 #include "test_runner_p.h"
+#include "vm.h"
 
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
 
 using namespace std;
 
@@ -14,25 +24,281 @@ void RunOpenLexerTests(TestRunner& tr);
 
 namespace ast {
 void RunUnitTests(TestRunner& tr);
-}
+namespace flat {
+void RunFlatTests(TestRunner& tr);
+}  // namespace flat
+}  // namespace ast
 namespace runtime {
 void RunObjectHolderTests(TestRunner& tr);
 void RunObjectsTests(TestRunner& tr);
 }  // namespace runtime
 
+namespace vm {
+void RunVmTests(TestRunner& tr);
+}  // namespace vm
+namespace cache {
+void RunProgramCacheTests(TestRunner& tr);
+}  // namespace cache
+
 void TestParseProgram(TestRunner& tr);
 
 namespace {
 
-void RunMythonProgram(istream& input, ostream& output) {
-    parse::Lexer lexer(input);
-    auto program = ParseProgram(lexer);
+// Способ исполнения разобранной программы
+enum class Engine {
+    TREE,  // обход синтаксического дерева
+    FLAT,  // плоское представление дерева
+    VM,    // байт-код регистровой машины
+};
+
+Engine ParseEngine(string_view name) {
+    if (name.empty() || name == "tree"sv) {
+        return Engine::TREE;
+    }
+    if (name == "flat"sv) {
+        return Engine::FLAT;
+    }
+    if (name == "vm"sv) {
+        return Engine::VM;
+    }
+    throw invalid_argument("Unknown engine: "s + string(name));
+}
+
+// Переводит разобранную программу в представление движка engine
+unique_ptr<runtime::Executable> PrepareProgram(unique_ptr<runtime::Executable> program,
+                                               Engine engine) {
+    if (engine == Engine::FLAT) {
+        return ast::flat::Flatten(std::move(program));
+    }
+    if (engine == Engine::VM) {
+        return vm::Compile(std::move(program));
+    }
+    return program;
+}
 
+void ExecuteProgram(unique_ptr<runtime::Executable> program, ostream& output, Engine engine) {
+    program = PrepareProgram(std::move(program), engine);
     runtime::SimpleContext context{output};
     runtime::Closure closure;
     program->Execute(closure, context);
 }
 
+void RunMythonProgram(istream& input, ostream& output,
+                      parse::LexerMode mode = parse::LexerMode::INLINE,
+                      Engine engine = Engine::TREE) {
+    parse::Lexer lexer(input, mode);
+    ExecuteProgram(ParseProgram(lexer), output, engine);
+}
+
+void RunMythonProgramParallel(istream& input, ostream& output, Engine engine) {
+    const string text{istreambuf_iterator<char>(input), istreambuf_iterator<char>()};
+    ExecuteProgram(ParseProgram(text), output, engine);
+}
+
+// Берёт разобранную программу из каталога cache_dir. Если её там нет,
+// разбирает текст и сохраняет результат для следующих запусков
+void RunMythonProgramCached(istream& input, ostream& output, string_view cache_dir,
+                            bool parallel, Engine engine) {
+    const string text{istreambuf_iterator<char>(input), istreambuf_iterator<char>()};
+    const cache::ProgramCache cache{filesystem::path(cache_dir)};
+    auto program = cache.Load(text);
+    if (!program) {
+        if (parallel) {
+            program = ParseProgram(text);
+        } else {
+            parse::Lexer lexer(text);
+            program = ParseProgram(lexer);
+        }
+        try {
+            cache.Store(text, *program);
+        } catch (const std::exception& e) {
+            // Без кеша программа всё равно выполняется
+            cerr << "Can't cache the program: "s << e.what() << endl;
+        }
+    }
+    ExecuteProgram(std::move(program), output, engine);
+}
+
+/*
+ * Замеряет задержку до начала выполнения программы с кешем в каталоге cache_dir:
+ * холодный запуск - разбор текста и сохранение в кеш, тёплый - загрузка из кеша.
+ * Выводит среднее время каждого за reps повторов. Программа не выполняется
+ */
+void BenchmarkProgramCache(istream& input, ostream& output, string_view cache_dir,
+                           bool parallel, int reps) {
+    using Clock = chrono::steady_clock;
+    const string text{istreambuf_iterator<char>(input), istreambuf_iterator<char>()};
+    const cache::ProgramCache cache{filesystem::path(cache_dir)};
+
+    Clock::duration cold{};
+    Clock::duration warm{};
+    for (int i = 0; i < reps; ++i) {
+        filesystem::remove(cache.PathFor(text));
+        const auto start = Clock::now();
+        {
+            unique_ptr<ast::Statement> program;
+            if (parallel) {
+                program = ParseProgram(text);
+            } else {
+                parse::Lexer lexer(text);
+                program = ParseProgram(lexer);
+            }
+            cache.Store(text, *program);
+        }
+        const auto stored = Clock::now();
+        if (!cache.Load(text)) {
+            throw runtime_error("Can't load the cached program"s);
+        }
+        cold += stored - start;
+        warm += Clock::now() - stored;
+    }
+    const auto average = [reps](Clock::duration total) {
+        return chrono::duration<double, micro>(total).count() / reps;
+    };
+    output << "cold: "s << average(cold) << " us, warm: "s << average(warm) << " us"s << endl;
+}
+
+// Наименьшее за reps повторов время вызова run, в миллисекундах
+template <typename Run>
+double BestTime(int reps, Run run) {
+    using Clock = chrono::steady_clock;
+    auto best = Clock::duration::max();
+    for (int i = 0; i < reps; ++i) {
+        const auto start = Clock::now();
+        run();
+        best = min(best, Clock::now() - start);
+    }
+    return chrono::duration<double, milli>(best).count();
+}
+
+// Наименьшее за reps повторов время выполнения программы text движком engine, в миллисекундах.
+// Разбор и перевод в представление движка в замер не входят, вывод программы отбрасывается
+double BestProgramTime(const string& text, Engine engine, int reps) {
+    using Clock = chrono::steady_clock;
+    auto best = Clock::duration::max();
+    for (int i = 0; i < reps; ++i) {
+        parse::Lexer lexer(text);
+        auto program = PrepareProgram(ParseProgram(lexer), engine);
+        ostringstream output;
+        runtime::SimpleContext context{output};
+        runtime::Closure closure;
+        const auto start = Clock::now();
+        program->Execute(closure, context);
+        best = min(best, Clock::now() - start);
+    }
+    return chrono::duration<double, milli>(best).count();
+}
+
+// Цикл арифметики и сравнений над числами для --arithmetic-benchmark
+const string ARITHMETIC_PROGRAM = R"(
+class Loop:
+  def run(i, n, s):
+    if i < n:
+      s = s + i * 3 - i / 2 + (i + 1) * (i - 1) - i * i
+      if s >= i and i != 7 or s <= 0:
+        s = s - (i + i + i) / 3 + 1
+      return self.run(i + 1, n, s)
+    return s
+
+loop = Loop()
+print loop.run(0, 2000, 0) + loop.run(0, 2000, 0)
+)";
+
+/*
+ * Замеряет операции, разбирающие типы аргументов: IsTrue, Less, Equal, AddValues и SubValues
+ * на смеси чисел, строк и логических значений, затем цикл ARITHMETIC_PROGRAM движком engine.
+ * Выводит лучшее время каждого замера за reps повторов
+ */
+void BenchmarkArithmetic(ostream& output, Engine engine, int reps) {
+    using runtime::ObjectHolder;
+    constexpr int CALLS = 2'000'000;
+    // Пары значений одного типа: числа, строки, логические значения
+    const ObjectHolder values[] = {
+        ObjectHolder::Own(runtime::Number{7}),      ObjectHolder::Own(runtime::Number{3}),
+        ObjectHolder::Own(runtime::String{"ab"s}),  ObjectHolder::Own(runtime::String{"cd"s}),
+        ObjectHolder::Own(runtime::Bool{true}),     ObjectHolder::Own(runtime::Bool{false}),
+    };
+    runtime::DummyContext context;
+    size_t sink = 0;
+
+    const auto report = [&output](string_view name, double ms) {
+        output << name << ": "s << ms << " ms"s << endl;
+    };
+    report("IsTrue"sv, BestTime(reps, [&] {
+        for (int i = 0; i < CALLS; ++i) {
+            sink += runtime::IsTrue(values[i % size(values)]);
+        }
+    }));
+    report("Less"sv, BestTime(reps, [&] {
+        for (int i = 0; i < CALLS; ++i) {
+            const size_t pair = i % 3 * 2;
+            sink += runtime::Less(values[pair], values[pair + 1], context);
+        }
+    }));
+    report("Equal"sv, BestTime(reps, [&] {
+        for (int i = 0; i < CALLS; ++i) {
+            const size_t pair = i % 3 * 2;
+            sink += runtime::Equal(values[pair], values[pair + 1], context);
+        }
+    }));
+    report("AddValues"sv, BestTime(reps, [&] {
+        for (int i = 0; i < CALLS; ++i) {
+            const size_t pair = i % 2 * 2;
+            sink += ast::AddValues(values[pair], values[pair + 1], context).GetType()
+                    == runtime::ObjectType::NUMBER;
+        }
+    }));
+    report("SubValues"sv, BestTime(reps, [&] {
+        for (int i = 0; i < CALLS; ++i) {
+            sink += ast::SubValues(values[0], values[1]).As<runtime::Number>().GetValue();
+        }
+    }));
+    report("program"sv, BestProgramTime(ARITHMETIC_PROGRAM, engine, reps));
+    // Результат операций использован, и компилятор не выбрасывает циклы
+    if (sink == 0) {
+        output << "sink"s << endl;
+    }
+}
+
+// Рекурсивное вычисление числа Фибоначчи для --fib-benchmark: каждый вызов метода
+// возвращает значение через return, в том числе из вложенного if
+const string FIB_PROGRAM = R"(
+class Fib:
+  def calc(n):
+    if n < 2:
+      return n
+    return self.calc(n - 1) + self.calc(n - 2)
+
+fib = Fib()
+print fib.calc(22)
+)";
+
+// Выводит лучшее за reps повторов время выполнения FIB_PROGRAM движком engine
+void BenchmarkFib(ostream& output, Engine engine, int reps) {
+    output << "fib: "s << BestProgramTime(FIB_PROGRAM, engine, reps) << " ms"s << endl;
+}
+
+bool HasFlag(int argc, char* argv[], string_view flag) {
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i] == flag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Значение параметра вида name=value либо пустая строка, если параметра нет
+string_view FlagValue(int argc, char* argv[], string_view name) {
+    for (int i = 1; i < argc; ++i) {
+        const string_view arg = argv[i];
+        if (arg.size() > name.size() && arg.substr(0, name.size()) == name
+            && arg[name.size()] == '=') {
+            return arg.substr(name.size() + 1);
+        }
+    }
+    return {};
+}
+
 void TestSimplePrints() {
     istringstream input(R"(
 print 57
@@ -127,6 +393,9 @@ void TestAll() {
     runtime::RunObjectHolderTests(tr);
     runtime::RunObjectsTests(tr);
     ast::RunUnitTests(tr);
+    ast::flat::RunFlatTests(tr);
+    vm::RunVmTests(tr);
+    cache::RunProgramCacheTests(tr);
     TestParseProgram(tr);
 
     RUN_TEST(tr, TestSimplePrints);
@@ -138,11 +407,78 @@ void TestAll() {
 
 }  // namespace
 
-int main() {
+int main(int argc, char* argv[]) {
+    // --pipelined-lexer: разбирать текст на токены в отдельном потоке
+    const bool pipelined = HasFlag(argc, argv, "--pipelined-lexer"sv);
+    // --parallel-parse: разбирать программу по фрагментам на нескольких потоках
+    const bool parallel = HasFlag(argc, argv, "--parallel-parse"sv);
+    // --method-cache-stats: после выполнения вывести в cerr попадания и промахи кешей вызовов
+    const bool cache_stats = HasFlag(argc, argv, "--method-cache-stats"sv);
+    // --quickening-stats: после выполнения вывести в cerr число специализированных
+    // и деоптимизированных операций
+    const bool quickening_stats = HasFlag(argc, argv, "--quickening-stats"sv);
     try {
-        TestAll();
+        // --engine=tree|flat|vm: способ исполнения программы
+        const Engine engine = ParseEngine(FlagValue(argc, argv, "--engine"sv));
+
+        // --cache-dir=<каталог>: хранить разобранные программы и не разбирать их повторно
+        const string_view cache_dir = FlagValue(argc, argv, "--cache-dir"sv);
+
+        // --cache-benchmark=N: вместо выполнения замерить холодный и тёплый запуск
+        // с кешем --cache-dir за N повторов
+        const string_view cache_benchmark = FlagValue(argc, argv, "--cache-benchmark"sv);
+        if (!cache_benchmark.empty() && cache_dir.empty()) {
+            throw invalid_argument("--cache-benchmark requires --cache-dir"s);
+        }
+
+        // --arithmetic-benchmark=N: вместо выполнения программы замерить операции над
+        // значениями и цикл арифметики движком --engine, лучшее время за N повторов
+        const string_view arithmetic_benchmark
+            = FlagValue(argc, argv, "--arithmetic-benchmark"sv);
+
+        // --fib-benchmark=N: вместо выполнения программы замерить рекурсивный fib
+        // движком --engine, лучшее время за N повторов
+        const string_view fib_benchmark = FlagValue(argc, argv, "--fib-benchmark"sv);
+
+        // --max-call-depth=N: наибольшая глубина стека вызовов машины. Другие движки
+        // вызывают методы по стеку потока, и для них параметр не имеет смысла
+        const string_view max_call_depth = FlagValue(argc, argv, "--max-call-depth"sv);
+        if (!max_call_depth.empty() && engine != Engine::VM) {
+            throw invalid_argument("--max-call-depth requires --engine=vm"s);
+        }
 
-        RunMythonProgram(cin, cout);
+        TestAll();
+        runtime::MethodCache::GetStatistics() = {};
+        vm::Quickening::GetStatistics() = {};
+        if (!max_call_depth.empty()) {
+            vm::SetMaxCallDepth(stoul(string(max_call_depth)));
+        }
+
+        if (!fib_benchmark.empty()) {
+            BenchmarkFib(cout, engine, stoi(string(fib_benchmark)));
+        } else if (!arithmetic_benchmark.empty()) {
+            BenchmarkArithmetic(cout, engine, stoi(string(arithmetic_benchmark)));
+        } else if (!cache_benchmark.empty()) {
+            BenchmarkProgramCache(cin, cout, cache_dir, parallel, stoi(string(cache_benchmark)));
+        } else if (!cache_dir.empty()) {
+            RunMythonProgramCached(cin, cout, cache_dir, parallel, engine);
+        } else if (parallel) {
+            RunMythonProgramParallel(cin, cout, engine);
+        } else {
+            RunMythonProgram(cin, cout,
+                             pipelined ? parse::LexerMode::PIPELINED : parse::LexerMode::INLINE,
+                             engine);
+        }
+        if (cache_stats) {
+            const auto& stats = runtime::MethodCache::GetStatistics();
+            cerr << "method cache: "s << stats.hits << " hits, "s << stats.misses << " misses"s
+                 << endl;
+        }
+        if (quickening_stats) {
+            const auto& stats = vm::Quickening::GetStatistics();
+            cerr << "quickening: "s << stats.specialized << " specialized, "s << stats.deoptimized
+                 << " deoptimized"s << endl;
+        }
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
         return 1;
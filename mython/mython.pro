@@ -1,22 +1,42 @@
-TEMPLATE = app
+﻿TEMPLATE = app
 CONFIG += console c++17
 CONFIG -= app_bundle
 CONFIG -= qt
+CONFIG += thread
 
 SOURCES += \
+        arena.cpp \
+        flat_ast.cpp \
+        flat_ast_test.cpp \
         lexer.cpp \
         lexer_test_open.cpp \
         main.cpp \
         parse.cpp \
         parse_test.cpp \
+        prescan.cpp \
+        program_cache.cpp \
+        program_cache_test.cpp \
         runtime.cpp \
         runtime_test.cpp \
+        scan.cpp \
         statement.cpp \
-        statement_test.cpp
+        statement_test.cpp \
+        symbol.cpp \
+        vm.cpp \
+        vm_test.cpp
 
 HEADERS += \
+  arena.h \
+  flat_ast.h \
   lexer.h \
   parse.h \
+  prescan.h \
+  program_cache.h \
   runtime.h \
+  scan.h \
   statement.h \
-  test_runner_p.h
+  symbol.h \
+  symbol_map.h \
+  test_runner_p.h \
+  token_ring.h \
+  vm.h
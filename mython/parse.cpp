@@ -1,8 +1,16 @@
 ﻿#include "parse.h"
 
+#include "arena.h"
 #include "lexer.h"
+#include "prescan.h"
 #include "statement.h"
 
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <thread>
+#include <unordered_map>
+
 using namespace std;
 
 namespace TokenType = parse::token_type;
@@ -17,18 +25,115 @@ bool operator!=(const parse::Token& token, char c) {
     return !(token == c);
 }
 
+/*
+ * Классы верхнего уровня при параллельном разборе. Фрагмент публикует класс, как только
+ * разобрал его определение, а фрагменты, которые ссылаются на классы из предыдущих
+ * фрагментов, дожидаются публикации. Так имена классов разрешаются в порядке исходного текста
+ */
+class TopLevelClassRegistry {
+public:
+    explicit TopLevelClassRegistry(const vector<parse::TopLevelClass>& classes)
+        : slots_(classes.size()) {
+        for (size_t i = 0; i < classes.size(); ++i) {
+            slots_[i].name = classes[i].name;
+            slots_[i].chunk = classes[i].chunk;
+            slots_[i].future = slots_[i].declared.get_future().share();
+            index_[classes[i].name].push_back(i);
+        }
+    }
+
+    // Номер первого класса, объявленного во фрагменте chunk или после него
+    [[nodiscard]] size_t FirstSlot(size_t chunk) const {
+        return lower_bound(slots_.begin(), slots_.end(), chunk,
+                           [](const Slot& slot, size_t value) {
+                               return slot.chunk < value;
+                           })
+               - slots_.begin();
+    }
+
+    // Возвращает класс name, объявленный во фрагментах до chunk, или nullptr.
+    // Ждёт, пока класс будет разобран. Если его разбор завершился ошибкой, выбрасывает её
+    [[nodiscard]] const runtime::ObjectHolder* FindBefore(size_t chunk, string_view name) const {
+        const Slot* slot = FindSlotBefore(chunk, name);
+        return slot != nullptr ? &slot->future.get() : nullptr;
+    }
+
+    [[nodiscard]] bool DeclaredBefore(size_t chunk, string_view name) const {
+        return FindSlotBefore(chunk, name) != nullptr;
+    }
+
+    void Publish(size_t slot_index, string_view name, runtime::ObjectHolder cls) {
+        if (slot_index >= slots_.size() || slots_[slot_index].name != name) {
+            throw logic_error("Class "s + string(name) + " was not found by prescan"s);
+        }
+        slots_[slot_index].published = true;
+        slots_[slot_index].declared.set_value(std::move(cls));
+    }
+
+    // Завершает ошибкой ожидание классов фрагмента chunk, которые он так и не объявил
+    void FailUnpublished(size_t chunk, const exception_ptr& error) {
+        for (size_t i = FirstSlot(chunk); i < slots_.size() && slots_[i].chunk == chunk; ++i) {
+            if (!slots_[i].published) {
+                slots_[i].published = true;
+                slots_[i].declared.set_exception(error);
+            }
+        }
+    }
+
+private:
+    struct Slot {
+        string_view name;
+        size_t chunk = 0;
+        bool published = false;
+        promise<runtime::ObjectHolder> declared;
+        shared_future<runtime::ObjectHolder> future;
+    };
+
+    [[nodiscard]] const Slot* FindSlotBefore(size_t chunk, string_view name) const {
+        auto it = index_.find(name);
+        if (it == index_.end() || slots_[it->second.front()].chunk >= chunk) {
+            return nullptr;
+        }
+        return &slots_[it->second.front()];
+    }
+
+    vector<Slot> slots_;
+    unordered_map<string_view, vector<size_t>> index_;
+};
+
 class Parser {
 public:
-    explicit Parser(parse::Lexer& lexer)
-        : lexer_(lexer) {
+    // Узлы создаются в арене текущей ArenaScope, а классы продлевают жизнь арены arena
+    Parser(parse::Lexer& lexer, shared_ptr<runtime::NodeArena> arena)
+        : lexer_(lexer)
+        , arena_(std::move(arena)) {
+    }
+
+    // Парсер фрагмента chunk при параллельном разборе
+    Parser(parse::Lexer& lexer, shared_ptr<runtime::NodeArena> arena,
+           TopLevelClassRegistry& top_level_classes, size_t chunk)
+        : lexer_(lexer)
+        , arena_(std::move(arena))
+        , top_level_classes_(&top_level_classes)
+        , chunk_(chunk)
+        , next_class_slot_(top_level_classes.FirstSlot(chunk)) {
     }
 
     // Program -> eps
     //          | Statement \n Program
     unique_ptr<ast::Statement> ParseProgram() {
         auto result = make_unique<ast::Compound>();
+        for (auto& statement : ParseStatements()) {
+            result->AddStatement(std::move(statement));
+        }
+
+        return result;
+    }
+
+    vector<unique_ptr<ast::Statement>> ParseStatements() {
+        vector<unique_ptr<ast::Statement>> result;
         while (!lexer_.CurrentToken().Is<TokenType::Eof>()) {
-            result->AddStatement(ParseStatement());
+            result.push_back(ParseStatement());
         }
 
         return result;
@@ -86,21 +191,22 @@ private:
     // ClassDefinition -> Id ['(' Id ')'] : new_line indent MethodList dedent
     unique_ptr<ast::Statement> ParseClassDefinition()  // NOLINT
     {
-        string class_name = lexer_.Expect<TokenType::Id>().value;
+        const string& class_name = lexer_.Expect<TokenType::Id>().value.Name();
 
         lexer_.NextToken();
 
         const runtime::Class* base_class = nullptr;
         if (lexer_.CurrentToken() == '(') {
-            auto name = lexer_.ExpectNext<TokenType::Id>().value;
+            intern::Symbol name = lexer_.ExpectNext<TokenType::Id>().value;
             lexer_.ExpectNext<TokenType::Char>(')');
             lexer_.NextToken();
 
-            auto it = declared_classes_.find(name);
-            if (it == declared_classes_.end()) {
-                throw ParseError("Base class "s + name + " not found for class "s + class_name);
+            const runtime::ObjectHolder* base = FindClass(name.Name());
+            if (base == nullptr) {
+                throw ParseError("Base class "s + name.Name() + " not found for class "s
+                                 + class_name);
             }
-            base_class = static_cast<const runtime::Class*>(it->second.Get());  // NOLINT
+            base_class = static_cast<const runtime::Class*>(base->Get());  // NOLINT
         }
 
         lexer_.Expect<TokenType::Char>(':');
@@ -114,18 +220,24 @@ private:
 
         auto [it, inserted] = declared_classes_.insert({
             class_name,
-            runtime::ObjectHolder::Own(runtime::Class(class_name, std::move(methods), base_class)),
+            runtime::ObjectHolder::Own(
+                runtime::Class(class_name, std::move(methods), base_class, arena_)),
         });
 
-        if (!inserted) {
+        if (!inserted
+            || (top_level_classes_ != nullptr
+                && top_level_classes_->DeclaredBefore(chunk_, class_name))) {
             throw ParseError("Class "s + class_name + " already exists"s);
         }
+        if (top_level_classes_ != nullptr) {
+            top_level_classes_->Publish(next_class_slot_++, class_name, it->second);
+        }
 
         return make_unique<ast::ClassDefinition>(it->second);
     }
 
-    vector<string> ParseDottedIds() {
-        vector<string> result(1, lexer_.Expect<TokenType::Id>().value);
+    vector<intern::Symbol> ParseDottedIds() {
+        vector<intern::Symbol> result(1, lexer_.Expect<TokenType::Id>().value);
 
         while (lexer_.NextToken() == '.') {
             result.push_back(lexer_.ExpectNext<TokenType::Id>().value);
@@ -139,8 +251,8 @@ private:
     unique_ptr<ast::Statement> ParseAssignmentOrCall() {
         lexer_.Expect<TokenType::Id>();
 
-        vector<string> id_list = ParseDottedIds();
-        string last_name = id_list.back();
+        vector<intern::Symbol> id_list = ParseDottedIds();
+        intern::Symbol last_name = id_list.back();
         id_list.pop_back();
 
         if (lexer_.CurrentToken() == '=') {
@@ -156,7 +268,8 @@ private:
         lexer_.NextToken();
 
         if (id_list.empty()) {
-            throw ParseError("Mython doesn't support functions, only methods: "s + last_name);
+            throw ParseError("Mython doesn't support functions, only methods: "s
+                             + last_name.Name());
         }
 
         vector<unique_ptr<ast::Statement>> args;
@@ -253,7 +366,7 @@ private:
     }
 
     std::unique_ptr<ast::Statement> ParseDottedIdsInMultExpr() {
-        vector<string> names = ParseDottedIds();
+        vector<intern::Symbol> names = ParseDottedIds();
 
         if (lexer_.CurrentToken() == '(') {
             // various calls
@@ -272,9 +385,9 @@ private:
                     make_unique<ast::VariableValue>(std::move(names)), std::move(method_name),
                     std::move(args));
             }
-            if (auto it = declared_classes_.find(method_name); it != declared_classes_.end()) {
+            if (const runtime::ObjectHolder* cls = FindClass(method_name.Name())) {
                 return make_unique<ast::NewInstance>(
-                    static_cast<const runtime::Class&>(*it->second), std::move(args));  // NOLINT
+                    static_cast<const runtime::Class&>(**cls), std::move(args));  // NOLINT
             }
             if (method_name == "str"sv) {
                 if (args.size() != 1) {
@@ -282,7 +395,7 @@ private:
                 }
                 return make_unique<ast::Stringify>(std::move(args.front()));
             }
-            throw ParseError("Unknown call to "s + method_name + "()"s);
+            throw ParseError("Unknown call to "s + method_name.Name() + "()"s);
         }
         return make_unique<ast::VariableValue>(std::move(names));
     }
@@ -365,33 +478,33 @@ private:
 
         if (tok == '<') {
             lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::Less, std::move(result),
-                                                ParseExpression());
+            return ast::Comparison::Create(runtime::CompareOp::LESS, std::move(result),
+                                           ParseExpression());
         }
         if (tok == '>') {
             lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::Greater, std::move(result),
-                                                ParseExpression());
+            return ast::Comparison::Create(runtime::CompareOp::GREATER, std::move(result),
+                                           ParseExpression());
         }
         if (tok.Is<TokenType::Eq>()) {
             lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::Equal, std::move(result),
-                                                ParseExpression());
+            return ast::Comparison::Create(runtime::CompareOp::EQUAL, std::move(result),
+                                           ParseExpression());
         }
         if (tok.Is<TokenType::NotEq>()) {
             lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::NotEqual, std::move(result),
-                                                ParseExpression());
+            return ast::Comparison::Create(runtime::CompareOp::NOT_EQUAL, std::move(result),
+                                           ParseExpression());
         }
         if (tok.Is<TokenType::LessOrEq>()) {
             lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::LessOrEqual, std::move(result),
-                                                ParseExpression());
+            return ast::Comparison::Create(runtime::CompareOp::LESS_OR_EQUAL, std::move(result),
+                                           ParseExpression());
         }
         if (tok.Is<TokenType::GreaterOrEq>()) {
             lexer_.NextToken();
-            return make_unique<ast::Comparison>(runtime::GreaterOrEqual, std::move(result),
-                                                ParseExpression());
+            return ast::Comparison::Create(runtime::CompareOp::GREATER_OR_EQUAL, std::move(result),
+                                           ParseExpression());
         }
         return result;
     }
@@ -437,12 +550,116 @@ private:
         return ParseAssignmentOrCall();
     }
 
+    // Ищет класс среди объявленных ранее в этом фрагменте, затем в предыдущих фрагментах
+    const runtime::ObjectHolder* FindClass(const string& name) const {
+        if (auto it = declared_classes_.find(name); it != declared_classes_.end()) {
+            return &it->second;
+        }
+        if (top_level_classes_ != nullptr) {
+            return top_level_classes_->FindBefore(chunk_, name);
+        }
+        return nullptr;
+    }
+
     parse::Lexer& lexer_;
+    shared_ptr<runtime::NodeArena> arena_;
     runtime::Closure declared_classes_;
+    TopLevelClassRegistry* top_level_classes_ = nullptr;
+    size_t chunk_ = 0;
+    size_t next_class_slot_ = 0;
 };
 
+// На один поток приходится несколько фрагментов, чтобы потоки были равномерно загружены
+constexpr size_t CHUNKS_PER_THREAD = 8;
+
 }  // namespace
 
 unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer) {
-    return Parser{lexer}.ParseProgram();
+    auto arena = make_shared<runtime::NodeArena>();
+    unique_ptr<ast::Statement> body;
+    {
+        runtime::ArenaScope scope(*arena);
+        body = Parser(lexer, arena).ParseProgram();
+    }
+    return make_unique<ast::Program>(vector{std::move(arena)}, std::move(body));
+}
+
+unique_ptr<runtime::Executable> ParseProgram(string_view program,
+                                             const ParallelParseOptions& options) {
+    const size_t thread_count
+        = options.thread_count != 0 ? options.thread_count
+                                    : max<size_t>(1, thread::hardware_concurrency());
+    const auto layout = parse::SplitTopLevel(
+        program, max(options.min_chunk_size, program.size() / (thread_count * CHUNKS_PER_THREAD)));
+    const size_t chunk_count = layout.chunks.size();
+
+    if (thread_count == 1 || chunk_count == 1 || !layout.splittable) {
+        parse::Lexer lexer(program);
+        return ParseProgram(lexer);
+    }
+
+    const size_t worker_count = min(thread_count, chunk_count);
+    // У каждого потока своя арена. Арены объявлены раньше узлов и разрушаются после них
+    vector<shared_ptr<runtime::NodeArena>> arenas(worker_count);
+    for (auto& arena : arenas) {
+        arena = make_shared<runtime::NodeArena>();
+    }
+    TopLevelClassRegistry top_level_classes(layout.classes);
+    vector<vector<unique_ptr<ast::Statement>>> chunk_statements(chunk_count);
+    vector<exception_ptr> chunk_errors(chunk_count);
+    atomic<size_t> next_chunk = 0;
+    atomic<size_t> first_error = chunk_count;
+
+    // Потоки берут фрагменты по порядку, поэтому фрагмент ждёт классы только
+    // из фрагментов, которые уже разбираются или разобраны
+    auto worker = [&](size_t worker_index) {
+        runtime::ArenaScope scope(*arenas[worker_index]);
+        for (size_t chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++) {
+            try {
+                if (chunk > first_error.load()) {
+                    // Ошибка в более раннем фрагменте всё равно будет выброшена первой
+                    throw ParseError("Skipped after an earlier error"s);
+                }
+                parse::Lexer lexer(layout.chunks[chunk]);
+                chunk_statements[chunk]
+                    = Parser(lexer, arenas[worker_index], top_level_classes, chunk)
+                          .ParseStatements();
+                top_level_classes.FailUnpublished(
+                    chunk, make_exception_ptr(logic_error("Class was not declared"s)));
+            } catch (...) {
+                chunk_errors[chunk] = current_exception();
+                top_level_classes.FailUnpublished(chunk, chunk_errors[chunk]);
+                for (size_t seen = first_error.load();
+                     chunk < seen && !first_error.compare_exchange_weak(seen, chunk);) {
+                }
+            }
+        }
+    };
+
+    vector<thread> threads;
+    for (size_t i = 1; i < worker_count; ++i) {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (thread& t : threads) {
+        t.join();
+    }
+
+    for (const exception_ptr& error : chunk_errors) {
+        if (error) {
+            rethrow_exception(error);
+        }
+    }
+
+    unique_ptr<ast::Compound> body;
+    {
+        runtime::ArenaScope scope(*arenas.front());
+        body = make_unique<ast::Compound>();
+        for (auto& statements : chunk_statements) {
+            for (auto& statement : statements) {
+                body->AddStatement(std::move(statement));
+            }
+        }
+    }
+    return make_unique<ast::Program>(std::move(arenas), std::move(body));
 }
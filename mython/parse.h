@@ -1,7 +1,9 @@
 ﻿#pragma once
 
+#include <cstddef>
 #include <memory>
 #include <stdexcept>
+#include <string_view>
 
 namespace parse {
 class Lexer;
@@ -16,3 +18,21 @@ struct ParseError : std::runtime_error {
 };
 
 std::unique_ptr<runtime::Executable> ParseProgram(parse::Lexer& lexer);
+
+// Параметры параллельного разбора
+struct ParallelParseOptions {
+    // Число потоков. 0 - по числу ядер процессора
+    size_t thread_count = 0;
+    // Минимальный размер фрагмента в байтах: на маленьких фрагментах накладные расходы
+    // на отдельный лексер и синхронизацию больше выигрыша
+    size_t min_chunk_size = 16 * 1024;
+};
+
+/*
+ * Разбирает программу параллельно: текст делится на фрагменты по строкам с нулевым отступом,
+ * фрагменты разбираются на нескольких потоках, а инструкции собираются в исходном порядке.
+ * Результат и ошибки те же, что у ParseProgram(Lexer&): выбрасывается ошибка, ближайшая
+ * к началу текста. Если текст нельзя разбить на фрагменты, он разбирается последовательно
+ */
+std::unique_ptr<runtime::Executable> ParseProgram(std::string_view program,
+                                                  const ParallelParseOptions& options = {});
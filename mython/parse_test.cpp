@@ -1,5 +1,6 @@
 ﻿#include "lexer.h"
 #include "parse.h"
+#include "prescan.h"
 #include "statement.h"
 #include "test_runner_p.h"
 
@@ -7,12 +8,6 @@ using namespace std;
 
 namespace parse {
 
-unique_ptr<ast::Statement> ParseProgramFromString(const string& program) {
-    istringstream is(program);
-    parse::Lexer lexer(is);
-    return ParseProgram(lexer);
-}
-
 void TestSimpleProgram() {
     const string program = R"(
 x = 4
@@ -273,6 +268,107 @@ print x
 //    ASSERT_EQUAL(context.output.str(),
 //                 "Rect(10x20) Circle(52) Triangle(3, 4, 5) Wrong triangle\n"s);
 }
+
+void TestClassOutlivesProgram() {
+    const string program = R"(
+class Greeter:
+  def greet(name):
+    return 'Hello, ' + name
+
+g = Greeter()
+)"s;
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    {
+        // Узлы программы размещены в арене, которую класс Greeter должен пережить
+        auto tree = ParseProgramFromString(program);
+        tree->Execute(closure, context);
+    }
+    auto* greeter = closure.at("g"s).TryAs<runtime::ClassInstance>();
+    ASSERT(greeter != nullptr);
+    ASSERT_EQUAL(greeter->Call("greet"s, {runtime::ObjectHolder::Own(runtime::String("arena"s))},
+                               context)
+                     .TryAs<runtime::String>()
+                     ->GetValue(),
+                 "Hello, arena"s);
+}
+
+// Разбирает программу параллельно, разбивая её на фрагменты по каждой строке без отступа
+string RunParallel(const string& program) {
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    ParseProgram(program, ParallelParseOptions{4, 0})->Execute(closure, context);
+    return context.output.str();
+}
+
+string ParallelParseError(const string& program) {
+    try {
+        ParseProgram(program, ParallelParseOptions{4, 0});
+    } catch (const exception& e) {
+        return e.what();
+    }
+    return {};
+}
+
+void TestParallelParse() {
+    string program = R"(
+class Shape:
+  def __str__():
+    return "Shape"
+
+class Rect(Shape):
+  def __init__(w, h):
+    self.w = w
+    self.h = h
+
+  def __str__():
+    return "Rect(" + str(self.w) + 'x' + str(self.h) + ')'
+s = 'строка,
+в которой есть строка без отступа'
+# комментарий
+if s:
+  print Rect(1, 2)
+else:
+  print Shape()
+)"s;
+    for (int i = 0; i < 50; ++i) {
+        const string n = to_string(i);
+        program += "class C"s + n + "(Rect):\n  def area():\n    return self.w * self.h\n"s;
+        program += "c = C"s + n + "("s + n + ", 2)\nprint c.area(), Shape()\n"s;
+    }
+
+    const TopLevelChunks layout = SplitTopLevel(program, 0);
+    ASSERT(layout.splittable);
+    ASSERT_EQUAL(layout.chunks.size(), 155U);
+    ASSERT_EQUAL(layout.classes.size(), 52U);
+
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    ParseProgramFromString(program)->Execute(closure, context);
+    ASSERT_EQUAL(RunParallel(program), context.output.str());
+}
+
+void TestParallelParseErrors() {
+    // Класс виден только после объявления, как и при последовательном разборе
+    ASSERT_EQUAL(ParallelParseError("x = A()\nclass A:\n  def f():\n    return 1\n"s),
+                 "Unknown call to A()"s);
+    ASSERT_EQUAL(ParallelParseError("class B(A):\n  def f():\n    return 1\n"
+                                    "class A:\n  def f():\n    return 1\n"s),
+                 "Base class A not found for class B"s);
+    ASSERT_EQUAL(ParallelParseError("class A:\n  def f():\n    return 1\nx = 1\n"
+                                    "class A:\n  def g():\n    return 1\n"s),
+                 "Class A already exists"s);
+    // Выбрасывается ошибка, ближайшая к началу программы
+    ASSERT_EQUAL(ParallelParseError("x = 1\ny = B()\nz = 2\nw = C()\n"s),
+                 "Unknown call to B()"s);
+
+    // Класс внутри блока объявляется посреди фрагмента, поэтому такая программа
+    // разбирается последовательно
+    const string nested
+        = "if True:\n  class A:\n    def f():\n      return 1\na = A()\nprint a.f()\n"s;
+    ASSERT(!SplitTopLevel(nested, 0).splittable);
+    ASSERT_EQUAL(RunParallel(nested), "1\n"s);
+}
 }  // namespace parse
 
 void TestParseProgram(TestRunner& tr) {
@@ -285,4 +381,7 @@ void TestParseProgram(TestRunner& tr) {
     RUN_TEST(tr, parse::TestComplexLogicalExpression);
     RUN_TEST(tr, parse::TestClassicalPolymorphism);
     RUN_TEST(tr, parse::Test64);
+    RUN_TEST(tr, parse::TestClassOutlivesProgram);
+    RUN_TEST(tr, parse::TestParallelParse);
+    RUN_TEST(tr, parse::TestParallelParseErrors);
 }
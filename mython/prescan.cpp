@@ -0,0 +1,164 @@
+﻿#include "prescan.h"
+
+#include "scan.h"
+
+using namespace std;
+
+namespace parse {
+
+namespace {
+
+bool IsIdChar(char c) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+}
+
+bool IsBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Проверяет, что с позиции pos начинается отдельное слово word
+bool StartsWithWord(string_view text, size_t pos, string_view word) {
+    return text.substr(pos, word.size()) == word
+           && (pos + word.size() == text.size() || !IsIdChar(text[pos + word.size()]));
+}
+
+// Строка, начинающаяся с pos, продолжает предыдущую, если та заканчивается пробелами:
+// пропуская их, лексер пропускает и переводы строк после них
+bool ContinuesPreviousLine(string_view text, size_t pos) {
+    while (pos > 0 && text[pos - 1] == '\n') {
+        --pos;
+    }
+    return pos > 0 && IsBlank(text[pos - 1]);
+}
+
+class Splitter {
+public:
+    Splitter(string_view text, size_t min_chunk_size)
+        : text_(text)
+        , min_chunk_size_(min_chunk_size)
+        , kernels_(scan::ActiveKernels()) {
+    }
+
+    TopLevelChunks Split() && {
+        size_t pos = 0;
+        while (pos < text_.size()) {
+            OnLineStart(pos);
+            pos = SkipLine(pos);
+        }
+        result_.chunks.push_back(text_.substr(chunk_begin_));
+        return std::move(result_);
+    }
+
+private:
+    void OnLineStart(size_t pos) {
+        const char c = text_[pos];
+        if (IsBlank(c)) {
+            const size_t first = SkipBlanks(pos);
+            if (!seen_line_ || StartsWithWord(text_, first, "class"sv)) {
+                result_.splittable = false;
+            }
+            seen_line_ = true;
+            if (first < text_.size() && text_[first] == '#') {
+                after_comment_ = true;
+            } else if (first < text_.size() && text_[first] != '\n') {
+                after_indented_code_ = true;
+            }
+            return;
+        }
+        if (c == '\n') {
+            return;
+        }
+        seen_line_ = true;
+        if (c == '#') {
+            after_comment_ = after_comment_ || after_indented_code_;
+            return;
+        }
+        if (pos - chunk_begin_ >= min_chunk_size_ && pos > 0 && !StartsWithWord(text_, pos, "else"sv)
+            && !after_comment_ && !ContinuesPreviousLine(text_, pos)) {
+            result_.chunks.push_back(text_.substr(chunk_begin_, pos - chunk_begin_));
+            chunk_begin_ = pos;
+        }
+        after_comment_ = false;
+        after_indented_code_ = false;
+        if (StartsWithWord(text_, pos, "class"sv)) {
+            AddClass(pos + "class"sv.size());
+        }
+    }
+
+    void AddClass(size_t pos) {
+        while (pos < text_.size() && text_[pos] == ' ') {
+            ++pos;
+        }
+        size_t end = pos;
+        while (end < text_.size() && IsIdChar(text_[end])) {
+            ++end;
+        }
+        if (end != pos) {
+            result_.classes.push_back({text_.substr(pos, end - pos), result_.chunks.size()});
+        }
+    }
+
+    size_t SkipBlanks(size_t pos) const {
+        pos = kernels_.skip_spaces(text_.data() + pos, text_.data() + text_.size()) - text_.data();
+        while (pos < text_.size() && IsBlank(text_[pos])) {
+            ++pos;
+        }
+        return pos;
+    }
+
+    // Возвращает позицию начала следующей строки. Переводы строк внутри
+    // строковых констант и комментариев строку не завершают
+    size_t SkipLine(size_t pos) const {
+        const char* end = text_.data() + text_.size();
+        while (pos < text_.size()) {
+            const char c = text_[pos];
+            if (c == '\n') {
+                return pos + 1;
+            }
+            if (c == '#') {
+                pos = kernels_.find_newline(text_.data() + pos, end) - text_.data();
+            } else if (c == '\'' || c == '"') {
+                pos = SkipString(pos);
+            } else {
+                ++pos;
+            }
+        }
+        return pos;
+    }
+
+    size_t SkipString(size_t pos) const {
+        const char quote = text_[pos++];
+        const char* end = text_.data() + text_.size();
+        while (pos < text_.size()) {
+            pos = kernels_.find_quote_or_backslash(text_.data() + pos, end, quote) - text_.data();
+            if (pos == text_.size()) {
+                break;
+            }
+            if (text_[pos] == quote) {
+                return pos + 1;
+            }
+            pos += 2;
+        }
+        return text_.size();
+    }
+
+    string_view text_;
+    size_t min_chunk_size_;
+    const scan::Kernels& kernels_;
+    size_t chunk_begin_ = 0;
+    // в начале текста отступ задаёт точку отсчёта для лексера
+    bool seen_line_ = false;
+    // после строки из одного комментария, идущей за блоком или с отступом,
+    // лексер иначе закрывает блоки
+    bool after_comment_ = false;
+    bool after_indented_code_ = false;
+    TopLevelChunks result_;
+};
+
+}  // namespace
+
+TopLevelChunks SplitTopLevel(std::string_view text, size_t min_chunk_size) {
+    return Splitter(text, min_chunk_size).Split();
+}
+
+}  // namespace parse
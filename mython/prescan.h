@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace parse {
+
+// Класс, объявленный в начале строки (на нулевом уровне отступа)
+struct TopLevelClass {
+    std::string_view name;  // имя класса
+    size_t chunk;           // номер фрагмента, в котором находится объявление
+};
+
+// Разбиение текста программы на независимо разбираемые фрагменты
+struct TopLevelChunks {
+    // Фрагменты в порядке следования в тексте. Вместе покрывают весь текст
+    std::vector<std::string_view> chunks;
+    // Классы верхнего уровня в порядке объявления
+    std::vector<TopLevelClass> classes;
+    // Фрагменты можно разбирать независимо. Это не так, если в тексте есть объявление
+    // класса внутри блока (класс становится виден в середине фрагмента) или если первая
+    // строка программы начинается с отступа (лексер отсчитывает отступы от него)
+    bool splittable = true;
+};
+
+/*
+ * Быстрый предварительный просмотр текста без построения токенов.
+ * Фрагмент начинается со строки, которая начинается с нулевого отступа: к этому месту
+ * лексер закрывает все блоки, и разбор можно начать заново отдельным лексером.
+ * Границей не считаются строки else, строки внутри многострочных строковых констант,
+ * строки, перед которыми стоят пробелы в конце предыдущей строки (лексер склеивает такие строки),
+ * и строки сразу после строки из одного комментария (после неё лексер иначе закрывает блоки).
+ * Соседние границы объединяются так, чтобы фрагмент был не короче min_chunk_size байт
+ */
+TopLevelChunks SplitTopLevel(std::string_view text, size_t min_chunk_size);
+
+}  // namespace parse
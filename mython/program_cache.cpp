@@ -0,0 +1,706 @@
+﻿#include "program_cache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MYTHON_CACHE_MMAP 1
+#endif
+
+using namespace std;
+
+namespace cache {
+
+namespace {
+
+// Начало каждого файла: сигнатура и версия формата
+constexpr char MAGIC[8] = {'M', 'Y', 'T', 'H', 'O', 'N', 'C', '\0'};
+
+// Вид узла в сериализованном дереве
+enum class Tag : uint8_t {
+    NO_STATEMENT,  // отсутствующий необязательный узел (ветка else, тело метода)
+    COMPOUND,
+    METHOD_BODY,
+    ASSIGNMENT,
+    VARIABLE,
+    FIELD_ASSIGNMENT,
+    METHOD_CALL,
+    NEW_INSTANCE,
+    PRINT_ONE,
+    PRINT,
+    IF_ELSE,
+    RETURN,
+    COMPARISON,
+    ADD,
+    SUB,
+    MULT,
+    DIV,
+    OR,
+    AND,
+    STRINGIFY,
+    NOT,
+    NUMBER,
+    STRING,
+    BOOL,
+    NONE,
+    CLASS_DEFINITION,
+};
+
+constexpr uint32_t NO_CLASS = UINT32_MAX;
+
+using ComparatorFunction = bool (*)(const runtime::ObjectHolder&, const runtime::ObjectHolder&,
+                                    runtime::Context&);
+
+// Функции сравнения, которые подставляет парсер. В файле хранится номер функции в этом массиве
+const ComparatorFunction COMPARATORS[] = {
+    runtime::Equal,   runtime::NotEqual,    runtime::Less,
+    runtime::Greater, runtime::LessOrEqual, runtime::GreaterOrEqual,
+};
+
+/*
+ * Содержимое файла. Где есть mmap, файл отображается в память,
+ * иначе читается целиком
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const filesystem::path& path) {
+#ifdef MYTHON_CACHE_MMAP
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info {};
+        if (::fstat(fd, &info) == 0) {
+            size_ = static_cast<size_t>(info.st_size);
+            if (size_ == 0) {
+                open_ = true;
+            } else if (void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                       data != MAP_FAILED) {
+                data_ = data;
+                open_ = true;
+            }
+        }
+        ::close(fd);
+#else
+        ifstream input(path, ios::binary);
+        if (input) {
+            contents_.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+            open_ = true;
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifdef MYTHON_CACHE_MMAP
+        if (data_ != nullptr) {
+            ::munmap(data_, size_);
+        }
+#endif
+    }
+
+    [[nodiscard]] bool IsOpen() const {
+        return open_;
+    }
+
+    [[nodiscard]] string_view Data() const {
+#ifdef MYTHON_CACHE_MMAP
+        return {static_cast<const char*>(data_), size_};
+#else
+        return contents_;
+#endif
+    }
+
+private:
+    bool open_ = false;
+#ifdef MYTHON_CACHE_MMAP
+    void* data_ = nullptr;
+    size_t size_ = 0;
+#else
+    string contents_;
+#endif
+};
+
+/*
+ * Файл каталога: длина исходного текста (8 байт), сам текст, затем данные Serialize.
+ * Имя файла - лишь 64-битный хеш, поэтому текст сверяется перед загрузкой:
+ * при совпадении хешей разных текстов выполнится тот, что передан, а не чужой
+ */
+string MakeEntry(string_view source, string_view data) {
+    const uint64_t size = source.size();
+    string entry(sizeof(size), '\0');
+    memcpy(entry.data(), &size, sizeof(size));
+    entry.reserve(entry.size() + source.size() + data.size());
+    entry.append(source);
+    entry.append(data);
+    return entry;
+}
+
+// Данные Serialize из файла каталога, если он записан для текста source, иначе nullopt
+optional<string_view> EntryData(string_view entry, string_view source) {
+    uint64_t size = 0;
+    if (entry.size() < sizeof(size)) {
+        return nullopt;
+    }
+    memcpy(&size, entry.data(), sizeof(size));
+    entry.remove_prefix(sizeof(size));
+    if (size != source.size() || entry.substr(0, source.size()) != source) {
+        return nullopt;
+    }
+    return entry.substr(source.size());
+}
+
+// Случайная часть имени временного файла: одновременно записывающие процессы
+// и потоки не пишут в один файл
+string UniqueSuffix() {
+    thread_local mt19937_64 generator{(static_cast<uint64_t>(random_device{}()) << 32)
+                                      ^ random_device{}()};
+    char suffix[24];
+    snprintf(suffix, sizeof(suffix), ".%016llx",
+             static_cast<unsigned long long>(generator()));
+    return suffix;
+}
+
+// Восстанавливает программу из данных, записанных Writer
+class Reader {
+public:
+    explicit Reader(string_view data)
+        : data_(data) {
+    }
+
+    unique_ptr<ast::Statement> ReadProgram() {
+        if (GetBytes(sizeof(MAGIC)) != string_view(MAGIC, sizeof(MAGIC))) {
+            throw FormatError("Not a compiled Mython program"s);
+        }
+        if (const uint32_t version = Get32(); version != FORMAT_VERSION) {
+            throw FormatError("Unsupported compiled program version "s + to_string(version));
+        }
+        const uint32_t symbol_count = GetCount();
+        symbols_.reserve(symbol_count);
+        for (uint32_t i = 0; i < symbol_count; ++i) {
+            symbols_.emplace_back(GetBytes(Get32()));
+        }
+
+        unique_ptr<ast::Statement> body;
+        {
+            runtime::ArenaScope scope(*arena_);
+            body = Read();
+        }
+        if (pos_ != data_.size()) {
+            throw FormatError("Unexpected data after the program"s);
+        }
+        return make_unique<ast::Program>(vector{std::move(arena_)}, std::move(body));
+    }
+
+private:
+    string_view GetBytes(size_t count) {
+        if (data_.size() - pos_ < count) {
+            throw FormatError("Compiled program is truncated"s);
+        }
+        const string_view result = data_.substr(pos_, count);
+        pos_ += count;
+        return result;
+    }
+
+    uint8_t Get8() {
+        return static_cast<uint8_t>(GetBytes(1)[0]);
+    }
+
+    uint32_t Get32() {
+        uint32_t value = 0;
+        memcpy(&value, GetBytes(sizeof(value)).data(), sizeof(value));
+        return value;
+    }
+
+    // Длина списка. Каждый элемент занимает хотя бы байт, поэтому длина не больше остатка данных
+    uint32_t GetCount() {
+        const uint32_t count = Get32();
+        if (count > data_.size() - pos_) {
+            throw FormatError("Compiled program is truncated"s);
+        }
+        return count;
+    }
+
+    int GetInt() {
+        return static_cast<int>(static_cast<int32_t>(Get32()));
+    }
+
+    intern::Symbol GetSymbol() {
+        const uint32_t index = Get32();
+        if (index >= symbols_.size()) {
+            throw FormatError("Bad symbol index"s);
+        }
+        return symbols_[index];
+    }
+
+    const runtime::Class* GetClass() {
+        const uint32_t index = Get32();
+        if (index == NO_CLASS) {
+            return nullptr;
+        }
+        if (index >= classes_.size()) {
+            throw FormatError("Bad class index"s);
+        }
+        return classes_[index];
+    }
+
+    unique_ptr<ast::Statement> Read() {
+        auto result = ReadOptional();
+        if (!result) {
+            throw FormatError("Missing statement"s);
+        }
+        return result;
+    }
+
+    vector<unique_ptr<ast::Statement>> ReadList() {
+        vector<unique_ptr<ast::Statement>> result(GetCount());
+        for (auto& statement : result) {
+            statement = Read();
+        }
+        return result;
+    }
+
+    vector<intern::Symbol> ReadSymbols() {
+        vector<intern::Symbol> result(GetCount());
+        for (auto& symbol : result) {
+            symbol = GetSymbol();
+        }
+        return result;
+    }
+
+    template <typename Operation>
+    unique_ptr<ast::Statement> ReadBinary() {
+        auto lhs = Read();
+        return make_unique<Operation>(std::move(lhs), Read());
+    }
+
+    unique_ptr<ast::Statement> ReadOptional() {
+        switch (static_cast<Tag>(Get8())) {
+            case Tag::NO_STATEMENT:
+                return nullptr;
+            case Tag::COMPOUND: {
+                auto result = make_unique<ast::Compound>();
+                for (auto& statement : ReadList()) {
+                    result->AddStatement(std::move(statement));
+                }
+                return result;
+            }
+            case Tag::METHOD_BODY:
+                return make_unique<ast::MethodBody>(Read());
+            case Tag::ASSIGNMENT: {
+                const intern::Symbol var = GetSymbol();
+                return make_unique<ast::Assignment>(var, Read());
+            }
+            case Tag::VARIABLE:
+                return make_unique<ast::VariableValue>(ReadSymbols());
+            case Tag::FIELD_ASSIGNMENT: {
+                ast::VariableValue object(ReadSymbols());
+                const intern::Symbol field = GetSymbol();
+                return make_unique<ast::FieldAssignment>(std::move(object), field, Read());
+            }
+            case Tag::METHOD_CALL: {
+                auto object = Read();
+                const intern::Symbol method = GetSymbol();
+                return make_unique<ast::MethodCall>(std::move(object), method, ReadList());
+            }
+            case Tag::NEW_INSTANCE: {
+                const runtime::Class* cls = GetClass();
+                if (cls == nullptr) {
+                    throw FormatError("Missing class of a new instance"s);
+                }
+                return make_unique<ast::NewInstance>(*cls, ReadList());
+            }
+            case Tag::PRINT_ONE:
+                return make_unique<ast::Print>(Read());
+            case Tag::PRINT:
+                return make_unique<ast::Print>(ReadList());
+            case Tag::IF_ELSE: {
+                auto condition = Read();
+                auto if_body = Read();
+                return make_unique<ast::IfElse>(std::move(condition), std::move(if_body),
+                                                ReadOptional());
+            }
+            case Tag::RETURN:
+                return make_unique<ast::Return>(Read());
+            case Tag::COMPARISON: {
+                const uint32_t index = Get8();
+                if (index >= size(COMPARATORS)) {
+                    throw FormatError("Bad comparator index"s);
+                }
+                auto lhs = Read();
+                return ast::Comparison::Create(static_cast<runtime::CompareOp>(index),
+                                               std::move(lhs), Read());
+            }
+            case Tag::ADD:
+                return ReadBinary<ast::Add>();
+            case Tag::SUB:
+                return ReadBinary<ast::Sub>();
+            case Tag::MULT:
+                return ReadBinary<ast::Mult>();
+            case Tag::DIV:
+                return ReadBinary<ast::Div>();
+            case Tag::OR:
+                return ReadBinary<ast::Or>();
+            case Tag::AND:
+                return ReadBinary<ast::And>();
+            case Tag::STRINGIFY:
+                return make_unique<ast::Stringify>(Read());
+            case Tag::NOT:
+                return make_unique<ast::Not>(Read());
+            case Tag::NUMBER:
+                return make_unique<ast::NumericConst>(runtime::Number(GetInt()));
+            case Tag::STRING:
+                return make_unique<ast::StringConst>(runtime::String(string(GetBytes(Get32()))));
+            case Tag::BOOL:
+                return make_unique<ast::BoolConst>(runtime::Bool(Get8() != 0));
+            case Tag::NONE:
+                return make_unique<ast::None>();
+            case Tag::CLASS_DEFINITION:
+                return ReadClassDefinition();
+        }
+        throw FormatError("Unknown statement tag"s);
+    }
+
+    unique_ptr<ast::Statement> ReadClassDefinition() {
+        const intern::Symbol name = GetSymbol();
+        const runtime::Class* parent = GetClass();
+        vector<runtime::Method> methods(GetCount());
+        for (auto& method : methods) {
+            method.name = GetSymbol();
+            method.formal_params = ReadSymbols();
+            method.body = ReadOptional();
+        }
+        auto cls = runtime::ObjectHolder::Own(
+            runtime::Class(name.Name(), std::move(methods), parent, arena_));
+        classes_.push_back(cls.TryAs<runtime::Class>());
+        return make_unique<ast::ClassDefinition>(std::move(cls));
+    }
+
+    string_view data_;
+    size_t pos_ = 0;
+    vector<intern::Symbol> symbols_;
+    vector<const runtime::Class*> classes_;
+    shared_ptr<runtime::NodeArena> arena_ = make_shared<runtime::NodeArena>();
+};
+
+}  // namespace
+
+/*
+ * Записывает дерево программы. Имена собираются в таблицу и в узлах заменяются номерами,
+ * классы нумеруются в порядке объявления. Числа записываются в порядке байтов машины
+ */
+class Writer {
+public:
+    void Write(const ast::Statement& statement) {
+        if (const auto* node = As<ast::Program>(statement)) {
+            // Арены не сериализуются: при чтении узлы размещаются в новой
+            Write(*node->body_);
+        } else if (const auto* node = As<ast::MethodBody>(statement)) {
+            PutTag(Tag::METHOD_BODY);
+            Write(*node->body_);
+        } else if (const auto* node = As<ast::Compound>(statement)) {
+            PutTag(Tag::COMPOUND);
+            WriteList(node->stmts_);
+        } else if (const auto* node = As<ast::Assignment>(statement)) {
+            PutTag(Tag::ASSIGNMENT);
+            PutSymbol(node->var_);
+            Write(*node->rv_);
+        } else if (const auto* node = As<ast::VariableValue>(statement)) {
+            PutTag(Tag::VARIABLE);
+            WriteSymbols(node->dotted_ids_);
+        } else if (const auto* node = As<ast::FieldAssignment>(statement)) {
+            PutTag(Tag::FIELD_ASSIGNMENT);
+            WriteSymbols(node->object_.dotted_ids_);
+            PutSymbol(node->field_name_);
+            Write(*node->rv_);
+        } else if (const auto* node = As<ast::MethodCall>(statement)) {
+            PutTag(Tag::METHOD_CALL);
+            Write(*node->object_);
+            PutSymbol(node->method_);
+            WriteList(node->args_);
+        } else if (const auto* node = As<ast::NewInstance>(statement)) {
+            PutTag(Tag::NEW_INSTANCE);
+            PutClass(node->cls_);
+            // Вызов без скобок и вызов с пустым списком аргументов выполняются одинаково
+            WriteOptionalList(node->args_);
+        } else if (const auto* node = As<ast::Print>(statement)) {
+            if (node->argument_) {
+                PutTag(Tag::PRINT_ONE);
+                Write(**node->argument_);
+            } else {
+                PutTag(Tag::PRINT);
+                WriteOptionalList(node->args_);
+            }
+        } else if (const auto* node = As<ast::IfElse>(statement)) {
+            PutTag(Tag::IF_ELSE);
+            Write(*node->condition_);
+            Write(*node->if_body_);
+            WriteOptional(node->else_body_.get());
+        } else if (const auto* node = As<ast::Return>(statement)) {
+            PutTag(Tag::RETURN);
+            Write(*node->statement_);
+        } else if (const auto* node = As<ast::Add>(statement)) {
+            WriteBinary(Tag::ADD, *node);
+        } else if (const auto* node = As<ast::Sub>(statement)) {
+            WriteBinary(Tag::SUB, *node);
+        } else if (const auto* node = As<ast::Mult>(statement)) {
+            WriteBinary(Tag::MULT, *node);
+        } else if (const auto* node = As<ast::Div>(statement)) {
+            WriteBinary(Tag::DIV, *node);
+        } else if (const auto* node = As<ast::Or>(statement)) {
+            WriteBinary(Tag::OR, *node);
+        } else if (const auto* node = As<ast::And>(statement)) {
+            WriteBinary(Tag::AND, *node);
+        } else if (const auto* node = As<ast::Stringify>(statement)) {
+            PutTag(Tag::STRINGIFY);
+            Write(*node->argument_);
+        } else if (const auto* node = As<ast::Not>(statement)) {
+            PutTag(Tag::NOT);
+            Write(*node->argument_);
+        } else if (const auto* node = As<ast::NumericConst>(statement)) {
+            PutTag(Tag::NUMBER);
+            Put32(static_cast<uint32_t>(static_cast<int32_t>(node->value_.GetValue())));
+        } else if (const auto* node = As<ast::StringConst>(statement)) {
+            PutTag(Tag::STRING);
+            PutBytes(node->value_.GetValue());
+        } else if (const auto* node = As<ast::BoolConst>(statement)) {
+            PutTag(Tag::BOOL);
+            Put8(node->value_.GetValue() ? 1 : 0);
+        } else if (As<ast::None>(statement) != nullptr) {
+            PutTag(Tag::NONE);
+        } else if (const auto* node = As<ast::ClassDefinition>(statement)) {
+            WriteClassDefinition(*node->cls_.TryAs<runtime::Class>());
+        } else if (const auto* node = dynamic_cast<const ast::Comparison*>(&statement)) {
+            // узлы сравнения специализированы по операции, поэтому проверяются через базовый класс
+            PutTag(Tag::COMPARISON);
+            Put8(node->op_ ? static_cast<uint8_t>(*node->op_) : ComparatorIndex(node->cmp_));
+            Write(*node->lhs_);
+            Write(*node->rhs_);
+        } else {
+            throw logic_error("Statement can't be serialized"s);
+        }
+    }
+
+    // Возвращает данные файла: заголовок, таблицу имён и дерево
+    string Finish() const {
+        string result(MAGIC, sizeof(MAGIC));
+        AppendRaw(result, FORMAT_VERSION);
+        AppendRaw(result, static_cast<uint32_t>(symbols_.size()));
+        for (const intern::Symbol& symbol : symbols_) {
+            AppendRaw(result, static_cast<uint32_t>(symbol.Name().size()));
+            result += symbol.Name();
+        }
+        result += body_;
+        return result;
+    }
+
+private:
+    // Узлы парсера, кроме сравнений, не наследуются друг от друга, поэтому тип узла
+    // проверяется точным сравнением: это заметно дешевле цепочки dynamic_cast на больших программах
+    template <typename T>
+    static const T* As(const ast::Statement& statement) {
+        return typeid(statement) == typeid(T) ? static_cast<const T*>(&statement) : nullptr;
+    }
+
+    template <typename T>
+    static void AppendRaw(string& out, T value) {
+        char bytes[sizeof(T)];
+        memcpy(bytes, &value, sizeof(T));
+        out.append(bytes, sizeof(T));
+    }
+
+    void Put8(uint8_t value) {
+        body_.push_back(static_cast<char>(value));
+    }
+
+    void Put32(uint32_t value) {
+        AppendRaw(body_, value);
+    }
+
+    void PutTag(Tag tag) {
+        Put8(static_cast<uint8_t>(tag));
+    }
+
+    void PutBytes(string_view bytes) {
+        Put32(static_cast<uint32_t>(bytes.size()));
+        body_ += bytes;
+    }
+
+    void PutSymbol(intern::Symbol symbol) {
+        auto [it, inserted] = symbol_index_.emplace(symbol.Id(), symbols_.size());
+        if (inserted) {
+            symbols_.push_back(symbol);
+        }
+        Put32(it->second);
+    }
+
+    void PutClass(const runtime::Class* cls) {
+        if (cls == nullptr) {
+            Put32(NO_CLASS);
+            return;
+        }
+        const auto it = class_index_.find(cls);
+        if (it == class_index_.end()) {
+            throw logic_error("Class "s + cls->GetName() + " is not declared in the program"s);
+        }
+        Put32(it->second);
+    }
+
+    template <typename Symbols>
+    void WriteSymbols(const Symbols& symbols) {
+        Put32(static_cast<uint32_t>(symbols.size()));
+        for (const intern::Symbol& symbol : symbols) {
+            PutSymbol(symbol);
+        }
+    }
+
+    void WriteList(const ast::StatementList& statements) {
+        Put32(static_cast<uint32_t>(statements.size()));
+        for (const auto& statement : statements) {
+            Write(*statement);
+        }
+    }
+
+    void WriteOptionalList(const optional<ast::StatementList>& statements) {
+        if (statements) {
+            WriteList(*statements);
+        } else {
+            Put32(0);
+        }
+    }
+
+    void WriteOptional(const ast::Statement* statement) {
+        if (statement == nullptr) {
+            PutTag(Tag::NO_STATEMENT);
+        } else {
+            Write(*statement);
+        }
+    }
+
+    void WriteBinary(Tag tag, const ast::BinaryOperation& node) {
+        PutTag(tag);
+        Write(*node.lhs_);
+        Write(*node.rhs_);
+    }
+
+    void WriteClassDefinition(runtime::Class& cls) {
+        PutTag(Tag::CLASS_DEFINITION);
+        PutSymbol(cls.GetName());
+        PutClass(cls.GetParent());
+        uint32_t method_count = 0;
+        cls.ForEachMethod([&method_count](runtime::Method&) {
+            ++method_count;
+        });
+        Put32(method_count);
+        cls.ForEachMethod([this](runtime::Method& method) {
+            PutSymbol(method.name);
+            WriteSymbols(method.formal_params);
+            WriteOptional(method.body.get());
+        });
+        // Номер класса присваивается после методов, как и при чтении
+        class_index_.emplace(&cls, static_cast<uint32_t>(class_index_.size()));
+    }
+
+    static uint8_t ComparatorIndex(const ast::Comparison::Comparator& comparator) {
+        if (const auto* function = comparator.target<ComparatorFunction>()) {
+            for (size_t i = 0; i < size(COMPARATORS); ++i) {
+                if (*function == COMPARATORS[i]) {
+                    return static_cast<uint8_t>(i);
+                }
+            }
+        }
+        throw logic_error("Comparator can't be serialized"s);
+    }
+
+    string body_;
+    vector<intern::Symbol> symbols_;
+    unordered_map<uint32_t, uint32_t> symbol_index_;
+    unordered_map<const runtime::Class*, uint32_t> class_index_;
+};
+
+uint64_t HashSource(string_view source) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char c : source) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+string Serialize(const ast::Statement& program) {
+    Writer writer;
+    writer.Write(program);
+    return writer.Finish();
+}
+
+unique_ptr<ast::Statement> Deserialize(string_view data) {
+    return Reader(data).ReadProgram();
+}
+
+ProgramCache::ProgramCache(filesystem::path directory)
+    : directory_(std::move(directory)) {
+}
+
+filesystem::path ProgramCache::PathFor(string_view source) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.myc",
+             static_cast<unsigned long long>(HashSource(source)));
+    return directory_ / name;
+}
+
+unique_ptr<ast::Statement> ProgramCache::Load(string_view source) const {
+    const MappedFile file(PathFor(source));
+    if (!file.IsOpen()) {
+        return nullptr;
+    }
+    const optional<string_view> data = EntryData(file.Data(), source);
+    if (!data) {
+        // Файл записан для другого текста с тем же хешем
+        return nullptr;
+    }
+    try {
+        return Deserialize(*data);
+    } catch (const FormatError&) {
+        // Файл другой версии либо повреждён - программа будет разобрана заново
+        return nullptr;
+    }
+}
+
+void ProgramCache::Store(string_view source, const ast::Statement& program) const {
+    const string data = MakeEntry(source, Serialize(program));
+    filesystem::create_directories(directory_);
+
+    const filesystem::path path = PathFor(source);
+    filesystem::path temporary = path;
+    temporary += UniqueSuffix() + ".tmp"s;
+    try {
+        {
+            ofstream output(temporary, ios::binary | ios::trunc);
+            output.write(data.data(), static_cast<streamsize>(data.size()));
+            if (!output) {
+                throw runtime_error("Can't write "s + temporary.string());
+            }
+        }
+        // Переименование целиком заменяет файл, записанный другим процессом
+        filesystem::rename(temporary, path);
+    } catch (...) {
+        error_code ignored;
+        filesystem::remove(temporary, ignored);
+        throw;
+    }
+}
+
+}  // namespace cache
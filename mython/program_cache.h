@@ -0,0 +1,61 @@
+﻿#pragma once
+
+#include "statement.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace cache {
+
+// Версия формата. Увеличивается при любом изменении сериализации узлов
+inline constexpr uint32_t FORMAT_VERSION = 1;
+
+// Данные не являются разобранной программой текущей версии формата
+class FormatError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Хеш содержимого исходного текста (FNV-1a, 64 бита)
+uint64_t HashSource(std::string_view source);
+
+/*
+ * Сериализует разобранную программу: таблицу имён, классы с телами методов и дерево инструкций.
+ * Дерево должно состоять из узлов, которые создаёт парсер
+ */
+std::string Serialize(const ast::Statement& program);
+
+// Восстанавливает программу, сериализованную Serialize. Узлы размещаются в новой арене.
+// При повреждённых данных либо другой версии формата выбрасывает FormatError
+std::unique_ptr<ast::Statement> Deserialize(std::string_view data);
+
+/*
+ * Каталог разобранных программ. Программа хранится в файле, имя которого - хеш исходного текста,
+ * поэтому неизменённый текст повторно не разбирается. Вместе с программой хранится и сам текст:
+ * файл загружается, только если текст совпал, а не один лишь хеш
+ */
+class ProgramCache {
+public:
+    explicit ProgramCache(std::filesystem::path directory);
+
+    // Путь к файлу программы с исходным текстом source
+    [[nodiscard]] std::filesystem::path PathFor(std::string_view source) const;
+
+    // Загружает программу с исходным текстом source.
+    // Возвращает nullptr, если её нет в каталоге, файл записан для другого текста
+    // с тем же хешем, устарел либо повреждён
+    [[nodiscard]] std::unique_ptr<ast::Statement> Load(std::string_view source) const;
+
+    // Сохраняет разобранную программу с исходным текстом source.
+    // Файл записывается целиком под временным именем и затем переименовывается
+    void Store(std::string_view source, const ast::Statement& program) const;
+
+private:
+    std::filesystem::path directory_;
+};
+
+}  // namespace cache
@@ -0,0 +1,128 @@
+﻿#include "program_cache.h"
+#include "test_runner_p.h"
+
+#include <fstream>
+#include <random>
+
+using namespace std;
+
+namespace cache {
+
+namespace {
+
+const string PROGRAM = R"(
+class Shape:
+  def __init__(name):
+    self.name = name
+
+  def __str__():
+    return 'Shape ' + self.name
+
+  def area():
+    return None
+
+class Rect(Shape):
+  def __init__(w, h):
+    self.name = 'rect'
+    self.w = w
+    self.h = h
+
+  def area():
+    return self.w * self.h
+
+  def __lt__(other):
+    return self.area() < other.area()
+
+class Printer:
+  def show(value):
+    if value:
+      print value
+    else:
+      print 'nothing'
+
+r = Rect(2, -3)
+s = Shape('blob')
+p = Printer()
+p.show(r.area())
+p.show(s.area())
+print r, s, r < Rect(1, 1), not r.area() == -6, r.area() >= -6 and True, str(r.w) + "!"
+r.w = 4 / 2 + 1 - 1
+print r.w, r.area() > 0 or False, r.area() <= 0, r.area() != 1
+x = None
+print x
+)";
+
+void TestRoundTrip() {
+    auto parsed = ParseProgramFromString(PROGRAM);
+    const string data = Serialize(*parsed);
+
+    auto restored = Deserialize(data);
+    ASSERT_EQUAL(RunProgram(*restored), RunProgram(*ParseProgramFromString(PROGRAM)));
+    // Повторная сериализация восстановленной программы даёт те же данные
+    ASSERT_EQUAL(Serialize(*restored), data);
+}
+
+void TestBadDataIsRejected() {
+    const string data = Serialize(*ParseProgramFromString(PROGRAM));
+
+    ASSERT_THROWS(Deserialize(""sv), FormatError);
+    ASSERT_THROWS(Deserialize(string_view(data).substr(0, data.size() - 1)), FormatError);
+    ASSERT_THROWS(Deserialize(data + "x"s), FormatError);
+
+    string other_version = data;
+    other_version[8] = static_cast<char>(FORMAT_VERSION + 1);
+    ASSERT_THROWS(Deserialize(other_version), FormatError);
+}
+
+// Новый пустой каталог. Тесты выполняются при каждом запуске интерпретатора,
+// поэтому у одновременно запущенных процессов каталоги разные
+filesystem::path MakeTestDirectory() {
+    random_device random;
+    for (;;) {
+        const auto directory = filesystem::temp_directory_path()
+                               / ("mython_cache_test_"s + to_string(random()) + "_"s
+                                  + to_string(random()));
+        if (filesystem::create_directory(directory)) {
+            return directory;
+        }
+    }
+}
+
+void TestCacheDirectory() {
+    const auto directory = MakeTestDirectory();
+    const ProgramCache cache(directory);
+
+    ASSERT(cache.Load(PROGRAM) == nullptr);
+    cache.Store(PROGRAM, *ParseProgramFromString(PROGRAM));
+    ASSERT(filesystem::exists(cache.PathFor(PROGRAM)));
+
+    auto loaded = cache.Load(PROGRAM);
+    ASSERT(loaded != nullptr);
+    ASSERT_EQUAL(RunProgram(*loaded), RunProgram(*ParseProgramFromString(PROGRAM)));
+
+    // Изменённый текст ищется под другим именем
+    ASSERT(cache.PathFor(PROGRAM + "print 1\n"s) != cache.PathFor(PROGRAM));
+    ASSERT(cache.Load(PROGRAM + "print 1\n"s) == nullptr);
+
+    // Файл другого текста под тем же именем (совпадение хешей) не загружается
+    const string other = "print 'other'\n"s;
+    cache.Store(other, *ParseProgramFromString(other));
+    filesystem::rename(cache.PathFor(other), cache.PathFor(PROGRAM));
+    ASSERT(cache.Load(PROGRAM) == nullptr);
+
+    // Повреждённый файл считается отсутствующим
+    ofstream(cache.PathFor(PROGRAM), ios::binary | ios::trunc) << "garbage"s;
+    ASSERT(cache.Load(PROGRAM) == nullptr);
+
+    filesystem::remove_all(directory);
+}
+
+}  // namespace
+
+void RunProgramCacheTests(TestRunner& tr) {
+    RUN_TEST(tr, cache::TestRoundTrip);
+    RUN_TEST(tr, cache::TestBadDataIsRejected);
+    RUN_TEST(tr, cache::TestCacheDirectory);
+}
+
+}  // namespace cache
@@ -1,14 +1,29 @@
 ﻿#include "runtime.h"
 
-#include <algorithm>
+#include "arena.h"
+
 #include <cassert>
+#include <new>
 #include <optional>
+#include <utility>
 #include <sstream>
 
 using namespace std;
 
 namespace runtime {
 
+namespace {
+const intern::Symbol SELF_SYMBOL{"self"sv};
+}  // namespace
+
+intern::Symbol SpecialMethodName(SpecialMethod method) {
+    // Порядок имён совпадает с порядком SpecialMethod
+    static const intern::Symbol names[SPECIAL_METHOD_COUNT] = {
+        "__init__"sv, STR_METHOD, "__eq__"sv, "__lt__"sv, "__add__"sv, "__cmp__"sv,
+    };
+    return names[static_cast<size_t>(method)];
+}
+
 ObjectHolder::ObjectHolder(std::shared_ptr<Object> data)
     : data_(std::move(data)) {
 }
@@ -18,8 +33,38 @@ void ObjectHolder::AssertIsValid() const {
 }
 
 ObjectHolder ObjectHolder::Share(Object& object) {
-    // Возвращаем невладеющий shared_ptr (его deleter ничего не делает)
-    return ObjectHolder(std::shared_ptr<Object>(&object, [](auto* /*p*/) { /* do nothing */ }));
+    // Невладеющий shared_ptr без блока управления: копирование не трогает счётчик ссылок
+    return ObjectHolder(std::shared_ptr<Object>(std::shared_ptr<Object>(), &object));
+}
+
+namespace {
+
+// Объекты небольших чисел создаются один раз и никогда не удаляются
+Number* SmallInts() {
+    static Number* const table = [] {
+        auto* numbers = static_cast<Number*>(::operator new(
+            sizeof(Number) * (ObjectHolder::SMALL_INT_MAX - ObjectHolder::SMALL_INT_MIN)));
+        for (int value = ObjectHolder::SMALL_INT_MIN; value < ObjectHolder::SMALL_INT_MAX; ++value) {
+            new (numbers + (value - ObjectHolder::SMALL_INT_MIN)) Number(value);
+        }
+        return numbers;
+    }();
+    return table;
+}
+
+}  // namespace
+
+ObjectHolder ObjectHolder::OwnNumber(int value) {
+    if (value >= SMALL_INT_MIN && value < SMALL_INT_MAX) {
+        return Share(SmallInts()[value - SMALL_INT_MIN]);
+    }
+    return ObjectHolder(std::make_shared<Number>(value));
+}
+
+ObjectHolder ObjectHolder::OwnBool(bool value) {
+    static Bool true_value{true};
+    static Bool false_value{false};
+    return Share(value ? true_value : false_value);
 }
 
 ObjectHolder ObjectHolder::None() {
@@ -45,26 +90,32 @@ ObjectHolder::operator bool() const {
 }
 
 bool IsTrue(const ObjectHolder& object) {
-    if(!object
-       || (object.TryAs<Bool>() && object.TryAs<Bool>()->GetValue() == false)
-       || (object.TryAs<String>() && object.TryAs<String>()->GetValue() == ""s)
-       || (object.TryAs<Number>() && object.TryAs<Number>()->GetValue() == 0)
-       || object.TryAs<Class>()
-       || object.TryAs<ClassInstance>()) {
-        return false;
+    switch (object.GetType()) {
+        case ObjectType::BOOL:
+            return object.As<Bool>().GetValue();
+        case ObjectType::STRING:
+            return !object.As<String>().GetValue().empty();
+        case ObjectType::NUMBER:
+            return object.As<Number>().GetValue() != 0;
+        case ObjectType::OTHER:
+            return true;
+        default:
+            return false;
     }
-    return true;
 }
 
 void ClassInstance::Print(std::ostream& os, Context& context) {
-    if(const Method* metod = cls_->GetMethod(STR_METHOD); metod != nullptr ) {
-        this->Call(STR_METHOD, {}, context)->Print(os, context);
+    if(const Method* metod = cls_->GetMethod(SpecialMethod::STR); metod != nullptr ) {
+        if (!metod->formal_params.empty()) {
+            throw std::runtime_error("Not implemented"s);
+        }
+        this->Call(*metod, {}, context)->Print(os, context);
     } else {
         os << this;
     }
 }
 
-bool ClassInstance::HasMethod(const std::string& method, size_t argument_count) const {
+bool ClassInstance::HasMethod(intern::Symbol method, size_t argument_count) const {
     if(const Method* mtd = cls_->GetMethod(method);
        mtd != nullptr && mtd->formal_params.size() == argument_count ) {
         return true;
@@ -72,21 +123,99 @@ bool ClassInstance::HasMethod(const std::string& method, size_t argument_count)
     return false;
 }
 
-Closure& ClassInstance::Fields() {
-    return closure_;
-    throw std::logic_error("Not implemented"s);
+FieldTable& ClassInstance::Fields() {
+    return fields_;
 }
 
-const Closure& ClassInstance::Fields() const {
-    return closure_;
-    throw std::logic_error("Not implemented"s);
+const FieldTable& ClassInstance::Fields() const {
+    return fields_;
 }
 
 ClassInstance::ClassInstance(const Class& cls)
-    :cls_(&cls)
+    :Object(ObjectType::INSTANCE)
+    ,cls_(&cls)
+    ,fields_(cls.GetEmptyShape())
 {}
 
-ObjectHolder ClassInstance::Call(const std::string& method,
+uint32_t Shape::Find(intern::Symbol name) const {
+    for (size_t i = 0; i < names_.size(); ++i) {
+        if (names_[i] == name) {
+            return static_cast<uint32_t>(i);
+        }
+    }
+    return NO_SLOT;
+}
+
+const Shape* Shape::With(intern::Symbol name) const {
+    for (const auto& [field, shape] : transitions_) {
+        if (field == name) {
+            return shape.get();
+        }
+    }
+    auto shape = std::make_unique<Shape>();
+    shape->names_.reserve(names_.size() + 1);
+    shape->names_ = names_;
+    shape->names_.push_back(name);
+    return transitions_.emplace_back(name, std::move(shape)).second.get();
+}
+
+ObjectHolder& FieldTable::operator[](intern::Symbol name) {
+    if (const uint32_t slot = shape_->Find(name); slot != Shape::NO_SLOT) {
+        return values_[slot];
+    }
+    return Append(name);
+}
+
+ObjectHolder& FieldTable::at(intern::Symbol name) {
+    if (const uint32_t slot = shape_->Find(name); slot != Shape::NO_SLOT) {
+        return values_[slot];
+    }
+    throw std::out_of_range("No field "s + name.Name());
+}
+
+const ObjectHolder& FieldTable::at(intern::Symbol name) const {
+    return const_cast<FieldTable&>(*this).at(name);
+}
+
+FieldTable::iterator FieldTable::find(intern::Symbol name) {
+    const uint32_t slot = shape_->Find(name);
+    return slot != Shape::NO_SLOT ? begin() + slot : end();
+}
+
+FieldTable::const_iterator FieldTable::find(intern::Symbol name) const {
+    return const_cast<FieldTable&>(*this).find(name);
+}
+
+ObjectHolder* FieldTable::FindSlow(intern::Symbol name, FieldCache& cache) {
+    const uint32_t slot = shape_->Find(name);
+    if (slot == Shape::NO_SLOT) {
+        return nullptr;
+    }
+    cache = {shape_, nullptr, slot};
+    return &values_[slot];
+}
+
+ObjectHolder& FieldTable::AssignSlow(intern::Symbol name, FieldCache& cache) {
+    if (const uint32_t slot = shape_->Find(name); slot != Shape::NO_SLOT) {
+        cache = {shape_, nullptr, slot};
+        return values_[slot];
+    }
+    const Shape* before = shape_;
+    ObjectHolder& value = Append(name);
+    cache = {before, shape_, static_cast<uint32_t>(values_.size() - 1)};
+    return value;
+}
+
+ObjectHolder& FieldTable::Append(intern::Symbol name) {
+    shape_ = shape_->With(name);
+    if (values_.empty()) {
+        // у объектов обычно несколько полей: не выделяем память под каждое по отдельности
+        values_.reserve(4);
+    }
+    return values_.emplace_back();
+}
+
+ObjectHolder ClassInstance::Call(intern::Symbol method,
                                  const std::vector<ObjectHolder>& actual_args,
                                  Context& context) {
 
@@ -94,42 +223,214 @@ ObjectHolder ClassInstance::Call(const std::string& method,
     if(mtd == nullptr || mtd->formal_params.size() != actual_args.size()) {
         throw std::runtime_error("Not implemented"s);
     }
-    Closure closure;
-    closure["self"s] = ObjectHolder::Share(*this);
-    for(size_t i = 0; i < mtd->formal_params.size(); ++i) {
-        closure[mtd->formal_params[i]] = actual_args[i];
+    return Call(*mtd, actual_args, context);
+}
+
+ObjectHolder ClassInstance::Call(MethodCache& cache, intern::Symbol method,
+                                 const std::vector<ObjectHolder>& actual_args,
+                                 Context& context) {
+    const Method* mtd = cache.Find(*cls_, method, actual_args.size());
+    if (mtd == nullptr) {
+        throw std::runtime_error("Not implemented"s);
+    }
+    return Call(*mtd, actual_args, context);
+}
+
+ObjectHolder ClassInstance::Call(const Method& method, const std::vector<ObjectHolder>& actual_args,
+                                 Context& context) {
+    assert(method.formal_params.size() == actual_args.size());
+    return method.body->ExecuteMethod(ObjectHolder::Share(*this), method.formal_params,
+                                      actual_args, context);
+}
+
+ObjectHolder Executable::ExecuteMethod(const ObjectHolder& self, const vector<intern::Symbol>& params,
+                                       const vector<ObjectHolder>& args, Context& context) {
+    Frame frame;
+    Closure& closure = frame.GetClosure();
+    closure[SELF_SYMBOL] = self;
+    for (size_t i = 0; i < params.size(); ++i) {
+        closure[params[i]] = args[i];
+    }
+    return Execute(closure, context);
+}
+
+namespace {
+
+// Сколько кадров пул сохраняет, когда поток выходит из всех вызовов.
+// Кадры, созданные сверх этого глубокой рекурсией, освобождаются
+constexpr size_t POOLED_FRAMES = 128;
+
+// Пул кадров вызова потока
+struct FramePool {
+    std::vector<std::unique_ptr<Frame::Data>> frames;
+    // Число занятых кадров
+    size_t depth = 0;
+};
+
+thread_local FramePool frame_pool;
+
+}  // namespace
+
+Frame::Frame() {
+    if (frame_pool.depth == frame_pool.frames.size()) {
+        frame_pool.frames.push_back(std::make_unique<Data>());
+    }
+    data_ = frame_pool.frames[frame_pool.depth++].get();
+}
+
+Frame::~Frame() {
+    data_->values.clear();
+    data_->closure.clear();
+    if (--frame_pool.depth == 0 && frame_pool.frames.size() > POOLED_FRAMES) {
+        frame_pool.frames.resize(POOLED_FRAMES);
+    }
+}
+
+namespace {
+
+// Объект и аргументы отложенного хвостового вызова потока
+struct TailCallValues {
+    ObjectHolder object;
+    std::vector<ObjectHolder> args;
+};
+
+thread_local TailCallValues tail_call_values;
+
+}  // namespace
+
+void PendingTailCall::Set(const Method& method, ObjectHolder object,
+                          std::vector<ObjectHolder>& args) {
+    method_ = &method;
+    tail_call_values.object = std::move(object);
+    std::swap(tail_call_values.args, args);
+}
+
+const Method* PendingTailCall::Take(Frame& frame, ObjectHolder& object) {
+    frame.GetClosure().clear();
+    std::vector<ObjectHolder>& args = frame.Values();
+    args.clear();
+    std::swap(args, tail_call_values.args);
+    object = std::move(tail_call_values.object);
+    return std::exchange(method_, nullptr);
+}
+
+void PendingTailCall::BindFrame(const Method& method, const ObjectHolder& object, Frame& frame) {
+    Closure& closure = frame.GetClosure();
+    const std::vector<ObjectHolder>& args = frame.Values();
+    closure[SELF_SYMBOL] = ObjectHolder::Share(object.As<ClassInstance>());
+    for (size_t i = 0; i < args.size(); ++i) {
+        closure[method.formal_params[i]] = args[i];
+    }
+}
+
+thread_local MethodCache::Statistics MethodCache::statistics_;
+
+const Method* MethodCache::FindSlow(const Class& cls, intern::Symbol name,
+                                    size_t argument_count) {
+    for (size_t i = 1; i < size_; ++i) {
+        if (entries_[i].cls == &cls) {
+            ++statistics_.hits;
+            // последний найденный класс переходит в первую ячейку
+            std::swap(entries_[0], entries_[i]);
+            return entries_[0].method;
+        }
+    }
+    ++statistics_.misses;
+    const Method* method = cls.GetMethod(name);
+    if (method != nullptr && method->formal_params.size() != argument_count) {
+        method = nullptr;
+    }
+    if (size_ < CAPACITY) {
+        // освободившаяся ячейка получает прежний первый класс
+        entries_[size_++] = entries_[0];
+        entries_[0] = {&cls, method};
+    }
+    return method;
+}
+
+namespace {
+
+// Заголовок перед каждым узлом: откуда взята его память
+struct alignas(alignof(std::max_align_t)) NodeHeader {
+    bool in_arena;
+};
+
+}  // namespace
+
+void* Executable::operator new(size_t size) {
+    void* memory = nullptr;
+    bool in_arena = false;
+    if (NodeArena* arena = ArenaScope::Current()) {
+        memory = arena->Allocate(sizeof(NodeHeader) + size, alignof(NodeHeader));
+        in_arena = true;
+    } else {
+        memory = ::operator new(sizeof(NodeHeader) + size);
+    }
+    return new (memory) NodeHeader{in_arena} + 1;
+}
+
+void Executable::operator delete(void* ptr) noexcept {
+    if (ptr == nullptr) {
+        return;
+    }
+    NodeHeader* header = static_cast<NodeHeader*>(ptr) - 1;
+    if (!header->in_arena) {
+        ::operator delete(header);
     }
-    return mtd->body->Execute(closure, context);
 }
 
 Class::Class(std::string name, std::vector<Method> methods, const Class* parent)
-    :name_(std::move(name))
+    :Object(ObjectType::CLASS)
+    ,name_(std::move(name))
     ,methods_(std::move(methods))
     ,parent_(parent)
-{}
+{
+    BuildMethodTable();
+}
 
-const Method* Class::GetMethod(const std::string& name) const {
-    auto eqv = [&name](const Method& lth){
-        return lth.name == name;
-    };
-    auto result = find_if(methods_.begin(), methods_.end(), eqv);
-    if (result != methods_.end()) {
-        return &(*result);
+Class::Class(std::string name, std::vector<Method> methods, const Class* parent,
+             std::shared_ptr<NodeArena> storage)
+    :Object(ObjectType::CLASS)
+    ,storage_(std::move(storage))
+    ,name_(std::move(name))
+    ,methods_(std::move(methods))
+    ,parent_(parent)
+{
+    BuildMethodTable();
+}
+
+void Class::BuildMethodTable() {
+    // Таблица родителя уже содержит методы всех его предков
+    if (parent_) {
+        method_table_ = parent_->method_table_;
     }
-    if(!parent_) {
-        return nullptr;
+    for (const Method& method : methods_) {
+        method_table_[method.name] = &method;
     }
-    result = find_if(parent_->methods_.begin(), parent_->methods_.end(), eqv);
-    if (result != parent_->methods_.end()) {
-        return &(*result);
+    for (size_t i = 0; i < SPECIAL_METHOD_COUNT; ++i) {
+        special_methods_[i] = GetMethod(SpecialMethodName(static_cast<SpecialMethod>(i)));
     }
-    return nullptr;
+}
+
+const Method* Class::GetMethod(intern::Symbol name) const {
+    auto it = method_table_.find(name);
+    return it != method_table_.end() ? it->second : nullptr;
 }
 
 [[nodiscard]] const std::string& Class::GetName() const {
     return name_;
 }
 
+const Class* Class::GetParent() const {
+    return parent_;
+}
+
+void Class::ForEachMethod(const std::function<void(Method&)>& action) {
+    for (Method& method : methods_) {
+        action(method);
+    }
+}
+
 void Class::Print(ostream& os, Context& /*context*/) {
     os << "Class " << name_;
 }
@@ -138,15 +439,48 @@ void Bool::Print(std::ostream& os, [[maybe_unused]] Context& context) {
     os << (GetValue() ? "True"sv : "False"sv);
 }
 
+namespace {
+
+// Возвращает метод сравнения объекта с одним параметром или nullptr, если его нет
+const Method* FindComparisonMethod(const ObjectHolder& object, SpecialMethod method) {
+    if (object.GetType() != ObjectType::INSTANCE) {
+        return nullptr;
+    }
+    const Method* result = object.As<ClassInstance>().GetClass().GetMethod(method);
+    return result != nullptr && result->formal_params.size() == 1 ? result : nullptr;
+}
+
+// Вызывает lhs.__cmp__(rhs). Возвращает nullopt, если такого метода нет
+std::optional<int> ThreeWayCompare(const ObjectHolder& lhs, const ObjectHolder& rhs,
+                                   Context& context) {
+    const Method* cmp = FindComparisonMethod(lhs, SpecialMethod::CMP);
+    if (cmp == nullptr) {
+        return std::nullopt;
+    }
+    const ObjectHolder result = lhs.As<ClassInstance>().Call(*cmp, {rhs}, context);
+    if (result.GetType() != ObjectType::NUMBER) {
+        throw std::runtime_error("__cmp__ must return a number"s);
+    }
+    return result.As<Number>().GetValue();
+}
+
+}  // namespace
+
 bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
     if(!lhs && !rhs ) {
         return true;
     }
-    return Compare(lhs, rhs, context, std::equal_to(), "__eq__"s);
+    if (const auto order = ThreeWayCompare(lhs, rhs, context)) {
+        return *order == 0;
+    }
+    return Compare(lhs, rhs, context, std::equal_to(), SpecialMethod::EQ);
 }
 
 bool Less(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
-    return Compare(lhs, rhs, context, std::less(), "__lt__"s);
+    if (const auto order = ThreeWayCompare(lhs, rhs, context)) {
+        return *order < 0;
+    }
+    return Compare(lhs, rhs, context, std::less(), SpecialMethod::LT);
 }
 
 bool NotEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
@@ -159,6 +493,16 @@ bool NotEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context
 
 bool Greater(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
     try {
+        if (lhs.GetType() == ObjectType::INSTANCE) {
+            if (const auto order = ThreeWayCompare(lhs, rhs, context)) {
+                return *order > 0;
+            }
+            // lhs > rhs равносильно rhs < lhs, это один вызов вместо двух.
+            // Результат приводится к bool так же, как в Compare
+            if (const Method* lt = FindComparisonMethod(rhs, SpecialMethod::LT)) {
+                return IsTrue(rhs.As<ClassInstance>().Call(*lt, {lhs}, context));
+            }
+        }
         return !Less(lhs, rhs, context) && !Equal(lhs, rhs, context);
     } catch (...){
         throw std::runtime_error("Cannot compare objects for Greater"s);
@@ -181,4 +525,42 @@ bool GreaterOrEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& c
     }
 }
 
+bool CompareObjects(CompareOp op, const ObjectHolder& lhs, const ObjectHolder& rhs,
+                    Context& context) {
+    switch (op) {
+        case CompareOp::EQUAL:
+            return Equal(lhs, rhs, context);
+        case CompareOp::NOT_EQUAL:
+            return NotEqual(lhs, rhs, context);
+        case CompareOp::LESS:
+            return Less(lhs, rhs, context);
+        case CompareOp::GREATER:
+            return Greater(lhs, rhs, context);
+        case CompareOp::LESS_OR_EQUAL:
+            return LessOrEqual(lhs, rhs, context);
+        case CompareOp::GREATER_OR_EQUAL:
+            return GreaterOrEqual(lhs, rhs, context);
+    }
+    throw std::logic_error("Unknown comparison"s);
+}
+
+bool CompareValues(CompareOp op, const ObjectHolder& lhs, const ObjectHolder& rhs,
+                   Context& context) {
+    switch (op) {
+        case CompareOp::EQUAL:
+            return CompareValues<CompareOp::EQUAL>(lhs, rhs, context);
+        case CompareOp::NOT_EQUAL:
+            return CompareValues<CompareOp::NOT_EQUAL>(lhs, rhs, context);
+        case CompareOp::LESS:
+            return CompareValues<CompareOp::LESS>(lhs, rhs, context);
+        case CompareOp::GREATER:
+            return CompareValues<CompareOp::GREATER>(lhs, rhs, context);
+        case CompareOp::LESS_OR_EQUAL:
+            return CompareValues<CompareOp::LESS_OR_EQUAL>(lhs, rhs, context);
+        case CompareOp::GREATER_OR_EQUAL:
+            return CompareValues<CompareOp::GREATER_OR_EQUAL>(lhs, rhs, context);
+    }
+    return CompareObjects(op, lhs, rhs, context);
+}
+
 }  // namespace runtime
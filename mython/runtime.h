@@ -1,8 +1,17 @@
 ﻿#pragma once
 
+#include "symbol.h"
+#include "symbol_map.h"
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -10,6 +19,8 @@ static const std::string STR_METHOD = "__str__";
 
 namespace runtime {
 
+class NodeArena;
+
 // Контекст исполнения инструкций Mython
 class Context {
 public:
@@ -20,14 +31,60 @@ protected:
     ~Context() = default;
 };
 
+// Вид объекта. Позволяет узнать тип объекта сравнением, без dynamic_cast
+enum class ObjectType : uint8_t {
+    NONE,  // пустой ObjectHolder
+    OTHER,
+    NUMBER,
+    STRING,
+    BOOL,
+    CLASS,
+    INSTANCE,
+};
+
 // Базовый класс для всех объектов языка Mython
 class Object {
 public:
+    Object() = default;
     virtual ~Object() = default;
     // выводит в os своё представление в виде строки
     virtual void Print(std::ostream& os, Context& context) = 0;
+
+    // Вид объекта. Наследники встроенных типов получают вид своего базового типа
+    [[nodiscard]] ObjectType GetType() const {
+        return type_;
+    }
+
+protected:
+    explicit Object(ObjectType type)
+        : type_(type) {
+    }
+
+private:
+    ObjectType type_ = ObjectType::OTHER;
 };
 
+template <typename T>
+class ValueObject;
+class Bool;
+class Class;
+class ClassInstance;
+
+// Вид, который имеют все объекты типа T. Для остальных типов TYPE_TAG равен OTHER,
+// и принадлежность к ним проверяется через dynamic_cast
+template <typename T>
+inline constexpr ObjectType TYPE_TAG = ObjectType::OTHER;
+template <>
+inline constexpr ObjectType TYPE_TAG<ValueObject<int>> = ObjectType::NUMBER;
+template <>
+inline constexpr ObjectType TYPE_TAG<ValueObject<std::string>> = ObjectType::STRING;
+template <>
+inline constexpr ObjectType TYPE_TAG<Bool> = ObjectType::BOOL;
+template <>
+inline constexpr ObjectType TYPE_TAG<Class> = ObjectType::CLASS;
+template <>
+inline constexpr ObjectType TYPE_TAG<ClassInstance> = ObjectType::INSTANCE;
+
 // Специальный класс-обёртка, предназначенный для хранения объекта в Mython-программе
 class ObjectHolder {
 public:
@@ -36,13 +93,31 @@ public:
 
     // Возвращает ObjectHolder, владеющий объектом типа T
     // Тип T - конкретный класс-наследник Object.
-    // object копируется или перемещается в кучу
+    // object копируется или перемещается в кучу. Числа и логические значения неизменяемы,
+    // поэтому True, False и небольшие числа берутся из заранее созданных вечных объектов
     template <typename T>
     [[nodiscard]] static ObjectHolder Own(T&& object) {
-        return ObjectHolder(std::make_shared<T>(std::forward<T>(object)));
+        using Type = std::decay_t<T>;
+        if constexpr (std::is_same_v<Type, ValueObject<int>>) {
+            return OwnNumber(object.GetValue());
+        } else if constexpr (std::is_same_v<Type, Bool>) {
+            return OwnBool(object.GetValue());
+        } else {
+            return ObjectHolder(std::make_shared<Type>(std::forward<T>(object)));
+        }
     }
 
-    // Создаёт ObjectHolder, не владеющий объектом (аналог слабой ссылки)
+    // Число value. Для значений из [SMALL_INT_MIN, SMALL_INT_MAX) память не выделяется
+    [[nodiscard]] static ObjectHolder OwnNumber(int value);
+    // Вечный объект True или False
+    [[nodiscard]] static ObjectHolder OwnBool(bool value);
+
+    // Диапазон чисел, для которых заранее созданы вечные объекты
+    static constexpr int SMALL_INT_MIN = -256;
+    static constexpr int SMALL_INT_MAX = 4096;
+
+    // Создаёт ObjectHolder, не владеющий объектом (аналог слабой ссылки).
+    // Такой ObjectHolder не выделяет память и не ведёт счётчик ссылок
     [[nodiscard]] static ObjectHolder Share(Object& object);
     // Создаёт пустой ObjectHolder, соответствующий значению None
     [[nodiscard]] static ObjectHolder None();
@@ -56,10 +131,27 @@ public:
     [[nodiscard]] Object* Get() const;
 
     // Возвращает указатель на объект типа T либо nullptr, если внутри ObjectHolder не хранится
-    // объект данного типа
+    // объект данного типа. Для встроенных типов это сравнение вида объекта
     template <typename T>
     [[nodiscard]] T* TryAs() const {
-        return dynamic_cast<T*>(this->Get());
+        constexpr ObjectType type = TYPE_TAG<std::remove_cv_t<T>>;
+        if constexpr (type != ObjectType::OTHER) {
+            return GetType() == type ? static_cast<T*>(data_.get()) : nullptr;
+        } else {
+            return dynamic_cast<T*>(this->Get());
+        }
+    }
+
+    // Возвращает ссылку на объект типа T. Вид объекта должен быть проверен заранее
+    template <typename T>
+    [[nodiscard]] T& As() const {
+        assert(GetType() == TYPE_TAG<std::remove_cv_t<T>>);
+        return *static_cast<T*>(data_.get());
+    }
+
+    // Вид хранимого объекта либо NONE, если ObjectHolder пуст
+    [[nodiscard]] ObjectType GetType() const {
+        return data_ ? data_->GetType() : ObjectType::NONE;
     }
 
     // Возвращает true, если ObjectHolder не пуст
@@ -77,7 +169,8 @@ template <typename T>
 class ValueObject : public Object {
 public:
     ValueObject(T v)  // NOLINT(google-explicit-constructor,hicpp-explicit-conversions)
-        : value_(v) {
+        : Object(TYPE_TAG<ValueObject>)
+        , value_(v) {
     }
 
     void Print(std::ostream& os, [[maybe_unused]] Context& context) override {
@@ -88,12 +181,18 @@ public:
         return value_;
     }
 
+protected:
+    ValueObject(T v, ObjectType type)
+        : Object(type)
+        , value_(v) {
+    }
+
 private:
     T value_;
 };
 
 // Таблица символов, связывающая имя объекта с его значением
-using Closure = std::unordered_map<std::string, ObjectHolder>;
+using Closure = intern::SymbolMap<ObjectHolder>;
 
 // Проверяет, содержится ли в object значение, приводимое к True
 // Для отличных от нуля чисел, True и непустых строк возвращается true. В остальных случаях - false.
@@ -106,6 +205,53 @@ public:
     // Выполняет действие над объектами внутри closure, используя context
     // Возвращает результирующее значение либо None
     virtual ObjectHolder Execute(Closure& closure, Context& context) = 0;
+
+    // Выполняет тело метода для объекта self с аргументами args, соответствующими параметрам
+    // params. По умолчанию self и аргументы кладутся под своими именами в новый Closure.
+    // Тела, заранее сопоставившие имена ячейкам кадра, обходятся без него
+    virtual ObjectHolder ExecuteMethod(const ObjectHolder& self,
+                                       const std::vector<intern::Symbol>& params,
+                                       const std::vector<ObjectHolder>& args, Context& context);
+
+    // Узлы размещаются в арене текущей ArenaScope, а вне области - в куче.
+    // Память узла из арены не освобождается по отдельности, а уходит вместе с ареной
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr) noexcept;
+};
+
+/*
+ * Кадр вызова метода: значения вызова (аргументы либо регистры виртуальной машины)
+ * и Closure тела метода. Кадры берутся из пула потока в порядке стека вызовов, поэтому
+ * вызов получает кадр своей глубины вместе с памятью, которую выделили прошлые вызовы
+ * на той же глубине. В установившемся режиме вызов метода не обращается к куче
+ */
+class Frame {
+public:
+    // Занимает свободный кадр пула
+    Frame();
+    // Очищает кадр и возвращает его в пул. Кадры освобождаются в обратном порядке
+    ~Frame();
+
+    Frame(const Frame&) = delete;
+    Frame& operator=(const Frame&) = delete;
+
+    // Пустой массив значений, память которого остаётся от прошлых вызовов
+    [[nodiscard]] std::vector<ObjectHolder>& Values() {
+        return data_->values;
+    }
+
+    // Пустой Closure
+    [[nodiscard]] Closure& GetClosure() {
+        return data_->closure;
+    }
+
+    struct Data {
+        std::vector<ObjectHolder> values;
+        Closure closure;
+    };
+
+private:
+    Data* data_;
 };
 
 // Строковое значение
@@ -116,7 +262,9 @@ using Number = ValueObject<int>;
 // Логическое значение
 class Bool : public ValueObject<bool> {
 public:
-    using ValueObject<bool>::ValueObject;
+    Bool(bool v)  // NOLINT(google-explicit-constructor,hicpp-explicit-conversions)
+        : ValueObject<bool>(v, ObjectType::BOOL) {
+    }
 
     void Print(std::ostream& os, Context& context) override;
 };
@@ -124,13 +272,147 @@ public:
 // Метод класса
 struct Method {
     // Имя метода
-    std::string name;
+    intern::Symbol name;
     // Имена формальных параметров метода
-    std::vector<std::string> formal_params;
+    std::vector<intern::Symbol> formal_params;
     // Тело метода
     std::unique_ptr<Executable> body;
 };
 
+// Специальные методы, ссылки на которые класс хранит отдельно от общей таблицы
+enum class SpecialMethod : uint8_t {
+    INIT,  // __init__
+    STR,   // __str__
+    EQ,    // __eq__
+    LT,    // __lt__
+    ADD,   // __add__
+    CMP,   // __cmp__
+};
+
+inline constexpr size_t SPECIAL_METHOD_COUNT = 6;
+
+// Имя специального метода
+[[nodiscard]] intern::Symbol SpecialMethodName(SpecialMethod method);
+
+/*
+ * Форма объекта: имена его полей в порядке добавления. Номер имени - индекс значения поля
+ * в массиве значений объекта. Формы образуют дерево переходов с корнем в пустой форме класса:
+ * добавление поля переводит объект в дочернюю форму, поэтому объекты, получившие одни и те же
+ * поля в одном порядке, разделяют одну форму.
+ * Переходы создаются при выполнении программы, поэтому дерево не потокобезопасно
+ */
+class Shape {
+public:
+    // Номер отсутствующего поля
+    static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+    Shape() = default;
+    Shape(const Shape&) = delete;
+    Shape& operator=(const Shape&) = delete;
+
+    // Номер поля name либо NO_SLOT
+    [[nodiscard]] uint32_t Find(intern::Symbol name) const;
+
+    // Форма с полем name, добавленным после полей этой формы
+    [[nodiscard]] const Shape* With(intern::Symbol name) const;
+
+    // Имена полей в порядке номеров
+    [[nodiscard]] const std::vector<intern::Symbol>& Names() const {
+        return names_;
+    }
+
+private:
+    std::vector<intern::Symbol> names_;
+    mutable std::vector<std::pair<intern::Symbol, std::unique_ptr<Shape>>> transitions_;
+};
+
+/*
+ * Кеш обращения к полю в точке программы: у объектов формы shape поле лежит в ячейке slot.
+ * Для записи, добавляющей поле, next - форма объекта после записи, иначе nullptr
+ */
+struct FieldCache {
+    const Shape* shape = nullptr;
+    const Shape* next = nullptr;
+    uint32_t slot = 0;
+};
+
+/*
+ * Поля объекта: форма и массив значений в порядке её имён.
+ * Поддерживает ту же часть интерфейса ассоциативного контейнера, что использовалась у Closure.
+ * Итераторы - указатели на значения полей
+ */
+class FieldTable {
+public:
+    using iterator = ObjectHolder*;
+    using const_iterator = const ObjectHolder*;
+
+    explicit FieldTable(const Shape& shape)
+        : shape_(&shape) {
+    }
+
+    // Значение поля name. Отсутствующее поле добавляется со значением None
+    ObjectHolder& operator[](intern::Symbol name);
+
+    // Значение поля name. Если поля нет, выбрасывает std::out_of_range
+    ObjectHolder& at(intern::Symbol name);
+    const ObjectHolder& at(intern::Symbol name) const;
+
+    // Итератор на значение поля name либо end()
+    [[nodiscard]] iterator find(intern::Symbol name);
+    [[nodiscard]] const_iterator find(intern::Symbol name) const;
+
+    [[nodiscard]] iterator begin() {
+        return values_.data();
+    }
+    [[nodiscard]] iterator end() {
+        return values_.data() + values_.size();
+    }
+    [[nodiscard]] const_iterator begin() const {
+        return values_.data();
+    }
+    [[nodiscard]] const_iterator end() const {
+        return values_.data() + values_.size();
+    }
+    [[nodiscard]] size_t size() const {
+        return values_.size();
+    }
+
+    // Значение поля name либо nullptr, если поля нет. Поиск запоминается в cache
+    [[nodiscard]] ObjectHolder* Find(intern::Symbol name, FieldCache& cache) {
+        if (cache.shape == shape_ && cache.next == nullptr) {
+            return &values_[cache.slot];
+        }
+        return FindSlow(name, cache);
+    }
+
+    // Значение поля name для записи, как operator[]. Поиск либо переход в новую форму
+    // запоминается в cache
+    ObjectHolder& Assign(intern::Symbol name, FieldCache& cache) {
+        if (cache.shape == shape_) {
+            if (cache.next != nullptr) {
+                shape_ = cache.next;
+                values_.emplace_back();
+            }
+            return values_[cache.slot];
+        }
+        return AssignSlow(name, cache);
+    }
+
+    // Текущая форма объекта
+    [[nodiscard]] const Shape& GetShape() const {
+        return *shape_;
+    }
+
+private:
+    ObjectHolder* FindSlow(intern::Symbol name, FieldCache& cache);
+    ObjectHolder& AssignSlow(intern::Symbol name, FieldCache& cache);
+    // Добавляет поле name в конец и переводит объект в следующую форму
+    ObjectHolder& Append(intern::Symbol name);
+
+    const Shape* shape_;
+    std::vector<ObjectHolder> values_;
+};
+
 // Класс
 class Class : public Object {
 public:
@@ -138,19 +420,104 @@ public:
     // Если parent равен nullptr, то создаётся базовый класс
     explicit Class(std::string name, std::vector<Method> methods, const Class* parent);
 
-    // Возвращает указатель на метод name или nullptr, если метод с таким именем отсутствует
-    [[nodiscard]] const Method* GetMethod(const std::string& name) const;
+    // Создаёт класс, тела методов которого размещены в арене storage.
+    // Класс может пережить программу, поэтому он продлевает жизнь арены
+    Class(std::string name, std::vector<Method> methods, const Class* parent,
+          std::shared_ptr<NodeArena> storage);
+
+    // Класс хранит указатели на свои методы, поэтому не копируется
+    Class(const Class&) = delete;
+    Class& operator=(const Class&) = delete;
+    Class(Class&&) = default;
+    Class& operator=(Class&&) = default;
+
+    // Возвращает указатель на метод name или nullptr, если метод с таким именем отсутствует.
+    // Поиск идёт по таблице, собранной при создании класса из методов всей цепочки предков
+    [[nodiscard]] const Method* GetMethod(intern::Symbol name) const;
+
+    // Возвращает указатель на специальный метод или nullptr, если его нет ни у класса,
+    // ни у предков
+    [[nodiscard]] const Method* GetMethod(SpecialMethod method) const {
+        return special_methods_[static_cast<size_t>(method)];
+    }
 
     // Возвращает имя класса
     [[nodiscard]] const std::string& GetName() const;
 
+    // Возвращает родительский класс или nullptr, если класс базовый
+    [[nodiscard]] const Class* GetParent() const;
+
+    // Вызывает action для каждого собственного метода класса (методы родителя не входят).
+    // Через него тела методов заменяются при переводе программы в другое представление
+    void ForEachMethod(const std::function<void(Method&)>& action);
+
     // Выводит в os строку "Class <имя класса>", например "Class cat"
     void Print(std::ostream& os, Context& context) override;
 
+    // Форма только что созданного экземпляра, корень дерева форм экземпляров класса
+    [[nodiscard]] const Shape& GetEmptyShape() const {
+        return *empty_shape_;
+    }
+
 private:
+    // арена освобождается после методов, узлы которых в ней размещены
+    std::shared_ptr<NodeArena> storage_;
     std::string name_;
     std::vector<Method> methods_;
     const Class* parent_;
+    // методы класса и всех предков; собственные методы заменяют унаследованные
+    std::unordered_map<intern::Symbol, const Method*> method_table_;
+    std::array<const Method*, SPECIAL_METHOD_COUNT> special_methods_{};
+    std::unique_ptr<Shape> empty_shape_ = std::make_unique<Shape>();
+
+    void BuildMethodTable();
+};
+
+/*
+ * Кеш поиска метода в точке вызова. Запоминает, какой метод с нужным числом параметров
+ * найден для класса получателя. Сначала хранится один класс (мономорфный кеш),
+ * затем до CAPACITY классов. Для точки вызова с большим числом классов
+ * метод каждый раз ищется в таблице класса
+ */
+class MethodCache {
+public:
+    static constexpr size_t CAPACITY = 4;
+
+    // Попадания - вызовы, для которых метод взят из кеша, промахи - поиски в таблице класса
+    struct Statistics {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    // Возвращает метод name класса cls, принимающий argument_count параметров,
+    // либо nullptr, если такого метода нет. Точка вызова всегда передаёт одни и те же
+    // name и argument_count
+    [[nodiscard]] const Method* Find(const Class& cls, intern::Symbol name,
+                                     size_t argument_count) {
+        if (entries_[0].cls == &cls) {
+            ++statistics_.hits;
+            return entries_[0].method;
+        }
+        return FindSlow(cls, name, argument_count);
+    }
+
+    // Счётчики всех кешей текущего потока
+    [[nodiscard]] static Statistics& GetStatistics() {
+        return statistics_;
+    }
+
+private:
+    struct Entry {
+        const Class* cls = nullptr;
+        const Method* method = nullptr;
+    };
+
+    const Method* FindSlow(const Class& cls, intern::Symbol name, size_t argument_count);
+
+    std::array<Entry, CAPACITY> entries_{};
+    size_t size_ = 0;
+
+    static thread_local Statistics statistics_;
 };
 
 // Экземпляр класса
@@ -170,29 +537,81 @@ public:
      * Если ни сам класс, ни его родители не содержат метод method, метод выбрасывает исключение
      * runtime_error
      */
-    ObjectHolder Call(const std::string& method, const std::vector<ObjectHolder>& actual_args,
+    ObjectHolder Call(intern::Symbol method, const std::vector<ObjectHolder>& actual_args,
                       Context& context);
 
+    // Вызывает метод method, как Call выше, но ищет его через кеш точки вызова cache
+    ObjectHolder Call(MethodCache& cache, intern::Symbol method,
+                      const std::vector<ObjectHolder>& actual_args, Context& context);
+
+    // Вызывает уже найденный метод класса объекта.
+    // Число actual_args должно совпадать с числом параметров метода
+    ObjectHolder Call(const Method& method, const std::vector<ObjectHolder>& actual_args,
+                      Context& context);
+
+    // Возвращает класс объекта
+    [[nodiscard]] const Class& GetClass() const {
+        return *cls_;
+    }
+
     // Возвращает true, если объект имеет метод method, принимающий argument_count параметров
-    [[nodiscard]] bool HasMethod(const std::string& method, size_t argument_count) const;
+    [[nodiscard]] bool HasMethod(intern::Symbol method, size_t argument_count) const;
 
-    // Возвращает ссылку на Closure, содержащий поля объекта
-    [[nodiscard]] Closure& Fields();
-    // Возвращает константную ссылку на Closure, содержащую поля объекта
-    [[nodiscard]] const Closure& Fields() const;
+    // Возвращает ссылку на таблицу полей объекта
+    [[nodiscard]] FieldTable& Fields();
+    // Возвращает константную ссылку на таблицу полей объекта
+    [[nodiscard]] const FieldTable& Fields() const;
 
 private:
     const Class* cls_;
-    Closure closure_;
+    FieldTable fields_;
+};
+
+/*
+ * Отложенный хвостовой вызов return obj.m(args). Return вычисляет объект и аргументы
+ * и откладывает вызов, а охватывающее тело метода после выхода выполняет его в своём кадре,
+ * не углубляя стек. Вызов один на поток и общий для дерева и плоского представления,
+ * поэтому вызов, отложенный телом одного движка, выполнит тело другого
+ */
+class PendingTailCall {
+public:
+    // Откладывает вызов method у object. Аргументы забираются из args обменом массивов
+    static void Set(const Method& method, ObjectHolder object, std::vector<ObjectHolder>& args);
+
+    [[nodiscard]] static bool IsSet() {
+        return method_ != nullptr;
+    }
+
+    // Забирает отложенный вызов: очищает кадр frame, переносит аргументы в frame.Values(),
+    // а объект - в object. Возвращает метод либо nullptr, если вызова нет
+    static const Method* Take(Frame& frame, ObjectHolder& object);
+
+    // Связывает в frame.GetClosure() self с объектом object и параметры method с аргументами
+    // из frame.Values()
+    static void BindFrame(const Method& method, const ObjectHolder& object, Frame& frame);
+
+private:
+    // Отдельно от объекта и аргументов: проверка на каждом выходе из тела метода
+    // не требует инициализации переменной потока
+    static inline thread_local const Method* method_ = nullptr;
 };
 
+/*
+ * Сравнение объектов классов. Если у класса lhs есть метод __cmp__ с одним параметром,
+ * любая операция сравнения выполняется одним его вызовом: lhs.__cmp__(rhs) возвращает
+ * отрицательное число, ноль или положительное число, когда lhs соответственно меньше,
+ * равен или больше rhs. Иначе операции выводятся из __eq__ и __lt__ так, чтобы каждая
+ * по возможности вызывала только один из них
+ */
+
 /*
  * Возвращает true, если lhs и rhs содержат одинаковые числа, строки или значения типа Bool.
+ * Если lhs - объект с методом __cmp__, возвращает true, когда lhs.__cmp__(rhs) равен нулю.
  * Если lhs - объект с методом __eq__, функция возвращает результат вызова lhs.__eq__(rhs),
  * приведённый к типу Bool. Если lhs и rhs имеют значение None, функция возвращает true.
  * В остальных случаях функция выбрасывает исключение runtime_error.
  *
- * Параметр context задаёт контекст для выполнения метода __eq__
+ * Параметр context задаёт контекст для выполнения методов __cmp__ и __eq__
  */
 bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
 
@@ -200,40 +619,117 @@ bool Equal(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
  * Если lhs и rhs - числа, строки или значения bool, функция возвращает результат их сравнения
  * оператором <.
  * Если lhs - объект с методом __lt__, возвращает результат вызова lhs.__lt__(rhs),
- * приведённый к типу bool. В остальных случаях функция выбрасывает исключение runtime_error.
+ * приведённый к типу bool функцией IsTrue. В остальных случаях функция выбрасывает исключение runtime_error.
  *
  * Параметр context задаёт контекст для выполнения метода __lt__
  */
 template <typename Comparator>
 bool Compare(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context,
-             Comparator comparator, const std::string& method_name) {
+             Comparator comparator, SpecialMethod method) {
     using namespace std::literals;
-    if(lhs.TryAs<Number>() && rhs.TryAs<Number>() ) {
-        return comparator(lhs.TryAs<Number>()->GetValue(), rhs.TryAs<Number>()->GetValue());
-    }
-    if(lhs.TryAs<String>() && rhs.TryAs<String>() ) {
-        return comparator(lhs.TryAs<String>()->GetValue(), rhs.TryAs<String>()->GetValue());
-    }
-    if(lhs.TryAs<Bool>() && rhs.TryAs<Bool>() ) {
-        return comparator(lhs.TryAs<Bool>()->GetValue(), rhs.TryAs<Bool>()->GetValue());
-    }
-    if(auto cli = lhs.TryAs<ClassInstance>(); cli) {
-        if(cli->HasMethod(method_name,1)){
-           return cli->Call(method_name, {rhs}, context).TryAs<Bool>()->GetValue();
-        }
+    const ObjectType type = lhs.GetType();
+    switch (type) {
+        case ObjectType::NUMBER:
+            if (rhs.GetType() == type) {
+                return comparator(lhs.As<Number>().GetValue(), rhs.As<Number>().GetValue());
+            }
+            break;
+        case ObjectType::STRING:
+            if (rhs.GetType() == type) {
+                return comparator(lhs.As<String>().GetValue(), rhs.As<String>().GetValue());
+            }
+            break;
+        case ObjectType::BOOL:
+            if (rhs.GetType() == type) {
+                return comparator(lhs.As<Bool>().GetValue(), rhs.As<Bool>().GetValue());
+            }
+            break;
+        case ObjectType::INSTANCE:
+            if (auto& cli = lhs.As<ClassInstance>();
+                const Method* mtd = cli.GetClass().GetMethod(method)) {
+                if (mtd->formal_params.size() == 1) {
+                    return IsTrue(cli.Call(*mtd, {rhs}, context));
+                }
+            }
+            break;
+        default:
+            break;
     }
-    throw std::runtime_error("Cannot compare objects for "s + method_name);
+    throw std::runtime_error("Cannot compare objects for "s + SpecialMethodName(method).Name());
 }
+// Как Compare(lhs, rhs, context, std::less(), SpecialMethod::LT), но объект с методом __cmp__
+// меньше rhs, когда lhs.__cmp__(rhs) отрицателен
 bool Less(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
 // Возвращает значение, противоположное Equal(lhs, rhs, context)
 bool NotEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
-// Возвращает значение lhs>rhs, используя функции Equal и Less
+// Возвращает значение lhs>rhs. Объект без __cmp__ сравнивается вызовом rhs.__lt__(lhs), если rhs -
+// объект с методом __lt__, иначе используются функции Less и Equal. Во втором случае,
+// например при сравнении объекта с числом, вызовов два, когда lhs.__lt__(rhs) ложен:
+// из одного __lt__ объекта lhs операцию > не вывести
 bool Greater(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
-// Возвращает значение lhs<=rhs, используя функции Equal и Less
+// Возвращает значение, противоположное Greater(lhs, rhs, context)
 bool LessOrEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
 // Возвращает значение, противоположное Less(lhs, rhs, context)
 bool GreaterOrEqual(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context);
 
+// Операция сравнения. Порядок совпадает с номерами операций в файлах разобранных программ
+enum class CompareOp : uint8_t {
+    EQUAL,             // ==, функция Equal
+    NOT_EQUAL,         // !=, функция NotEqual
+    LESS,              // <, функция Less
+    GREATER,           // >, функция Greater
+    LESS_OR_EQUAL,     // <=, функция LessOrEqual
+    GREATER_OR_EQUAL,  // >=, функция GreaterOrEqual
+};
+
+// Сравнивает lhs и rhs операцией op, вызывая соответствующую ей функцию сравнения
+bool CompareObjects(CompareOp op, const ObjectHolder& lhs, const ObjectHolder& rhs,
+                    Context& context);
+
+// Применяет операцию op к значениям одного типа
+template <CompareOp op, typename T>
+bool ApplyCompareOp(const T& lhs, const T& rhs) {
+    if constexpr (op == CompareOp::EQUAL) {
+        return lhs == rhs;
+    } else if constexpr (op == CompareOp::NOT_EQUAL) {
+        return lhs != rhs;
+    } else if constexpr (op == CompareOp::LESS) {
+        return lhs < rhs;
+    } else if constexpr (op == CompareOp::GREATER) {
+        return rhs < lhs;
+    } else if constexpr (op == CompareOp::LESS_OR_EQUAL) {
+        return !(rhs < lhs);
+    } else {
+        return !(lhs < rhs);
+    }
+}
+
+/*
+ * То же, что CompareObjects(op, lhs, rhs, context). Числа, строки и логические значения
+ * сравниваются на месте, а функция сравнения вызывается только для остальных объектов
+ */
+template <CompareOp op>
+bool CompareValues(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+    const ObjectType type = lhs.GetType();
+    if (type == rhs.GetType()) {
+        switch (type) {
+            case ObjectType::NUMBER:
+                return ApplyCompareOp<op>(lhs.As<Number>().GetValue(), rhs.As<Number>().GetValue());
+            case ObjectType::STRING:
+                return ApplyCompareOp<op>(lhs.As<String>().GetValue(), rhs.As<String>().GetValue());
+            case ObjectType::BOOL:
+                return ApplyCompareOp<op>(lhs.As<Bool>().GetValue(), rhs.As<Bool>().GetValue());
+            default:
+                break;
+        }
+    }
+    return CompareObjects(op, lhs, rhs, context);
+}
+
+// CompareValues для операции, известной только при выполнении
+bool CompareValues(CompareOp op, const ObjectHolder& lhs, const ObjectHolder& rhs,
+                   Context& context);
+
 // Контекст-заглушка, применяется в тестах.
 // В этом контексте весь вывод перенаправляется в строковый поток вывода output
 struct DummyContext : Context {
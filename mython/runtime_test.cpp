@@ -19,7 +19,8 @@ public:
     }
 
     Logger(const Logger& rhs)
-        : id_(rhs.id_)  //
+        : Object(rhs)
+        , id_(rhs.id_)  //
     {
         ++instance_count;
     }
@@ -242,6 +243,58 @@ void TestMove() {
     }
 }
 
+void TestImmortalValues() {
+    // True, False и небольшие числа не создаются заново
+    ASSERT(ObjectHolder::Own(Bool{true}).Get() == ObjectHolder::Own(Bool{true}).Get());
+    ASSERT(ObjectHolder::Own(Bool{false}).Get() == ObjectHolder::Own(Bool{false}).Get());
+    ASSERT(ObjectHolder::Own(Bool{true}).Get() != ObjectHolder::Own(Bool{false}).Get());
+    ASSERT(ObjectHolder::Own(Number{7}).Get() == ObjectHolder::Own(Number{7}).Get());
+    ASSERT(ObjectHolder::Own(Number{-1}).Get() == ObjectHolder::Own(Number{-1}).Get());
+
+    for (int value : {ObjectHolder::SMALL_INT_MIN - 1, ObjectHolder::SMALL_INT_MIN, 0,
+                      ObjectHolder::SMALL_INT_MAX - 1, ObjectHolder::SMALL_INT_MAX}) {
+        auto number = ObjectHolder::Own(Number{value});
+        ASSERT(number.TryAs<Number>() != nullptr);
+        ASSERT_EQUAL(number.TryAs<Number>()->GetValue(), value);
+        ASSERT(number.TryAs<Bool>() == nullptr);
+    }
+    ASSERT(ObjectHolder::Own(Bool{true}).TryAs<Bool>()->GetValue());
+    ASSERT(!ObjectHolder::Own(Bool{false}).TryAs<Bool>()->GetValue());
+
+    // Большие числа по-прежнему размещаются в куче
+    ASSERT(ObjectHolder::Own(Number{1 << 20}).Get() != ObjectHolder::Own(Number{1 << 20}).Get());
+}
+
+void TestTypeTags() {
+    ASSERT(ObjectHolder::None().GetType() == ObjectType::NONE);
+    ASSERT(ObjectHolder::Own(Number{1}).GetType() == ObjectType::NUMBER);
+    ASSERT(ObjectHolder::Own(String{"s"s}).GetType() == ObjectType::STRING);
+    ASSERT(ObjectHolder::Own(Bool{true}).GetType() == ObjectType::BOOL);
+    ASSERT(ObjectHolder::Own(Logger()).GetType() == ObjectType::OTHER);
+
+    Class cls("cls"s, {}, nullptr);
+    ASSERT(ObjectHolder::Share(cls).GetType() == ObjectType::CLASS);
+    ASSERT(ObjectHolder::Own(ClassInstance{cls}).GetType() == ObjectType::INSTANCE);
+
+    // Bool - наследник ValueObject<bool>, но не всякий ValueObject<bool> - Bool
+    auto plain = ObjectHolder::Own(ValueObject<bool>{true});
+    ASSERT(plain.TryAs<Bool>() == nullptr);
+    ASSERT(plain.TryAs<ValueObject<bool>>() != nullptr);
+    ASSERT(ObjectHolder::Own(Bool{true}).TryAs<ValueObject<bool>>() != nullptr);
+
+    // Наследник встроенного типа остаётся объектом этого типа
+    class Counter : public Number {
+    public:
+        using Number::Number;
+    };
+    auto counter = ObjectHolder::Own(Counter{5});
+    ASSERT(counter.GetType() == ObjectType::NUMBER);
+    ASSERT_EQUAL(counter.TryAs<Number>()->GetValue(), 5);
+    ASSERT(counter.TryAs<Counter>() != nullptr);
+    ASSERT(ObjectHolder::Own(Number{5}).TryAs<Counter>() == nullptr);
+    ASSERT(counter.TryAs<String>() == nullptr);
+}
+
 void TestNullptr() {
     ObjectHolder oh;
     ASSERT(!oh);
@@ -474,6 +527,129 @@ void TestComparison() {
     }
 }
 
+void TestThreeWayComparison() {
+    DummyContext ctx;
+
+    // __cmp__ answers every comparison with a single call
+    {
+        int calls = 0;
+        auto cmp_body = [&calls](Closure& closure, [[maybe_unused]] Context& ctx) {
+            ++calls;
+            const int lhs = closure.at("self"s).TryAs<ClassInstance>()->Fields().at("v"s)
+                                .TryAs<Number>()->GetValue();
+            const int rhs = closure.at("rhs"s).TryAs<ClassInstance>()->Fields().at("v"s)
+                                .TryAs<Number>()->GetValue();
+            return ObjectHolder::Own(Number{lhs - rhs});
+        };
+        std::vector<Method> methods;
+        methods.push_back({"__cmp__"s, {"rhs"s}, std::make_unique<TestMethodBody>(cmp_body)});
+        Class cls{"Key"s, std::move(methods), nullptr};
+
+        auto make = [&cls](int value) {
+            auto key = ObjectHolder::Own(ClassInstance{cls});
+            key.TryAs<ClassInstance>()->Fields()["v"s] = ObjectHolder::Own(Number{value});
+            return key;
+        };
+        const ObjectHolder one = make(1);
+        const ObjectHolder two = make(2);
+
+        ASSERT(Less(one, two, ctx));
+        ASSERT(!Less(two, one, ctx));
+        ASSERT(Greater(two, one, ctx));
+        ASSERT(!Greater(one, one, ctx));
+        ASSERT(LessOrEqual(one, one, ctx));
+        ASSERT(GreaterOrEqual(two, one, ctx));
+        ASSERT(Equal(one, make(1), ctx));
+        ASSERT(NotEqual(one, two, ctx));
+        ASSERT_EQUAL(calls, 8);
+    }
+
+    // Without __cmp__, lhs > rhs is rhs.__lt__(lhs)
+    {
+        Closure lt_closure;
+        int calls = 0;
+        auto lt_body = [&lt_closure, &calls](Closure& closure, [[maybe_unused]] Context& ctx) {
+            ++calls;
+            lt_closure = closure;
+            return ObjectHolder::Own(Bool{true});
+        };
+        std::vector<Method> methods;
+        methods.push_back({"__lt__"s, {"rhs"s}, std::make_unique<TestMethodBody>(lt_body)});
+        Class cls{"Ordered"s, std::move(methods), nullptr};
+        ClassInstance lhs{cls};
+        ClassInstance rhs{cls};
+
+        ASSERT(Greater(ObjectHolder::Share(lhs), ObjectHolder::Share(rhs), ctx));
+        ASSERT(lt_closure.at("self"s).TryAs<ClassInstance>() == &rhs);
+        ASSERT(lt_closure.at("rhs"s).TryAs<ClassInstance>() == &lhs);
+        ASSERT(!LessOrEqual(ObjectHolder::Share(lhs), ObjectHolder::Share(rhs), ctx));
+        ASSERT_EQUAL(calls, 2);
+
+        // There is no __eq__ to derive equality from
+        ASSERT_THROWS(Equal(ObjectHolder::Share(lhs), ObjectHolder::Share(rhs), ctx),
+                      runtime_error);
+    }
+
+    // __lt__ results are converted to bool the same way for < and for reflected >
+    {
+        auto lt_body = []([[maybe_unused]] Closure& closure, [[maybe_unused]] Context& ctx) {
+            return ObjectHolder::Own(Number{1});
+        };
+        std::vector<Method> methods;
+        methods.push_back({"__lt__"s, {"rhs"s}, std::make_unique<TestMethodBody>(lt_body)});
+        Class cls{"NumericLess"s, std::move(methods), nullptr};
+        ClassInstance lhs{cls};
+        ClassInstance rhs{cls};
+
+        ASSERT(Less(ObjectHolder::Share(lhs), ObjectHolder::Share(rhs), ctx));
+        ASSERT(Greater(ObjectHolder::Share(rhs), ObjectHolder::Share(lhs), ctx));
+    }
+
+    // __cmp__ must return a number
+    {
+        std::vector<Method> methods;
+        methods.push_back({"__cmp__"s, {"rhs"s}, std::make_unique<TestMethodBody>(nullptr)});
+        Class cls{"Broken"s, std::move(methods), nullptr};
+        ClassInstance instance{cls};
+        ASSERT_THROWS(Less(ObjectHolder::Share(instance), ObjectHolder::None(), ctx),
+                      runtime_error);
+    }
+}
+
+void TestCompareValues() {
+    const CompareOp ops[] = {
+        CompareOp::EQUAL,   CompareOp::NOT_EQUAL,     CompareOp::LESS,
+        CompareOp::GREATER, CompareOp::LESS_OR_EQUAL, CompareOp::GREATER_OR_EQUAL,
+    };
+    const ObjectHolder values[] = {
+        ObjectHolder::Own(Number{-1000}), ObjectHolder::Own(Number{3}),
+        ObjectHolder::Own(Number{100000}), ObjectHolder::Own(String{""s}),
+        ObjectHolder::Own(String{"abc"s}), ObjectHolder::Own(Bool{false}),
+        ObjectHolder::Own(Bool{true}),     ObjectHolder::None(),
+    };
+
+    // The fast path gives the same results and errors as the comparison functions
+    DummyContext ctx;
+    for (const CompareOp op : ops) {
+        for (const ObjectHolder& lhs : values) {
+            for (const ObjectHolder& rhs : values) {
+                bool expected = false;
+                try {
+                    expected = CompareObjects(op, lhs, rhs, ctx);
+                } catch (const runtime_error&) {
+                    ASSERT_THROWS(CompareValues(op, lhs, rhs, ctx), runtime_error);
+                    continue;
+                }
+                ASSERT_EQUAL(CompareValues(op, lhs, rhs, ctx), expected);
+            }
+        }
+    }
+
+    ASSERT(CompareValues<CompareOp::LESS>(values[1], values[2], ctx));
+    ASSERT(CompareValues<CompareOp::GREATER_OR_EQUAL>(values[4], values[3], ctx));
+    ASSERT(!CompareValues<CompareOp::EQUAL>(values[5], values[6], ctx));
+}
+
 void TestClass() {
     vector<Method> methods;
     Closure* passed_closure = nullptr;
@@ -504,6 +680,237 @@ void TestClass() {
     ASSERT_EQUAL(out.str(), "Class Test"s);
 }
 
+void TestInheritedMethods() {
+    auto returns = [](int value) {
+        return make_unique<TestMethodBody>([value](Closure&, Context&) {
+            return ObjectHolder::Own(Number{value});
+        });
+    };
+    vector<Method> base_methods;
+    base_methods.push_back({"__str__"s, {}, returns(1)});
+    base_methods.push_back({"base_only"s, {}, returns(2)});
+    base_methods.push_back({"__eq__"s, {"other"s}, returns(3)});
+    Class base{"Base"s, move(base_methods), nullptr};
+
+    vector<Method> middle_methods;
+    middle_methods.push_back({"__str__"s, {}, returns(10)});
+    middle_methods.push_back({"__add__"s, {"other"s}, returns(11)});
+    Class middle{"Middle"s, move(middle_methods), &base};
+
+    vector<Method> leaf_methods;
+    leaf_methods.push_back({"__init__"s, {}, returns(20)});
+    Class leaf{"Leaf"s, move(leaf_methods), &middle};
+
+    // Методы ищутся по всей цепочке предков, ближайший переопределённый метод побеждает
+    ASSERT(leaf.GetMethod("base_only"s) == base.GetMethod("base_only"s));
+    ASSERT(leaf.GetMethod("__str__"s) == middle.GetMethod("__str__"s));
+    ASSERT(leaf.GetMethod("missing"s) == nullptr);
+
+    ASSERT(leaf.GetMethod(SpecialMethod::INIT) == leaf.GetMethod("__init__"s));
+    ASSERT(leaf.GetMethod(SpecialMethod::STR) == middle.GetMethod("__str__"s));
+    ASSERT(leaf.GetMethod(SpecialMethod::EQ) == base.GetMethod("__eq__"s));
+    ASSERT(leaf.GetMethod(SpecialMethod::ADD) == middle.GetMethod("__add__"s));
+    ASSERT(leaf.GetMethod(SpecialMethod::LT) == nullptr);
+    ASSERT(base.GetMethod(SpecialMethod::INIT) == nullptr);
+
+    DummyContext ctx;
+    ClassInstance instance(leaf);
+    ASSERT(instance.HasMethod("base_only"s, 0));
+    ASSERT_EQUAL(instance.Call("base_only"s, {}, ctx).TryAs<Number>()->GetValue(), 2);
+    ostringstream out;
+    instance.Print(out, ctx);
+    ASSERT_EQUAL(out.str(), "10"s);
+}
+
+void TestMethodCache() {
+    vector<unique_ptr<Class>> classes;
+    for (int i = 0; i < 6; ++i) {
+        vector<Method> methods;
+        methods.push_back({"f"s, {"x"s}, make_unique<TestMethodBody>(nullptr)});
+        classes.push_back(make_unique<Class>("C"s + to_string(i), move(methods), nullptr));
+    }
+    const intern::Symbol f{"f"sv};
+    auto& stats = MethodCache::GetStatistics();
+    const auto saved = stats;
+    stats = {};
+
+    // Мономорфная точка вызова: промах только при первом вызове
+    MethodCache mono;
+    for (int i = 0; i < 10; ++i) {
+        ASSERT(mono.Find(*classes[0], f, 1) == classes[0]->GetMethod(f));
+    }
+    ASSERT_EQUAL(stats.hits, 9u);
+    ASSERT_EQUAL(stats.misses, 1u);
+
+    // Метод с другим числом параметров кешируется как отсутствующий
+    stats = {};
+    MethodCache arity;
+    ASSERT(arity.Find(*classes[0], f, 2) == nullptr);
+    ASSERT(arity.Find(*classes[0], f, 2) == nullptr);
+    ASSERT_EQUAL(stats.hits, 1u);
+
+    // Полиморфная точка вызова помнит до CAPACITY классов
+    stats = {};
+    MethodCache poly;
+    for (int round = 0; round < 3; ++round) {
+        for (size_t i = 0; i < MethodCache::CAPACITY; ++i) {
+            ASSERT(poly.Find(*classes[i], f, 1) == classes[i]->GetMethod(f));
+        }
+    }
+    ASSERT_EQUAL(stats.misses, uint64_t{MethodCache::CAPACITY});
+    ASSERT_EQUAL(stats.hits, uint64_t{MethodCache::CAPACITY * 2});
+
+    // Для большего числа классов поиск остаётся верным, но идёт по таблице класса
+    stats = {};
+    MethodCache mega;
+    for (int round = 0; round < 2; ++round) {
+        for (const auto& cls : classes) {
+            ASSERT(mega.Find(*cls, f, 1) == cls->GetMethod(f));
+        }
+    }
+    ASSERT(stats.misses > classes.size());
+
+    stats = saved;
+}
+
+void TestShapes() {
+    Class cls{"Point"s, {}, nullptr};
+    ClassInstance a(cls);
+    ClassInstance b(cls);
+    ClassInstance c(cls);
+    ASSERT(&a.Fields().GetShape() == &cls.GetEmptyShape());
+
+    a.Fields()["x"s] = ObjectHolder::Own(Number{1});
+    a.Fields()["y"s] = ObjectHolder::Own(Number{2});
+    b.Fields()["x"s] = ObjectHolder::Own(Number{3});
+    b.Fields()["y"s] = ObjectHolder::Own(Number{4});
+    c.Fields()["y"s] = ObjectHolder::Own(Number{5});
+    c.Fields()["x"s] = ObjectHolder::Own(Number{6});
+
+    // Поля, добавленные в одном порядке, дают одну форму
+    ASSERT(&a.Fields().GetShape() == &b.Fields().GetShape());
+    ASSERT(&a.Fields().GetShape() != &c.Fields().GetShape());
+    ASSERT_EQUAL(a.Fields().size(), 2u);
+    ASSERT_EQUAL(c.Fields().at("x"s).TryAs<Number>()->GetValue(), 6);
+    ASSERT(a.Fields().find("z"s) == a.Fields().end());
+    ASSERT_THROWS(a.Fields().at("z"s), out_of_range);
+
+    // Кеш чтения подходит объектам той же формы
+    FieldCache read;
+    const intern::Symbol y{"y"sv};
+    ASSERT_EQUAL(a.Fields().Find(y, read)->TryAs<Number>()->GetValue(), 2);
+    ASSERT(read.shape == &a.Fields().GetShape());
+    ASSERT_EQUAL(b.Fields().Find(y, read)->TryAs<Number>()->GetValue(), 4);
+    ASSERT_EQUAL(c.Fields().Find(y, read)->TryAs<Number>()->GetValue(), 5);
+    ASSERT(a.Fields().Find("z"s, read) == nullptr);
+
+    // Кеш записи запоминает переход в следующую форму
+    FieldCache write;
+    ClassInstance d(cls);
+    ClassInstance e(cls);
+    d.Fields().Assign("x"s, write) = ObjectHolder::Own(Number{7});
+    ASSERT(write.next == &d.Fields().GetShape());
+    e.Fields().Assign("x"s, write) = ObjectHolder::Own(Number{8});
+    ASSERT(&e.Fields().GetShape() == &d.Fields().GetShape());
+    ASSERT_EQUAL(e.Fields().at("x"s).TryAs<Number>()->GetValue(), 8);
+    // Повторная запись в то же поле не меняет форму
+    e.Fields().Assign("x"s, write) = ObjectHolder::Own(Number{9});
+    ASSERT_EQUAL(e.Fields().size(), 1u);
+    ASSERT_EQUAL(e.Fields().at("x"s).TryAs<Number>()->GetValue(), 9);
+}
+
+void TestClosure() {
+    Closure closure;
+    ASSERT(closure.empty());
+    ASSERT(closure.find("x"s) == closure.end());
+    ASSERT_THROWS(closure.at("x"s), std::out_of_range);
+
+    // Enough names to switch from linear search to the hash index
+    const size_t count = intern::SymbolMap<ObjectHolder>::LINEAR_LIMIT * 10;
+    for (size_t i = 0; i < count; ++i) {
+        closure["v"s + to_string(i)] = ObjectHolder::Own(Number{static_cast<int>(i)});
+    }
+    ASSERT_EQUAL(closure.size(), count);
+    for (size_t i = 0; i < count; ++i) {
+        const auto it = closure.find("v"s + to_string(i));
+        ASSERT(it != closure.end());
+        ASSERT_EQUAL(it->second.TryAs<Number>()->GetValue(), static_cast<int>(i));
+    }
+    ASSERT_EQUAL(closure.count("v"s), 0u);
+
+    // Elements are kept in insertion order
+    int expected = 0;
+    for (const auto& [name, value] : closure) {
+        ASSERT_EQUAL(name, "v"s + to_string(expected));
+        ASSERT_EQUAL(value.TryAs<Number>()->GetValue(), expected++);
+    }
+
+    const auto [it, inserted] = closure.insert({"v0"s, ObjectHolder::None()});
+    ASSERT(!inserted);
+    ASSERT_EQUAL(it->second.TryAs<Number>()->GetValue(), 0);
+
+    closure.clear();
+    ASSERT(closure.empty());
+    ASSERT(closure.find("v1"s) == closure.end());
+    closure["v1"s] = ObjectHolder::Own(Number{1});
+    ASSERT_EQUAL(closure.at("v1"s).TryAs<Number>()->GetValue(), 1);
+}
+
+void TestFrames() {
+    const ObjectHolder* values = nullptr;
+    {
+        Frame outer;
+        outer.Values().assign(8, ObjectHolder::Own(Number{1}));
+        outer.GetClosure()["x"s] = ObjectHolder::Own(Number{2});
+        values = outer.Values().data();
+        {
+            // A nested call gets its own frame
+            Frame inner;
+            ASSERT(inner.Values().empty());
+            ASSERT(inner.GetClosure().empty());
+            ASSERT(inner.Values().data() != values);
+        }
+        ASSERT_EQUAL(outer.Values().size(), 8u);
+        ASSERT_EQUAL(outer.GetClosure().at("x"s).TryAs<Number>()->GetValue(), 2);
+    }
+    // A released frame is cleared but keeps its memory for the next call at the same depth
+    Frame frame;
+    ASSERT(frame.Values().empty());
+    ASSERT(frame.GetClosure().empty());
+    ASSERT(frame.Values().capacity() >= 8u);
+    ASSERT(frame.Values().data() == values);
+}
+
+void TestPendingTailCall() {
+    vector<Method> methods;
+    methods.push_back({"m"s, {"a"s, "b"s}, make_unique<TestMethodBody>(nullptr)});
+    Class cls{"Tail"s, move(methods), nullptr};
+    ClassInstance instance{cls};
+    const Method& method = *cls.GetMethod("m"s);
+
+    ASSERT(!PendingTailCall::IsSet());
+    vector<ObjectHolder> args = {ObjectHolder::Own(Number{1}), ObjectHolder::Own(Number{2})};
+    PendingTailCall::Set(method, ObjectHolder::Share(instance), args);
+    ASSERT(PendingTailCall::IsSet());
+
+    Frame frame;
+    frame.GetClosure()["stale"s] = ObjectHolder::None();
+    ObjectHolder object;
+    ASSERT(PendingTailCall::Take(frame, object) == &method);
+    ASSERT(!PendingTailCall::IsSet());
+    ASSERT(object.TryAs<ClassInstance>() == &instance);
+    ASSERT_EQUAL(frame.Values().size(), 2u);
+    ASSERT(frame.GetClosure().empty());
+
+    PendingTailCall::BindFrame(method, object, frame);
+    ASSERT(frame.GetClosure().at("self"s).TryAs<ClassInstance>() == &instance);
+    ASSERT_EQUAL(frame.GetClosure().at("a"s).TryAs<Number>()->GetValue(), 1);
+    ASSERT_EQUAL(frame.GetClosure().at("b"s).TryAs<Number>()->GetValue(), 2);
+
+    // Nothing is pending any more
+    ASSERT(PendingTailCall::Take(frame, object) == nullptr);
+}
+
 void TestClassInstance() {
     vector<Method> methods;
 
@@ -538,14 +945,24 @@ void RunObjectsTests(TestRunner& tr) {
     RUN_TEST(tr, runtime::TestMethodInvocation);
     RUN_TEST(tr, runtime::TestIsTrue);
     RUN_TEST(tr, runtime::TestComparison);
+    RUN_TEST(tr, runtime::TestThreeWayComparison);
+    RUN_TEST(tr, runtime::TestCompareValues);
     RUN_TEST(tr, runtime::TestClass);
     RUN_TEST(tr, runtime::TestClassInstance);
+    RUN_TEST(tr, runtime::TestClosure);
+    RUN_TEST(tr, runtime::TestFrames);
+    RUN_TEST(tr, runtime::TestPendingTailCall);
+    RUN_TEST(tr, runtime::TestInheritedMethods);
+    RUN_TEST(tr, runtime::TestMethodCache);
+    RUN_TEST(tr, runtime::TestShapes);
 }
 
 void RunObjectHolderTests(TestRunner& tr) {
     RUN_TEST(tr, runtime::TestNonowning);
     RUN_TEST(tr, runtime::TestOwning);
     RUN_TEST(tr, runtime::TestMove);
+    RUN_TEST(tr, runtime::TestImmortalValues);
+    RUN_TEST(tr, runtime::TestTypeTags);
     RUN_TEST(tr, runtime::TestNullptr);
 }
 
@@ -0,0 +1,262 @@
+﻿#include "scan.h"
+
+#include <stdexcept>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MYTHON_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace parse::scan {
+
+namespace {
+
+bool IsWhitespace(char c) {
+    return c == ' ' || (static_cast<unsigned char>(c) - 9U) <= 4U;
+}
+
+const char* ScalarFindNewline(const char* begin, const char* end) {
+    while (begin != end && *begin != '\n') {
+        ++begin;
+    }
+    return begin;
+}
+
+const char* ScalarFindQuoteOrBackslash(const char* begin, const char* end, char quote) {
+    while (begin != end && *begin != quote && *begin != '\\') {
+        ++begin;
+    }
+    return begin;
+}
+
+const char* ScalarSkipSpaces(const char* begin, const char* end) {
+    while (begin != end && *begin == ' ') {
+        ++begin;
+    }
+    return begin;
+}
+
+const char* ScalarSkipWhitespace(const char* begin, const char* end) {
+    while (begin != end && IsWhitespace(*begin)) {
+        ++begin;
+    }
+    return begin;
+}
+
+constexpr Kernels SCALAR_KERNELS = {
+    ScalarFindNewline,
+    ScalarFindQuoteOrBackslash,
+    ScalarSkipSpaces,
+    ScalarSkipWhitespace,
+};
+
+#ifdef MYTHON_SCAN_X86
+
+/*
+ * Векторные версии обрабатывают по 16 (SSE2) или 32 (AVX2) байта за итерацию:
+ * сравнивают блок с искомыми символами, собирают маску совпадений и берут номер
+ * младшего установленного бита. Хвост короче блока дочитывается скалярной версией
+ */
+
+__attribute__((target("sse2"))) inline __m128i Sse2WhitespaceMask(__m128i block) {
+    // '\t'..'\r' - это коды 9..13: после вычитания 9 они становятся не больше 4
+    const __m128i shifted = _mm_sub_epi8(block, _mm_set1_epi8(9));
+    const __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+    return _mm_or_si128(in_range, _mm_cmpeq_epi8(block, _mm_set1_epi8(' ')));
+}
+
+__attribute__((target("sse2"))) const char* Sse2FindNewline(const char* begin,
+                                                              const char* end) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; end - begin >= 16; begin += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        if (int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline))) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    return ScalarFindNewline(begin, end);
+}
+
+__attribute__((target("sse2"))) const char* Sse2FindQuoteOrBackslash(const char* begin,
+                                                                       const char* end,
+                                                                       char quote) {
+    const __m128i quote_vec = _mm_set1_epi8(quote);
+    const __m128i backslash = _mm_set1_epi8('\\');
+    for (; end - begin >= 16; begin += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        const __m128i hits
+            = _mm_or_si128(_mm_cmpeq_epi8(block, quote_vec), _mm_cmpeq_epi8(block, backslash));
+        if (int mask = _mm_movemask_epi8(hits)) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    return ScalarFindQuoteOrBackslash(begin, end, quote);
+}
+
+__attribute__((target("sse2"))) const char* Sse2SkipSpaces(const char* begin, const char* end) {
+    const __m128i space = _mm_set1_epi8(' ');
+    for (; end - begin >= 16; begin += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        if (int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(block, space)) & 0xFFFF) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    return ScalarSkipSpaces(begin, end);
+}
+
+__attribute__((target("sse2"))) const char* Sse2SkipWhitespace(const char* begin,
+                                                                 const char* end) {
+    for (; end - begin >= 16; begin += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        if (int mask = ~_mm_movemask_epi8(Sse2WhitespaceMask(block)) & 0xFFFF) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    return ScalarSkipWhitespace(begin, end);
+}
+
+__attribute__((target("avx2"))) inline __m256i Avx2WhitespaceMask(__m256i block) {
+    const __m256i shifted = _mm256_sub_epi8(block, _mm256_set1_epi8(9));
+    const __m256i in_range
+        = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+    return _mm256_or_si256(in_range, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')));
+}
+
+__attribute__((target("avx2"))) const char* Avx2FindNewline(const char* begin,
+                                                              const char* end) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for (; end - begin >= 32; begin += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        if (unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline))) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    return Sse2FindNewline(begin, end);
+}
+
+__attribute__((target("avx2"))) const char* Avx2FindQuoteOrBackslash(const char* begin,
+                                                                       const char* end,
+                                                                       char quote) {
+    const __m256i quote_vec = _mm256_set1_epi8(quote);
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    for (; end - begin >= 32; begin += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        const __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(block, quote_vec),
+                                             _mm256_cmpeq_epi8(block, backslash));
+        if (unsigned mask = _mm256_movemask_epi8(hits)) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    return Sse2FindQuoteOrBackslash(begin, end, quote);
+}
+
+__attribute__((target("avx2"))) const char* Avx2SkipSpaces(const char* begin, const char* end) {
+    const __m256i space = _mm256_set1_epi8(' ');
+    for (; end - begin >= 32; begin += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        if (unsigned mask = ~static_cast<unsigned>(
+                _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, space)))) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    return Sse2SkipSpaces(begin, end);
+}
+
+__attribute__((target("avx2"))) const char* Avx2SkipWhitespace(const char* begin,
+                                                                 const char* end) {
+    for (; end - begin >= 32; begin += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        if (unsigned mask
+            = ~static_cast<unsigned>(_mm256_movemask_epi8(Avx2WhitespaceMask(block)))) {
+            return begin + __builtin_ctz(mask);
+        }
+    }
+    return Sse2SkipWhitespace(begin, end);
+}
+
+constexpr Kernels SSE2_KERNELS = {
+    Sse2FindNewline,
+    Sse2FindQuoteOrBackslash,
+    Sse2SkipSpaces,
+    Sse2SkipWhitespace,
+};
+
+constexpr Kernels AVX2_KERNELS = {
+    Avx2FindNewline,
+    Avx2FindQuoteOrBackslash,
+    Avx2SkipSpaces,
+    Avx2SkipWhitespace,
+};
+
+#endif  // MYTHON_SCAN_X86
+
+Isa DetectIsa() {
+#ifdef MYTHON_SCAN_X86
+    if (IsSupported(Isa::AVX2)) {
+        return Isa::AVX2;
+    }
+    if (IsSupported(Isa::SSE2)) {
+        return Isa::SSE2;
+    }
+#endif
+    return Isa::SCALAR;
+}
+
+}  // namespace
+
+bool IsSupported(Isa isa) {
+    switch (isa) {
+    case Isa::SCALAR:
+        return true;
+#ifdef MYTHON_SCAN_X86
+    case Isa::SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case Isa::AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+const Kernels& GetKernels(Isa isa) {
+    if (!IsSupported(isa)) {
+        throw invalid_argument("Instruction set is not supported: "s + string(IsaName(isa)));
+    }
+#ifdef MYTHON_SCAN_X86
+    if (isa == Isa::AVX2) {
+        return AVX2_KERNELS;
+    }
+    if (isa == Isa::SSE2) {
+        return SSE2_KERNELS;
+    }
+#endif
+    return SCALAR_KERNELS;
+}
+
+const Kernels& ActiveKernels() {
+    static const Kernels& kernels = GetKernels(ActiveIsa());
+    return kernels;
+}
+
+Isa ActiveIsa() {
+    static const Isa isa = DetectIsa();
+    return isa;
+}
+
+std::string_view IsaName(Isa isa) {
+    switch (isa) {
+    case Isa::SSE2:
+        return "sse2"sv;
+    case Isa::AVX2:
+        return "avx2"sv;
+    default:
+        return "scalar"sv;
+    }
+}
+
+}  // namespace parse::scan
@@ -0,0 +1,45 @@
+﻿#pragma once
+
+#include <string_view>
+
+namespace parse::scan {
+
+// Набор команд, которым реализованы функции поиска
+enum class Isa {
+    SCALAR,
+    SSE2,
+    AVX2,
+};
+
+/*
+ * Функции поиска по диапазону [begin, end). Каждая возвращает указатель на первый
+ * подходящий символ либо end, если такого символа нет
+ */
+struct Kernels {
+    // Первый символ '\n'
+    const char* (*find_newline)(const char* begin, const char* end);
+    // Первый символ, равный quote или '\\'
+    const char* (*find_quote_or_backslash)(const char* begin, const char* end, char quote);
+    // Первый символ, отличный от ' '
+    const char* (*skip_spaces)(const char* begin, const char* end);
+    // Первый символ, не являющийся пробельным (' ', '\t', '\n', '\v', '\f', '\r')
+    const char* (*skip_whitespace)(const char* begin, const char* end);
+};
+
+// Возвращает true, если процессор поддерживает набор команд isa
+bool IsSupported(Isa isa);
+
+// Возвращает реализацию функций поиска для набора команд isa.
+// Набор команд должен поддерживаться процессором
+const Kernels& GetKernels(Isa isa);
+
+// Возвращает самую быструю реализацию, доступную на текущем процессоре.
+// Выбор делается один раз при первом обращении
+const Kernels& ActiveKernels();
+
+// Возвращает набор команд, выбранный ActiveKernels
+Isa ActiveIsa();
+
+std::string_view IsaName(Isa isa);
+
+}  // namespace parse::scan
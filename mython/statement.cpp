@@ -13,58 +13,88 @@ using runtime::Context;
 using runtime::ObjectHolder;
 
 namespace {
-const string ADD_METHOD = "__add__"s;
-const string INIT_METHOD = "__init__"s;
+const intern::Symbol INIT_METHOD{"__init__"sv};
+
+// Переносит узлы в массив, размещённый в арене текущей области
+StatementList MakeStatementList(vector<unique_ptr<Statement>> statements) {
+    StatementList result(runtime::ArenaScope::CurrentResource());
+    result.reserve(statements.size());
+    for (auto& statement : statements) {
+        result.push_back(std::move(statement));
+    }
+    return result;
+}
+
+/*
+ * Выполнение return без исключений. В теле метода Return поднимает флаг returning
+ * и возвращает своё значение, Compound при поднятом флаге прекращает работу
+ * и передаёт значение дальше (IfElse и так возвращает результат ветки),
+ * а MethodBody снимает флаг. Вне тела метода return выбрасывает ReturnException
+ */
+struct ReturnState {
+    // Число тел методов, выполняемых деревом в этом потоке
+    size_t method_depth = 0;
+    bool returning = false;
+};
+
+thread_local ReturnState return_state;
+
+// Отмечает выполнение тела метода и на выходе, в том числе по исключению, снимает отметку
+class MethodScope {
+public:
+    MethodScope() {
+        ++return_state.method_depth;
+    }
+
+    MethodScope(const MethodScope&) = delete;
+    MethodScope& operator=(const MethodScope&) = delete;
+
+    ~MethodScope() {
+        --return_state.method_depth;
+    }
+};
+
+// true, если оба значения - числа
+bool AreNumbers(const ObjectHolder& lhs, const ObjectHolder& rhs) {
+    return lhs.GetType() == runtime::ObjectType::NUMBER
+           && rhs.GetType() == runtime::ObjectType::NUMBER;
+}
 }  // namespace
 
 ObjectHolder Assignment::Execute(Closure& closure, Context& context) {
-    closure[var_] = rv_->Execute(closure, context);
-    return closure[var_];
+    ObjectHolder value = rv_->Execute(closure, context);
+    return closure[var_] = std::move(value);
 }
 
-Assignment::Assignment(std::string var, std::unique_ptr<Statement> rv)
-    :var_(std::move(var))
+Assignment::Assignment(intern::Symbol var, std::unique_ptr<Statement> rv)
+    :var_(var)
     ,rv_(std::move(rv))
 {
 }
 
 VariableValue::VariableValue(const std::string& var_name)
-    :var_name_(std::move(var_name))
+    :dotted_ids_(1, intern::Symbol(var_name), runtime::ArenaScope::CurrentResource())
+    ,field_caches_(1, runtime::ArenaScope::CurrentResource())
 {
 
 }
 
 VariableValue::VariableValue(std::vector<std::string> dotted_ids)
-    :dotted_ids_(std::move(dotted_ids))
+    :dotted_ids_(dotted_ids.begin(), dotted_ids.end(), runtime::ArenaScope::CurrentResource())
+    ,field_caches_(dotted_ids_.size(), runtime::ArenaScope::CurrentResource())
+{
+
+}
+
+VariableValue::VariableValue(std::vector<intern::Symbol> dotted_ids)
+    :dotted_ids_(dotted_ids.begin(), dotted_ids.end(), runtime::ArenaScope::CurrentResource())
+    ,field_caches_(dotted_ids_.size(), runtime::ArenaScope::CurrentResource())
 {
 
 }
 
 ObjectHolder VariableValue::Execute(Closure& closure, Context& /*context*/) {
-    using runtime::ClassInstance;
-    if(var_name_) {
-        if(closure.count(var_name_.value())) {
-            return closure.at(var_name_.value());
-        }
-    } else if (dotted_ids_) {    
-        if(dotted_ids_.value().size() > 0
-           && closure.count(dotted_ids_.value().front()))
-        {
-            ObjectHolder obj_current = closure.at(dotted_ids_.value().front());
-            ClassInstance* cl_i = obj_current.TryAs<ClassInstance>();
-            if( !cl_i && dotted_ids_.value().size() == 1) {
-                return obj_current;
-            }
-            for (size_t i = 1; i < dotted_ids_.value().size();
-                 ++i, cl_i = obj_current.TryAs<ClassInstance>() )
-            {
-                obj_current = cl_i->Fields().at(dotted_ids_.value()[i]);
-            }
-            return obj_current;
-        }
-    }
-    throw std::runtime_error("value undefined"s);
-//    return {};
+    return LookupVariable(closure, dotted_ids_.data(), dotted_ids_.size(), field_caches_.data());
 }
 
 unique_ptr<Print> Print::Variable(const std::string& name) {
@@ -79,19 +109,14 @@ Print::Print(unique_ptr<Statement> argument)
 }
 
 Print::Print(vector<unique_ptr<Statement>> args)
-    :args_(std::move(args))
+    :args_(MakeStatementList(std::move(args)))
 {
 
 }
 
 ObjectHolder Print::Execute(Closure& closure, Context& context) {
     if(argument_) {
-        runtime::Object* obj = argument_.value()->Execute(closure, context).Get();
-        if(obj) {
-            obj->Print(context.GetOutputStream(), context);
-        } else {
-            context.GetOutputStream() << "None";
-        }
+        PrintValue(argument_.value()->Execute(closure, context), context);
         context.GetOutputStream() << endl;
         return argument_.value()->Execute(closure, context);
     } else if(args_) {
@@ -101,11 +126,7 @@ ObjectHolder Print::Execute(Closure& closure, Context& context) {
             if (flg_no_first) {
                 context.GetOutputStream() << " ";
             }
-            if(obj) {
-                obj->Print(context.GetOutputStream(), context);
-            } else {
-                context.GetOutputStream() << "None";
-            }
+            PrintValue(obj, context);
             flg_no_first = true;
         }
         context.GetOutputStream() << endl;
@@ -113,113 +134,213 @@ ObjectHolder Print::Execute(Closure& closure, Context& context) {
     return {};
 }
 
-MethodCall::MethodCall(std::unique_ptr<Statement> object, std::string method,
+MethodCall::MethodCall(std::unique_ptr<Statement> object, intern::Symbol method,
                        std::vector<std::unique_ptr<Statement>> args)
     :object_(std::move(object))
-    ,method_(std::move(method))
-    ,args_(std::move(args))
+    ,method_(method)
+    ,args_(MakeStatementList(std::move(args)))
 {
 
 }
 
 ObjectHolder MethodCall::Execute(Closure& closure, Context& context) {
-    runtime::ClassInstance* cls_i = object_->Execute(closure, context).TryAs<runtime::ClassInstance>();
+    // объект должен жить до конца вызова, даже если на него больше никто не ссылается
+    ObjectHolder object = object_->Execute(closure, context);
+    runtime::ClassInstance* cls_i = object.TryAs<runtime::ClassInstance>();
     if(cls_i) {
-        std::vector<ObjectHolder> actual_args;
-        actual_args.reserve(args_.size());
+        runtime::Frame frame;
+        std::vector<ObjectHolder>& actual_args = frame.Values();
         for(auto& arg : args_) {
             actual_args.push_back(arg->Execute(closure, context));
         }
-        return cls_i->Call(method_, actual_args, context);
+        return cls_i->Call(cache_, method_, actual_args, context);
     }
     return {};
 }
 
-ObjectHolder Stringify::Execute(Closure& closure, Context& context) {
-    runtime::DummyContext cntxt;
-    //runtime::Object* obj = argument_->Execute(closure, context).Get();
-    ObjectHolder obj = argument_->Execute(closure, context);
-    if(obj) {
-        obj->Print(cntxt.GetOutputStream(), cntxt);
-    } else {
-        cntxt.output << "None"s;
+const runtime::Method* MethodCall::Prepare(Closure& closure, Context& context,
+                                           ObjectHolder& object, vector<ObjectHolder>& args) {
+    object = object_->Execute(closure, context);
+    runtime::ClassInstance* cls_i = object.TryAs<runtime::ClassInstance>();
+    if (cls_i == nullptr) {
+        return nullptr;
     }
-    return ObjectHolder::Own<runtime::String>(cntxt.output.str());
+    for (auto& arg : args_) {
+        args.push_back(arg->Execute(closure, context));
+    }
+    const runtime::Method* method = cache_.Find(cls_i->GetClass(), method_, args.size());
+    if (method == nullptr) {
+        throw std::runtime_error("Not implemented"s);
+    }
+    return method;
+}
+
+ObjectHolder Stringify::Execute(Closure& closure, Context& context) {
+    return StringifyValue(argument_->Execute(closure, context));
 }
 
 ObjectHolder Add::Execute(Closure& closure, Context& context) {
     ObjectHolder lhs = lhs_->Execute(closure, context);
     ObjectHolder rhs = rhs_->Execute(closure, context);
-
-    if(lhs.TryAs<runtime::Number>()
-       && rhs.TryAs<runtime::Number>()) {
-       return  ObjectHolder::Own<runtime::Number>(lhs.TryAs<runtime::Number>()->GetValue() +
-               rhs.TryAs<runtime::Number>()->GetValue());
-    }
-    if(lhs.TryAs<runtime::String>()
-       && rhs.TryAs<runtime::String>()) {
-       return  ObjectHolder::Own<runtime::String>(lhs.TryAs<runtime::String>()->GetValue() +
-               rhs.TryAs<runtime::String>()->GetValue());
-    }
-    if(runtime::ClassInstance* cl_i = lhs.TryAs<runtime::ClassInstance>();
-       cl_i)
-    {
-       if (cl_i->HasMethod(ADD_METHOD, 1 )) {
-           return cl_i->Call(ADD_METHOD, {rhs}, context);
-       }
-    }
-    throw std::runtime_error("Add unsuccess!");
+    return AddValues(lhs, rhs, context);
 }
 
 ObjectHolder Sub::Execute(Closure& closure, Context& context) {
     ObjectHolder lhs = lhs_->Execute(closure, context);
     ObjectHolder rhs = rhs_->Execute(closure, context);
-
-    if(lhs.TryAs<runtime::Number>()
-       && rhs.TryAs<runtime::Number>()) {
-       return  ObjectHolder::Own<runtime::Number>(lhs.TryAs<runtime::Number>()->GetValue() -
-               rhs.TryAs<runtime::Number>()->GetValue());
-    }
-    throw std::runtime_error("Sub unsuccess!");
+    return SubValues(lhs, rhs);
 }
 
 ObjectHolder Mult::Execute(Closure& closure, Context& context) {
     ObjectHolder lhs = lhs_->Execute(closure, context);
     ObjectHolder rhs = rhs_->Execute(closure, context);
-
-    if(lhs.TryAs<runtime::Number>()
-       && rhs.TryAs<runtime::Number>()) {
-       return  ObjectHolder::Own<runtime::Number>(lhs.TryAs<runtime::Number>()->GetValue() *
-               rhs.TryAs<runtime::Number>()->GetValue());
-    }
-    throw std::runtime_error("Mult unsuccess!");
+    return MultValues(lhs, rhs);
 }
 
 ObjectHolder Div::Execute(Closure& closure, Context& context) {
     ObjectHolder lhs = lhs_->Execute(closure, context);
     ObjectHolder rhs = rhs_->Execute(closure, context);
+    return DivValues(lhs, rhs);
+}
 
-    if(lhs.TryAs<runtime::Number>()
-       && rhs.TryAs<runtime::Number>()
-       && rhs.TryAs<runtime::Number>()->GetValue() != 0) {
-       return  ObjectHolder::Own<runtime::Number>(lhs.TryAs<runtime::Number>()->GetValue() /
-               rhs.TryAs<runtime::Number>()->GetValue() );
+ObjectHolder AddValues(const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+    switch (lhs.GetType()) {
+        case runtime::ObjectType::NUMBER:
+            if (rhs.GetType() == runtime::ObjectType::NUMBER) {
+                return ObjectHolder::Own<runtime::Number>(lhs.As<runtime::Number>().GetValue() +
+                                                          rhs.As<runtime::Number>().GetValue());
+            }
+            break;
+        case runtime::ObjectType::STRING:
+            if (rhs.GetType() == runtime::ObjectType::STRING) {
+                return ObjectHolder::Own<runtime::String>(lhs.As<runtime::String>().GetValue() +
+                                                          rhs.As<runtime::String>().GetValue());
+            }
+            break;
+        case runtime::ObjectType::INSTANCE:
+            if (auto& cl_i = lhs.As<runtime::ClassInstance>();
+                const runtime::Method* add = cl_i.GetClass().GetMethod(runtime::SpecialMethod::ADD)) {
+                if (add->formal_params.size() == 1) {
+                    return cl_i.Call(*add, {rhs}, context);
+                }
+            }
+            break;
+        default:
+            break;
     }
-    ostringstream in;
-    in << lhs.TryAs<runtime::Number>()->GetValue() << " / ";
-    in << rhs.TryAs<runtime::Number>()->GetValue();
-    throw std::runtime_error("Div unsuccess! " + in.str());
+    throw std::runtime_error("Add unsuccess!");
+}
+
+ObjectHolder SubValues(const ObjectHolder& lhs, const ObjectHolder& rhs) {
+    if (AreNumbers(lhs, rhs)) {
+        return ObjectHolder::Own<runtime::Number>(lhs.As<runtime::Number>().GetValue() -
+                                                  rhs.As<runtime::Number>().GetValue());
+    }
+    throw std::runtime_error("Sub unsuccess!");
+}
+
+ObjectHolder MultValues(const ObjectHolder& lhs, const ObjectHolder& rhs) {
+    if (AreNumbers(lhs, rhs)) {
+        return ObjectHolder::Own<runtime::Number>(lhs.As<runtime::Number>().GetValue() *
+                                                  rhs.As<runtime::Number>().GetValue());
+    }
+    throw std::runtime_error("Mult unsuccess!");
+}
+
+ObjectHolder DivValues(const ObjectHolder& lhs, const ObjectHolder& rhs) {
+    if (!AreNumbers(lhs, rhs)) {
+        throw std::runtime_error("Div unsuccess!");
+    }
+    const int divisor = rhs.As<runtime::Number>().GetValue();
+    if (divisor == 0) {
+        throw std::runtime_error("Div unsuccess! "s
+                                 + to_string(lhs.As<runtime::Number>().GetValue()) + " / 0"s);
+    }
+    return ObjectHolder::Own<runtime::Number>(lhs.As<runtime::Number>().GetValue() / divisor);
+}
+
+ObjectHolder StringifyValue(const ObjectHolder& value) {
+    runtime::DummyContext cntxt;
+    if(value) {
+        value->Print(cntxt.GetOutputStream(), cntxt);
+    } else {
+        cntxt.output << "None"s;
+    }
+    return ObjectHolder::Own<runtime::String>(cntxt.output.str());
+}
+
+void PrintValue(const ObjectHolder& value, Context& context) {
+    if(value) {
+        value->Print(context.GetOutputStream(), context);
+    } else {
+        context.GetOutputStream() << "None";
+    }
+}
+
+ObjectHolder LookupFields(ObjectHolder object, const intern::Symbol* ids, size_t count,
+                          runtime::FieldCache* caches) {
+    for (size_t i = 0; i < count; ++i) {
+        auto* cl_i = object.TryAs<runtime::ClassInstance>();
+        if (cl_i == nullptr) {
+            throw std::runtime_error("value undefined"s);
+        }
+        if (caches == nullptr) {
+            object = cl_i->Fields().at(ids[i]);
+        } else if (ObjectHolder* field = cl_i->Fields().Find(ids[i], caches[i])) {
+            object = *field;
+        } else {
+            throw std::out_of_range("No field "s + ids[i].Name());
+        }
+    }
+    return object;
+}
+
+ObjectHolder LookupVariable(Closure& closure, const intern::Symbol* ids, size_t count,
+                            runtime::FieldCache* caches) {
+    if(count != 0) {
+        if(auto it = closure.find(ids[0]); it != closure.end()) {
+            if (count == 1) {
+                return it->second;
+            }
+            return LookupFields(it->second, ids + 1, count - 1,
+                                caches != nullptr ? caches + 1 : nullptr);
+        }
+    }
+    throw std::runtime_error("value undefined"s);
 }
 
 ObjectHolder Compound::Execute(Closure& closure, Context& context) {
     for(auto& stmt : stmts_) {
-        stmt->Execute(closure, context);
+        ObjectHolder result = stmt->Execute(closure, context);
+        if (return_state.returning) {
+            return result;
+        }
     }
     return ObjectHolder::None();
 }
 
 ObjectHolder Return::Execute(Closure& closure, Context& context) {
-    throw ReturnException(statement_->Execute(closure, context));
+    if (tail_call_ != nullptr && return_state.method_depth != 0) {
+        PrepareTailCall(closure, context);
+        return {};
+    }
+    ObjectHolder result = statement_->Execute(closure, context);
+    if (return_state.method_depth == 0) {
+        throw ReturnException(std::move(result));
+    }
+    return_state.returning = true;
+    return result;
+}
+
+void Return::PrepareTailCall(Closure& closure, Context& context) {
+    // Аргументы собираются в своём кадре: их вычисление может само дойти до return
+    runtime::Frame frame;
+    ObjectHolder object;
+    const runtime::Method* method = tail_call_->Prepare(closure, context, object, frame.Values());
+    return_state.returning = true;
+    if (method != nullptr) {
+        runtime::PendingTailCall::Set(*method, std::move(object), frame.Values());
+    }
 }
 
 ClassDefinition::ClassDefinition(ObjectHolder cls)
@@ -230,15 +351,16 @@ ClassDefinition::ClassDefinition(ObjectHolder cls)
 
 ObjectHolder ClassDefinition::Execute(Closure& closure, Context& /*context*/) {
     runtime::Class* cls = cls_.TryAs<runtime::Class>();
-    std::string name = cls->GetName();
-    closure[name] = ObjectHolder::Share(*cls);
-    return closure[std::move(name)];
+    const intern::Symbol name = cls->GetName();
+    // Замыкание владеет классом наравне с деревом, поэтому класс и его методы
+    // переживают программу, в которой были объявлены
+    return closure[name] = cls_;
 }
 
-FieldAssignment::FieldAssignment(VariableValue object, std::string field_name,
+FieldAssignment::FieldAssignment(VariableValue object, intern::Symbol field_name,
                                  std::unique_ptr<Statement> rv)
     :object_(std::move(object))
-    ,field_name_(std::move(field_name))
+    ,field_name_(field_name)
     ,rv_(std::move(rv))
 {
 }
@@ -250,8 +372,8 @@ ObjectHolder FieldAssignment::Execute(Closure& closure, Context& context) {
         cl_i)
     {
         // добавляем поле с именем и значение типа ObjectHolder
-        cl_i->Fields()[field_name_] = rv_->Execute(closure, context);
-        return cl_i->Fields().at(field_name_);
+        ObjectHolder value = rv_->Execute(closure, context);
+        return cl_i->Fields().Assign(field_name_, cache_) = std::move(value);
     }
     return {};
 }
@@ -304,6 +426,38 @@ Comparison::Comparison(Comparator cmp, unique_ptr<Statement> lhs, unique_ptr<Sta
 {
 }
 
+Comparison::Comparison(runtime::CompareOp op, unique_ptr<Statement> lhs,
+                       unique_ptr<Statement> rhs)
+    : BinaryOperation(std::move(lhs), std::move(rhs))
+    ,cmp_([op](const ObjectHolder& lhs, const ObjectHolder& rhs, Context& context) {
+        return runtime::CompareObjects(op, lhs, rhs, context);
+    })
+    ,op_(op)
+{
+}
+
+unique_ptr<Comparison> Comparison::Create(runtime::CompareOp op, unique_ptr<Statement> lhs,
+                                          unique_ptr<Statement> rhs) {
+    using runtime::CompareOp;
+    switch (op) {
+        case CompareOp::EQUAL:
+            return make_unique<ComparisonOf<CompareOp::EQUAL>>(std::move(lhs), std::move(rhs));
+        case CompareOp::NOT_EQUAL:
+            return make_unique<ComparisonOf<CompareOp::NOT_EQUAL>>(std::move(lhs), std::move(rhs));
+        case CompareOp::LESS:
+            return make_unique<ComparisonOf<CompareOp::LESS>>(std::move(lhs), std::move(rhs));
+        case CompareOp::GREATER:
+            return make_unique<ComparisonOf<CompareOp::GREATER>>(std::move(lhs), std::move(rhs));
+        case CompareOp::LESS_OR_EQUAL:
+            return make_unique<ComparisonOf<CompareOp::LESS_OR_EQUAL>>(std::move(lhs),
+                                                                       std::move(rhs));
+        case CompareOp::GREATER_OR_EQUAL:
+            return make_unique<ComparisonOf<CompareOp::GREATER_OR_EQUAL>>(std::move(lhs),
+                                                                          std::move(rhs));
+    }
+    throw std::logic_error("Unknown comparison"s);
+}
+
 ObjectHolder Comparison::Execute(Closure& closure, Context& context) {
     ObjectHolder lhs = lhs_->Execute(closure, context);
     ObjectHolder rhs = rhs_->Execute(closure, context);
@@ -313,7 +467,7 @@ ObjectHolder Comparison::Execute(Closure& closure, Context& context) {
 
 NewInstance::NewInstance(const runtime::Class& class_, std::vector<std::unique_ptr<Statement>> args)
     :cls_(&class_)
-    ,args_(std::move(args)) {
+    ,args_(MakeStatementList(std::move(args))) {
 }
 
 NewInstance::NewInstance(const runtime::Class& class_)
@@ -322,29 +476,20 @@ NewInstance::NewInstance(const runtime::Class& class_)
 
 ObjectHolder NewInstance::Execute(Closure& closure, Context& context) {
     ObjectHolder obj_cls_i = ObjectHolder::Own(runtime::ClassInstance(*cls_));
-    runtime::ClassInstance* cls_i = obj_cls_i.TryAs<runtime::ClassInstance>();
-    // если был вызов без параметров
-    if(!args_) {
-        // если конструктор без параметров
-        if(cls_i->HasMethod(INIT_METHOD, 0)) {
-            cls_i->Call(INIT_METHOD, {}, context);
-        }
-        return obj_cls_i;//ObjectHolder::Own(std::move(cl_i_));
+    const size_t arg_count = args_ ? args_->size() : 0;
+    const runtime::Method* init = init_cache_.Find(*cls_, INIT_METHOD, arg_count);
+    // без __init__ с подходящим числом параметров поля объекта не инициализируются
+    if (init == nullptr) {
+        return obj_cls_i;
     }
-    // если у класса есть метод init и колличество аргументов совпадает
-    else if(cls_i->HasMethod(INIT_METHOD, args_->size())) {
-        std::vector<ObjectHolder> actual_args;
-        actual_args.reserve(args_->size());
-        for(auto& arg : args_.value()) {
+    runtime::Frame frame;
+    std::vector<ObjectHolder>& actual_args = frame.Values();
+    if (args_) {
+        for (auto& arg : *args_) {
             actual_args.push_back(arg->Execute(closure, context));
         }
-        cls_i->Call(INIT_METHOD, actual_args, context);
-        //return ObjectHolder::Own(std::move(cl_i_));
-        //return ObjectHolder::Share(cl_i_);
-        return obj_cls_i;
     }
-    // инече возвращаем класс без инициализации полей
-    //return ObjectHolder::Own(std::move(cl_i_));
+    obj_cls_i.As<runtime::ClassInstance>().Call(*init, actual_args, context);
     return obj_cls_i;
 }
 
@@ -352,13 +497,56 @@ MethodBody::MethodBody(std::unique_ptr<Statement>&& body)
     :body_(std::move(body)){
 }
 
-ObjectHolder MethodBody::Execute(Closure& closure, Context& context) {
+inline ObjectHolder MethodBody::ExecuteBody(Closure& closure, Context& context) {
+    MethodScope scope;
     try {
-        body_->Execute(closure, context);
+        ObjectHolder result = body_->Execute(closure, context);
+        if (return_state.returning) {
+            return_state.returning = false;
+            return result;
+        }
     } catch (ReturnException& r) {
+        // return из узла, выполненного не деревом
         return r.obj_;
     }
     return ObjectHolder::None();
 }
 
+ObjectHolder MethodBody::Execute(Closure& closure, Context& context) {
+    ObjectHolder result = ExecuteBody(closure, context);
+    if (runtime::PendingTailCall::IsSet()) {
+        return ExecuteTailCalls(context);
+    }
+    return result;
+}
+
+ObjectHolder MethodBody::ExecuteTailCalls(Context& context) {
+    // Хвостовые вызовы выполняются по очереди в одном кадре
+    ObjectHolder result;
+    runtime::Frame frame;
+    ObjectHolder object;
+    while (const runtime::Method* method = runtime::PendingTailCall::Take(frame, object)) {
+        auto* body = dynamic_cast<MethodBody*>(method->body.get());
+        if (body == nullptr) {
+            // тело, выполняемое не деревом, вызывается обычным образом
+            result = object.As<runtime::ClassInstance>().Call(*method, frame.Values(), context);
+            continue;
+        }
+        runtime::PendingTailCall::BindFrame(*method, object, frame);
+        result = body->ExecuteBody(frame.GetClosure(), context);
+    }
+    return result;
+}
+
+Program::Program(std::vector<std::shared_ptr<runtime::NodeArena>> arenas,
+                 std::unique_ptr<Statement> body)
+    :arenas_(std::move(arenas))
+    ,body_(std::move(body))
+{
+}
+
+ObjectHolder Program::Execute(Closure& closure, Context& context) {
+    return body_->Execute(closure, context);
+}
+
 }  // namespace ast
@@ -1,13 +1,27 @@
 ﻿#pragma once
 
+#include "arena.h"
 #include "runtime.h"
 
 #include <functional>
+#include <memory_resource>
 #include <optional>
 #include <exception>
 #include <deque>
 namespace ast {
 
+namespace flat {
+class Lowering;
+}  // namespace flat
+
+}  // namespace ast
+
+namespace cache {
+class Writer;
+}  // namespace cache
+
+namespace ast {
+
 struct ReturnException : public std::exception {
    ReturnException(runtime::ObjectHolder obj)
        :obj_(obj) {
@@ -20,10 +34,15 @@ struct ReturnException : public std::exception {
 
 using Statement = runtime::Executable;
 
+// Массив дочерних узлов. Память под него берётся из арены, в которой создаётся узел
+using StatementList = std::pmr::vector<std::unique_ptr<Statement>>;
+
 // Выражение, возвращающее значение типа T,
 // используется как основа для создания констант
 template <typename T>
 class ValueStatement : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
     explicit ValueStatement(T v)
         : value_(v) {
@@ -48,38 +67,48 @@ using BoolConst = ValueStatement<runtime::Bool>;
 x = circle.center.x
 */
 class VariableValue : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
     explicit VariableValue(const std::string& var_name);
     explicit VariableValue(std::vector<std::string> dotted_ids);
+    explicit VariableValue(std::vector<intern::Symbol> dotted_ids);
 
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
 
 private:
-    std::optional<const std::string> var_name_;
-    std::optional<std::vector<std::string>> dotted_ids_;
+    std::pmr::vector<intern::Symbol> dotted_ids_;
+    // кеши обращений к полям цепочки, по одному на каждое имя
+    std::pmr::vector<runtime::FieldCache> field_caches_;
 };
 
 // Присваивает переменной, имя которой задано в параметре var, значение выражения rv
 class Assignment : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
-    Assignment(std::string var, std::unique_ptr<Statement> rv);
+    Assignment(intern::Symbol var, std::unique_ptr<Statement> rv);
 
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
 private:
-    std::string var_;
+    intern::Symbol var_;
     std::unique_ptr<Statement> rv_;
 };
 
 // Присваивает полю object.field_name значение выражения rv
 class FieldAssignment : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
-    FieldAssignment(VariableValue object, std::string field_name, std::unique_ptr<Statement> rv);
+    FieldAssignment(VariableValue object, intern::Symbol field_name,
+                    std::unique_ptr<Statement> rv);
 
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
 private:
     VariableValue object_;
-    std::string field_name_;
+    intern::Symbol field_name_;
     std::unique_ptr<Statement> rv_;
+    runtime::FieldCache cache_;
 };
 
 // Значение None
@@ -93,6 +122,8 @@ public:
 
 // Команда print
 class Print : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
     // Инициализирует команду print для вывода значения выражения argument
     explicit Print(std::unique_ptr<Statement> argument);
@@ -108,20 +139,29 @@ public:
 
 private:
     std::optional<std::unique_ptr<Statement>> argument_;
-    std::optional<std::vector<std::unique_ptr<Statement>>> args_;
+    std::optional<StatementList> args_;
 };
 
 // Вызывает метод object.method со списком параметров args
 class MethodCall : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
-    MethodCall(std::unique_ptr<Statement> object, std::string method,
+    MethodCall(std::unique_ptr<Statement> object, intern::Symbol method,
                std::vector<std::unique_ptr<Statement>> args);
 
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+    // Вычисляет объект и аргументы вызова (в пустой массив args) и находит метод,
+    // но не вызывает его. Возвращает nullptr, если объект - не экземпляр класса
+    const runtime::Method* Prepare(runtime::Closure& closure, runtime::Context& context,
+                                   runtime::ObjectHolder& object,
+                                   std::vector<runtime::ObjectHolder>& args);
 private:
     std::unique_ptr<Statement> object_;
-    std::string method_;
-    std::vector<std::unique_ptr<Statement>> args_;
+    intern::Symbol method_;
+    StatementList args_;
+    runtime::MethodCache cache_;
 };
 
 /*
@@ -138,6 +178,8 @@ p = Person()
 p.set_name("Ivan")
 */
 class NewInstance : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
     explicit NewInstance(const runtime::Class& class_);
     NewInstance(const runtime::Class& class_, std::vector<std::unique_ptr<Statement>> args);
@@ -146,13 +188,16 @@ public:
 private:
     const runtime::Class* cls_;
     //runtime::ClassInstance cl_i_;
-    std::optional<std::vector<std::unique_ptr<Statement>>> args_;
+    std::optional<StatementList> args_;
+    runtime::MethodCache init_cache_;
 };
 
 // Базовый класс для унарных операций
 class UnaryOperation : public Statement {
     friend class Stringify;
     friend class Not;
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
     explicit UnaryOperation(std::unique_ptr<Statement> argument)
         : argument_(std::move(argument))
@@ -263,10 +308,13 @@ public:
 
 // Составная инструкция (например: тело метода, содержимое ветки if, либо else)
 class Compound : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
     // Конструирует Compound из нескольких инструкций типа unique_ptr<Statement>
     template <typename... Args>
-    explicit Compound(Args&&... args) {
+    explicit Compound(Args&&... args)
+        : stmts_(runtime::ArenaScope::CurrentResource()) {
         ((AddStatement(std::move(args))), ...);
     }
 
@@ -278,38 +326,57 @@ public:
     // Последовательно выполняет добавленные инструкции. Возвращает None
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
 private:
-    std::deque<std::unique_ptr<Statement>> stmts_;
+    StatementList stmts_;
 };
 
 // Тело метода. Как правило, содержит составную инструкцию
 class MethodBody : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
     explicit MethodBody(std::unique_ptr<Statement>&& body);
 
     // Вычисляет инструкцию, переданную в качестве body.
     // Если внутри body была выполнена инструкция return, возвращает результат return
     // В противном случае возвращает None
+    // Вызов из return obj.m(args) выполняется после выхода из body в этом же кадре стека,
+    // поэтому хвостовая рекурсия любой глубины не растит стек
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
 private:
+    [[gnu::always_inline]] runtime::ObjectHolder ExecuteBody(runtime::Closure& closure,
+                                                             runtime::Context& context);
+    // Выполняет отложенные хвостовые вызовы и возвращает результат последнего
+    [[gnu::noinline]] static runtime::ObjectHolder ExecuteTailCalls(runtime::Context& context);
+
     std::unique_ptr<Statement> body_;
 };
 
 // Выполняет инструкцию return с выражением statement
 class Return : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
     explicit Return(std::unique_ptr<Statement> statement)
-        :statement_(std::move(statement)){
+        :statement_(std::move(statement))
+        ,tail_call_(dynamic_cast<MethodCall*>(statement_.get())){
     }
 
     // Останавливает выполнение текущего метода. После выполнения инструкции return метод,
     // внутри которого она была исполнена, должен вернуть результат вычисления выражения statement.
+    // Вызов метода в теле метода не выполняется здесь, а передаётся охватывающему MethodBody
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
 private:
+    [[gnu::noinline]] void PrepareTailCall(runtime::Closure& closure, runtime::Context& context);
+
     std::unique_ptr<Statement> statement_;
+    // statement_, если это вызов метода
+    MethodCall* tail_call_;
 };
 
 // Объявляет класс
 class ClassDefinition : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
     // Гарантируется, что ObjectHolder содержит объект типа runtime::Class
     explicit ClassDefinition(runtime::ObjectHolder cls);
@@ -323,6 +390,8 @@ private:
 
 // Инструкция if <condition> <if_body> else <else_body>
 class IfElse : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
     // Параметр else_body может быть равен nullptr
     IfElse(std::unique_ptr<Statement> condition, std::unique_ptr<Statement> if_body,
@@ -337,6 +406,8 @@ private:
 
 // Операция сравнения
 class Comparison : public BinaryOperation {
+    friend class flat::Lowering;
+    friend class cache::Writer;
 public:
     // Comparator задаёт функцию, выполняющую сравнение значений аргументов
     using Comparator = std::function<bool(const runtime::ObjectHolder&,
@@ -344,11 +415,82 @@ public:
 
     Comparison(Comparator cmp, std::unique_ptr<Statement> lhs, std::unique_ptr<Statement> rhs);
 
+    // Создаёт узел, специализированный под операцию op
+    static std::unique_ptr<Comparison> Create(runtime::CompareOp op, std::unique_ptr<Statement> lhs,
+                                              std::unique_ptr<Statement> rhs);
+
     // Вычисляет значение выражений lhs и rhs и возвращает результат работы comparator,
     // приведённый к типу runtime::Bool
     runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+protected:
+    Comparison(runtime::CompareOp op, std::unique_ptr<Statement> lhs,
+               std::unique_ptr<Statement> rhs);
+
 private:
     Comparator cmp_;
+    // Операция узла, созданного через Create. У узла с произвольным comparator её нет
+    std::optional<runtime::CompareOp> op_;
+};
+
+// Сравнение операцией op: числа, строки и логические значения сравниваются без вызова comparator
+template <runtime::CompareOp op>
+class ComparisonOf final : public Comparison {
+public:
+    ComparisonOf(std::unique_ptr<Statement> lhs, std::unique_ptr<Statement> rhs)
+        : Comparison(op, std::move(lhs), std::move(rhs)) {
+    }
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override {
+        runtime::ObjectHolder lhs = lhs_->Execute(closure, context);
+        runtime::ObjectHolder rhs = rhs_->Execute(closure, context);
+        return runtime::ObjectHolder::Own(
+            runtime::Bool(runtime::CompareValues<op>(lhs, rhs, context)));
+    }
+};
+
+// Корень программы. Владеет деревом инструкций и аренами, в которых размещены его узлы
+class Program : public Statement {
+    friend class flat::Lowering;
+    friend class cache::Writer;
+public:
+    Program(std::vector<std::shared_ptr<runtime::NodeArena>> arenas,
+            std::unique_ptr<Statement> body);
+
+    // Выполняет тело программы
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+private:
+    // арены освобождаются после узлов, которые в них размещены
+    std::vector<std::shared_ptr<runtime::NodeArena>> arenas_;
+    std::unique_ptr<Statement> body_;
 };
 
+/*
+ * Операции над уже вычисленными значениями аргументов.
+ * Их используют все способы исполнения программы, поэтому семантика и тексты ошибок
+ * у них совпадают
+ */
+
+// Сложение чисел, строк либо вызов lhs.__add__(rhs)
+runtime::ObjectHolder AddValues(const runtime::ObjectHolder& lhs,
+                                const runtime::ObjectHolder& rhs, runtime::Context& context);
+runtime::ObjectHolder SubValues(const runtime::ObjectHolder& lhs,
+                                const runtime::ObjectHolder& rhs);
+runtime::ObjectHolder MultValues(const runtime::ObjectHolder& lhs,
+                                 const runtime::ObjectHolder& rhs);
+runtime::ObjectHolder DivValues(const runtime::ObjectHolder& lhs,
+                                const runtime::ObjectHolder& rhs);
+// Строковое представление значения, как у str(value)
+runtime::ObjectHolder StringifyValue(const runtime::ObjectHolder& value);
+// Выводит значение в поток вывода контекста, None выводится как "None"
+void PrintValue(const runtime::ObjectHolder& value, runtime::Context& context);
+// Значение цепочки полей object.ids[0]...ids[count - 1].
+// caches, если задан, - кеши обращений к полям, caches[i] соответствует ids[i]
+runtime::ObjectHolder LookupFields(runtime::ObjectHolder object, const intern::Symbol* ids,
+                                   size_t count, runtime::FieldCache* caches = nullptr);
+// Значение переменной ids[0] либо цепочки полей ids[0].ids[1]...ids[count - 1].
+// caches, если задан, соответствует ids так же, как в LookupFields
+runtime::ObjectHolder LookupVariable(runtime::Closure& closure, const intern::Symbol* ids,
+                                     size_t count, runtime::FieldCache* caches = nullptr);
+
 }  // namespace ast
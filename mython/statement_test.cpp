@@ -1,5 +1,7 @@
-﻿#include "statement.h"
+﻿#include "flat_ast.h"
+#include "statement.h"
 #include "test_runner_p.h"
+#include "vm.h"
 
 using namespace std;
 
@@ -22,6 +24,42 @@ void AssertObjectValueEqual(const ObjectHolder& obj, const T& expected, const st
     AssertEqual(one.str(), two.str(), msg);
 }
 
+// Способ выполнения узлов в текущем прогоне тестов
+enum class Mode {
+    TREE,
+    FLAT,
+    VM,
+};
+
+// Тесты прогоняются на дереве, на его плоском представлении и на байт-коде
+Mode mode = Mode::TREE;
+
+// Выполняет узел способом, выбранным для текущего прогона тестов
+ObjectHolder Run(Statement& statement, Closure& closure, runtime::Context& context) {
+    switch (mode) {
+        case Mode::FLAT:
+            return flat::Flatten(statement)->Execute(closure, context);
+        case Mode::VM:
+            return vm::Compile(statement)->Execute(closure, context);
+        case Mode::TREE:
+            break;
+    }
+    return statement.Execute(closure, context);
+}
+
+ObjectHolder Run(Statement&& statement, Closure& closure, runtime::Context& context) {
+    return Run(statement, closure, context);
+}
+
+// Подготавливает методы класса к выполнению способом текущего прогона
+void Prepare(runtime::Class& cls) {
+    if (mode == Mode::FLAT) {
+        flat::FlattenMethods(cls);
+    } else if (mode == Mode::VM) {
+        vm::CompileMethods(cls);
+    }
+}
+
 #define ASSERT_OBJECT_VALUE_EQUAL(obj, expected)                                          \
     {                                                                                     \
         std::ostringstream __assert_equal_private_os;                                     \
@@ -37,7 +75,7 @@ void TestNumericConst() {
     NumericConst num(runtime::Number(57));
     Closure empty;
 
-    ObjectHolder o = num.Execute(empty, context);
+    ObjectHolder o = Run(num, empty, context);
     ASSERT(o);
     ASSERT(empty.empty());
 
@@ -54,7 +92,7 @@ void TestStringConst() {
     StringConst value_(runtime::String("Hello!"s));
     Closure empty;
 
-    ObjectHolder o = value_.Execute(empty, context);
+    ObjectHolder o = Run(value_, empty, context);
     ASSERT(o);
     ASSERT(empty.empty());
 
@@ -72,9 +110,9 @@ void TestVariable() {
     runtime::String word("Hello"s);
 
     Closure closure = {{"x"s, ObjectHolder::Share(num)}, {"w"s, ObjectHolder::Share(word)}};
-    ASSERT(VariableValue("x"s).Execute(closure, context).Get() == &num);
-    ASSERT(VariableValue("w"s).Execute(closure, context).Get() == &word);
-    ASSERT_THROWS(VariableValue("unknown"s).Execute(closure, context), std::runtime_error);
+    ASSERT(Run(VariableValue("x"s), closure, context).Get() == &num);
+    ASSERT(Run(VariableValue("w"s), closure, context).Get() == &word);
+    ASSERT_THROWS(Run(VariableValue("unknown"s), closure, context), std::runtime_error);
 
     ASSERT(context.output.str().empty());
 }
@@ -88,7 +126,7 @@ void TestAssignment() {
     Closure closure = {{"y"s, ObjectHolder::Own(runtime::Number(42))}};
 
     {
-        ObjectHolder o = assign_x.Execute(closure, context);
+        ObjectHolder o = Run(assign_x, closure, context);
         ASSERT(o);
         ASSERT_OBJECT_VALUE_EQUAL(o, 57);
     }
@@ -96,7 +134,7 @@ void TestAssignment() {
     ASSERT_OBJECT_VALUE_EQUAL(closure.at("x"s), 57);
 
     {
-        ObjectHolder o = assign_y.Execute(closure, context);
+        ObjectHolder o = Run(assign_y, closure, context);
         ASSERT(o);
         ASSERT_OBJECT_VALUE_EQUAL(o, "Hello"s);
     }
@@ -119,19 +157,19 @@ void TestFieldAssignment() {
     Closure closure = {{"self"s, ObjectHolder::Share(object)}};
 
     {
-        ObjectHolder o = assign_x.Execute(closure, context);
+        ObjectHolder o = Run(assign_x, closure, context);
         ASSERT(o);
         ASSERT_OBJECT_VALUE_EQUAL(o, 57);
     }
     ASSERT(object.Fields().find("x"s) != object.Fields().end());
     ASSERT_OBJECT_VALUE_EQUAL(object.Fields().at("x"s), 57);
 
-    assign_y.Execute(closure, context);
+    Run(assign_y, closure, context);
     FieldAssignment assign_yz(
         VariableValue{vector<string>{"self"s, "y"s}}, "z"s,
         make_unique<StringConst>(runtime::String("Hello, world! Hooray! Yes-yes!!!"s)));
     {
-        ObjectHolder o = assign_yz.Execute(closure, context);
+        ObjectHolder o = Run(assign_yz, closure, context);
         ASSERT(o);
         ASSERT_OBJECT_VALUE_EQUAL(o, "Hello, world! Hooray! Yes-yes!!!"s);
     }
@@ -150,7 +188,7 @@ void TestPrintVariable() {
     Closure closure = {{"y"s, ObjectHolder::Own(runtime::Number(42))}};
 
     auto print_statement = Print::Variable("y"s);
-    print_statement->Execute(closure, context);
+    Run(*print_statement, closure, context);
 
     ASSERT_EQUAL(context.output.str(), "42\n"s);
 }
@@ -167,7 +205,7 @@ void TestPrintMultipleStatements() {
     args.push_back(make_unique<StringConst>("Python"s));
     args.push_back(make_unique<VariableValue>("empty"s));
 
-    Print(std::move(args)).Execute(closure, context);
+    Run(Print(std::move(args)), closure, context);
 
     ASSERT_EQUAL(context.output.str(), "hello 57 Python None\n"s);
 }
@@ -178,12 +216,12 @@ void TestStringify() {
     Closure empty;
 
     {
-        auto result = Stringify(make_unique<NumericConst>(57)).Execute(empty, context);
+        auto result = Run(Stringify(make_unique<NumericConst>(57)), empty, context);
         ASSERT_OBJECT_VALUE_EQUAL(result, "57"s);
         ASSERT(result.TryAs<runtime::String>());
     }
     {
-        auto result = Stringify(make_unique<StringConst>("Wazzup!"s)).Execute(empty, context);
+        auto result = Run(Stringify(make_unique<StringConst>("Wazzup!"s)), empty, context);
         ASSERT_OBJECT_VALUE_EQUAL(result, "Wazzup!"s);
         ASSERT(result.TryAs<runtime::String>());
     }
@@ -192,8 +230,9 @@ void TestStringify() {
         methods.push_back({STR_METHOD, {}, make_unique<NumericConst>(842)});
 
         runtime::Class cls("BoxedValue"s, std::move(methods), nullptr);
+        Prepare(cls);
 
-        auto result = Stringify(make_unique<NewInstance>(cls)).Execute(empty, context);
+        auto result = Run(Stringify(make_unique<NewInstance>(cls)), empty, context);
         ASSERT_OBJECT_VALUE_EQUAL(result, "842"s);
         ASSERT(result.TryAs<runtime::String>());
     }
@@ -205,11 +244,11 @@ void TestStringify() {
         expected_output << closure.at("x"s).Get();
 
         Stringify str(make_unique<VariableValue>("x"s));
-        ASSERT_OBJECT_VALUE_EQUAL(str.Execute(closure, context), expected_output.str());
+        ASSERT_OBJECT_VALUE_EQUAL(Run(str, closure, context), expected_output.str());
     }
     {
         Stringify str(make_unique<None>());
-        ASSERT_OBJECT_VALUE_EQUAL(str.Execute(empty, context), "None"s);
+        ASSERT_OBJECT_VALUE_EQUAL(Run(str, empty, context), "None"s);
     }
 
     ASSERT(context.output.str().empty());
@@ -221,7 +260,7 @@ void TestNumbersAddition() {
     Add sum(make_unique<NumericConst>(23), make_unique<NumericConst>(34));
 
     Closure empty;
-    ASSERT_OBJECT_VALUE_EQUAL(sum.Execute(empty, context), 57);
+    ASSERT_OBJECT_VALUE_EQUAL(Run(sum, empty, context), 57);
 
     ASSERT(context.output.str().empty());
 }
@@ -232,7 +271,7 @@ void TestStringsAddition() {
     Add sum(make_unique<StringConst>("23"s), make_unique<StringConst>("34"s));
 
     Closure empty;
-    ASSERT_OBJECT_VALUE_EQUAL(sum.Execute(empty, context), "2334"s);
+    ASSERT_OBJECT_VALUE_EQUAL(Run(sum, empty, context), "2334"s);
 
     ASSERT(context.output.str().empty());
 }
@@ -243,14 +282,14 @@ void TestBadAddition() {
     Closure empty;
 
     ASSERT_THROWS(
-        Add(make_unique<NumericConst>(42), make_unique<StringConst>("4"s)).Execute(empty, context),
+        Run(Add(make_unique<NumericConst>(42), make_unique<StringConst>("4"s)), empty, context),
         std::runtime_error);
     ASSERT_THROWS(
-        Add(make_unique<StringConst>("4"s), make_unique<NumericConst>(42)).Execute(empty, context),
+        Run(Add(make_unique<StringConst>("4"s), make_unique<NumericConst>(42)), empty, context),
         std::runtime_error);
-    ASSERT_THROWS(Add(make_unique<None>(), make_unique<StringConst>("4"s)).Execute(empty, context),
+    ASSERT_THROWS(Run(Add(make_unique<None>(), make_unique<StringConst>("4"s)), empty, context),
                   std::runtime_error);
-    ASSERT_THROWS(Add(make_unique<None>(), make_unique<None>()).Execute(empty, context),
+    ASSERT_THROWS(Run(Add(make_unique<None>(), make_unique<None>()), empty, context),
                   std::runtime_error);
 
     ASSERT(context.output.str().empty());
@@ -266,10 +305,10 @@ void TestSuccessfulClassInstanceAdd() {
                                         make_unique<VariableValue>("value_"s))});
 
     runtime::Class cls("BoxedValue"s, std::move(methods), nullptr);
+    Prepare(cls);
 
     Closure empty;
-    auto result = Add(make_unique<NewInstance>(cls), make_unique<StringConst>("world"s))
-                      .Execute(empty, context);
+    auto result = Run(Add(make_unique<NewInstance>(cls), make_unique<StringConst>("world"s)), empty, context);
     ASSERT_OBJECT_VALUE_EQUAL(result, "hello, world"s);
 
     ASSERT(context.output.str().empty());
@@ -282,7 +321,7 @@ void TestClassInstanceAddWithoutMethod() {
 
     Closure empty;
     Add addition(make_unique<NewInstance>(cls), make_unique<StringConst>("world"s));
-    ASSERT_THROWS(addition.Execute(empty, context), std::runtime_error);
+    ASSERT_THROWS(Run(addition, empty, context), std::runtime_error);
 
     ASSERT(context.output.str().empty());
 }
@@ -297,7 +336,7 @@ void TestCompound() {
     };
 
     Closure closure;
-    auto result = cpd.Execute(closure, context);
+    auto result = Run(cpd, closure, context);
 
     ASSERT_OBJECT_VALUE_EQUAL(closure.at("x"s), "one"s);
     ASSERT_OBJECT_VALUE_EQUAL(closure.at("y"s), 2);
@@ -308,6 +347,42 @@ void TestCompound() {
     ASSERT(context.output.str().empty());
 }
 
+void TestReturn() {
+    runtime::DummyContext context;
+
+    // if x: (if x: return 'early'; y = 1); y = 2; return y
+    auto make_body = [] {
+        return MethodBody(make_unique<Compound>(
+            make_unique<IfElse>(
+                make_unique<VariableValue>("x"s),
+                make_unique<Compound>(
+                    make_unique<IfElse>(make_unique<VariableValue>("x"s),
+                                        make_unique<Return>(make_unique<StringConst>("early"s)),
+                                        nullptr),
+                    make_unique<Assignment>("y"s, make_unique<NumericConst>(1))),
+                nullptr),
+            make_unique<Assignment>("y"s, make_unique<NumericConst>(2)),
+            make_unique<Return>(make_unique<VariableValue>("y"s)),
+            make_unique<Assignment>("y"s, make_unique<NumericConst>(3))));
+    };
+
+    // Константы отдают значения, которыми владеют узлы, поэтому тела живут до проверок
+    auto early_body = make_body();
+    Closure early{{"x"s, ObjectHolder::Own(runtime::Bool(true))}};
+    ASSERT_OBJECT_VALUE_EQUAL(Run(early_body, early, context), "early"s);
+    ASSERT(early.count("y"s) == 0);
+
+    auto late_body = make_body();
+    Closure late{{"x"s, ObjectHolder::Own(runtime::Bool(false))}};
+    ASSERT_OBJECT_VALUE_EQUAL(Run(late_body, late, context), 2);
+    ASSERT_OBJECT_VALUE_EQUAL(late.at("y"s), 2);
+
+    Closure closure;
+    ASSERT(!Run(MethodBody(make_unique<Compound>()), closure, context));
+    // Вне тела метода return выбрасывает исключение
+    ASSERT_THROWS(Run(Return(make_unique<NumericConst>(1)), closure, context), ReturnException);
+}
+
 void TestFields() {
     runtime::DummyContext context;
 
@@ -328,6 +403,7 @@ void TestFields() {
                               make_unique<VariableValue>("x"s)))}});
 
     runtime::Class cls("BoxedValue"s, std::move(methods), nullptr);
+    Prepare(cls);
     runtime::ClassInstance inst(cls);
 
     inst.Call("__init__"s, {}, context);
@@ -412,7 +488,7 @@ void TestOr() {
         Or or_statement{make_unique<BoolConst>(lhs), make_unique<BoolConst>(rhs)};
         Closure closure;
         runtime::DummyContext context;
-        ASSERT_EQUAL(runtime::Equal(or_statement.Execute(closure, context),
+        ASSERT_EQUAL(runtime::Equal(Run(or_statement, closure, context),
                                     ObjectHolder::Own(runtime::Bool(true)), context),
                      lhs || rhs);
     };
@@ -428,7 +504,7 @@ void TestAnd() {
         And and_statement{make_unique<BoolConst>(lhs), make_unique<BoolConst>(rhs)};
         Closure closure;
         runtime::DummyContext context;
-        ASSERT_EQUAL(runtime::Equal(and_statement.Execute(closure, context),
+        ASSERT_EQUAL(runtime::Equal(Run(and_statement, closure, context),
                                     ObjectHolder::Own(runtime::Bool(true)), context),
                      lhs && rhs);
     };
@@ -444,7 +520,7 @@ void TestNot() {
         Not not_statement{make_unique<BoolConst>(arg)};
         Closure closure;
         runtime::DummyContext context;
-        ASSERT_EQUAL(runtime::Equal(not_statement.Execute(closure, context),
+        ASSERT_EQUAL(runtime::Equal(Run(not_statement, closure, context),
                                     ObjectHolder::Own(runtime::Bool(true)), context),
                      !arg);
     };
@@ -490,9 +566,7 @@ struct TestMethodBody : runtime::Executable {
 
 //}
 
-}  // namespace
-
-void RunUnitTests(TestRunner& tr) {
+void RunStatementTests(TestRunner& tr) {
     RUN_TEST(tr, ast::TestNumericConst);
     RUN_TEST(tr, ast::TestStringConst);
     RUN_TEST(tr, ast::TestVariable);
@@ -507,6 +581,7 @@ void RunUnitTests(TestRunner& tr) {
     RUN_TEST(tr, ast::TestSuccessfulClassInstanceAdd);
     RUN_TEST(tr, ast::TestClassInstanceAddWithoutMethod);
     RUN_TEST(tr, ast::TestCompound);
+    RUN_TEST(tr, ast::TestReturn);
     RUN_TEST(tr, ast::TestFields);
     RUN_TEST(tr, ast::TestBaseClass);
     RUN_TEST(tr, ast::TestInheritance);
@@ -516,4 +591,14 @@ void RunUnitTests(TestRunner& tr) {
     //RUN_TEST(tr, ast::MyTestNewInstance);
 }
 
+}  // namespace
+
+void RunUnitTests(TestRunner& tr) {
+    for (Mode run : {Mode::TREE, Mode::FLAT, Mode::VM}) {
+        mode = run;
+        RunStatementTests(tr);
+    }
+    mode = Mode::TREE;
+}
+
 }  // namespace ast
@@ -0,0 +1,82 @@
+﻿#include "symbol.h"
+
+#include <atomic>
+#include <ostream>
+
+using namespace std;
+
+namespace intern {
+
+namespace {
+
+atomic<uint64_t> next_table_serial{0};
+
+// Записи, найденные потоком в одной таблице. Строки-ключи принадлежат записям таблицы
+struct LocalCache {
+    uint64_t table_serial = ~uint64_t{0};
+    unordered_map<string_view, const SymbolData*> index;
+};
+
+}  // namespace
+
+SymbolTable::SymbolTable()
+    : serial_(next_table_serial++) {
+    empty_ = InternLocked(""sv);
+}
+
+const SymbolData* SymbolTable::Intern(std::string_view name) {
+    thread_local LocalCache cache;
+    if (cache.table_serial != serial_) {
+        cache.index.clear();
+        cache.table_serial = serial_;
+    }
+    if (auto it = cache.index.find(name); it != cache.index.end()) {
+        return it->second;
+    }
+    const SymbolData* data = InternLocked(name);
+    cache.index.emplace(data->name, data);
+    return data;
+}
+
+const SymbolData* SymbolTable::InternLocked(std::string_view name) {
+    lock_guard guard(mutex_);
+    if (auto it = index_.find(name); it != index_.end()) {
+        return it->second;
+    }
+    const SymbolData& data = symbols_.emplace_back(SymbolData{
+        string(name), hash<string_view>{}(name), static_cast<uint32_t>(symbols_.size())});
+    index_.emplace(data.name, &data);
+    return &data;
+}
+
+size_t SymbolTable::Size() const {
+    lock_guard guard(mutex_);
+    return symbols_.size();
+}
+
+SymbolTable& SymbolTable::Global() {
+    static SymbolTable table;
+    return table;
+}
+
+Symbol::Symbol()
+    : data_(SymbolTable::Global().Empty()) {
+}
+
+Symbol::Symbol(std::string_view name)
+    : data_(SymbolTable::Global().Intern(name)) {
+}
+
+Symbol::Symbol(const std::string& name)
+    : Symbol(string_view{name}) {
+}
+
+Symbol::Symbol(const char* name)
+    : Symbol(string_view{name}) {
+}
+
+std::ostream& operator<<(std::ostream& os, Symbol symbol) {
+    return os << symbol.Name();
+}
+
+}  // namespace intern
@@ -0,0 +1,136 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+
+namespace intern {
+
+// Запись таблицы символов. Хранится в единственном экземпляре и не перемещается в памяти
+struct SymbolData {
+    std::string name;  // имя символа
+    size_t hash;       // заранее вычисленный хеш имени
+    uint32_t id;       // порядковый номер символа в таблице
+};
+
+/*
+ * Таблица символов: сопоставляет каждой строке единственную запись SymbolData.
+ * Записи не удаляются до конца жизни таблицы, поэтому в неё попадают только имена:
+ * идентификаторы, поля и методы. Строковые константы программ лексер не интернирует,
+ * и таблица растёт не больше, чем суммарный размер различных имён загруженных программ
+ */
+class SymbolTable {
+public:
+    SymbolTable();
+
+    SymbolTable(const SymbolTable&) = delete;
+    SymbolTable& operator=(const SymbolTable&) = delete;
+
+    // Возвращает запись для строки name, добавляя её в таблицу при первом обращении.
+    // Метод потокобезопасен. Записи, уже найденные потоком, он берёт из кеша потока
+    // без блокировки, поэтому лексеры на нескольких потоках не ждут друг друга
+    const SymbolData* Intern(std::string_view name);
+
+    // Запись пустой строки, добавленная при создании таблицы
+    [[nodiscard]] const SymbolData* Empty() const {
+        return empty_;
+    }
+
+    // Возвращает количество символов в таблице
+    [[nodiscard]] size_t Size() const;
+
+    // Таблица, общая для всех программ процесса
+    static SymbolTable& Global();
+
+private:
+    const SymbolData* InternLocked(std::string_view name);
+
+    mutable std::mutex mutex_;
+    std::deque<SymbolData> symbols_;
+    std::unordered_map<std::string_view, const SymbolData*> index_;
+    // Номер таблицы, по которому кеш потока отличает её от других, в том числе
+    // от уничтоженной таблицы по тому же адресу
+    const uint64_t serial_;
+    const SymbolData* empty_ = nullptr;
+};
+
+/*
+ * Интернированное имя.
+ * Занимает один указатель, копируется без выделения памяти,
+ * а символы сравниваются между собой по адресу записи в таблице
+ */
+class Symbol {
+public:
+    // Создаёт пустой символ ""
+    Symbol();
+
+    Symbol(std::string_view name);  // NOLINT(google-explicit-constructor)
+    Symbol(const std::string& name);  // NOLINT(google-explicit-constructor)
+    Symbol(const char* name);  // NOLINT(google-explicit-constructor)
+
+    [[nodiscard]] const std::string& Name() const {
+        return data_->name;
+    }
+
+    [[nodiscard]] size_t Hash() const {
+        return data_->hash;
+    }
+
+    [[nodiscard]] uint32_t Id() const {
+        return data_->id;
+    }
+
+    friend bool operator==(Symbol lhs, Symbol rhs) {
+        return lhs.data_ == rhs.data_;
+    }
+
+    friend bool operator!=(Symbol lhs, Symbol rhs) {
+        return lhs.data_ != rhs.data_;
+    }
+
+private:
+    const SymbolData* data_;
+};
+
+// Сравнение символа со строкой любого вида, приводимой к std::string_view
+template <typename S>
+using EnableIfString = std::enable_if_t<std::is_convertible_v<const S&, std::string_view>, bool>;
+
+template <typename S, EnableIfString<S> = true>
+bool operator==(Symbol lhs, const S& rhs) {
+    return std::string_view(lhs.Name()) == std::string_view(rhs);
+}
+
+template <typename S, EnableIfString<S> = true>
+bool operator==(const S& lhs, Symbol rhs) {
+    return rhs == lhs;
+}
+
+template <typename S, EnableIfString<S> = true>
+bool operator!=(Symbol lhs, const S& rhs) {
+    return !(lhs == rhs);
+}
+
+template <typename S, EnableIfString<S> = true>
+bool operator!=(const S& lhs, Symbol rhs) {
+    return !(rhs == lhs);
+}
+
+std::ostream& operator<<(std::ostream& os, Symbol symbol);
+
+}  // namespace intern
+
+namespace std {
+template <>
+struct hash<intern::Symbol> {
+    size_t operator()(intern::Symbol symbol) const {
+        return symbol.Hash();
+    }
+};
+}  // namespace std
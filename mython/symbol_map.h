@@ -0,0 +1,174 @@
+﻿#pragma once
+
+#include "symbol.h"
+
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace intern {
+
+/*
+ * Ассоциативный массив с ключами-символами. Элементы лежат подряд в порядке добавления,
+ * а индекс с открытой адресацией хранит для каждого занятого слота символ и номер элемента.
+ * Хеш символа вычислен заранее, а символы сравниваются по адресу записи в таблице символов,
+ * поэтому при поиске строки не хешируются и не сравниваются.
+ * Пока элементов не больше LINEAR_LIMIT, индекс не строится и элементы просматриваются подряд.
+ * Добавление элемента, как и у std::vector, делает недействительными ссылки и итераторы.
+ * clear() сохраняет выделенную память
+ */
+template <typename Value>
+class SymbolMap {
+public:
+    using value_type = std::pair<Symbol, Value>;
+    using iterator = value_type*;
+    using const_iterator = const value_type*;
+
+    // Наибольшее число элементов, которые ищутся без индекса
+    static constexpr size_t LINEAR_LIMIT = 8;
+
+    SymbolMap() = default;
+
+    SymbolMap(std::initializer_list<value_type> items) {
+        for (const value_type& item : items) {
+            insert(item);
+        }
+    }
+
+    // Значение ключа key. Отсутствующий ключ добавляется со значением по умолчанию
+    Value& operator[](Symbol key) {
+        if (const uint32_t index = Find(key); index != NOT_FOUND) {
+            return entries_[index].second;
+        }
+        return Append(key, Value{}).second;
+    }
+
+    // Значение ключа key. Если ключа нет, выбрасывает std::out_of_range
+    Value& at(Symbol key) {
+        return const_cast<Value&>(std::as_const(*this).at(key));
+    }
+
+    const Value& at(Symbol key) const {
+        const uint32_t index = Find(key);
+        if (index == NOT_FOUND) {
+            throw std::out_of_range("No key " + key.Name());
+        }
+        return entries_[index].second;
+    }
+
+    // Итератор на элемент с ключом key либо end()
+    [[nodiscard]] iterator find(Symbol key) {
+        const uint32_t index = Find(key);
+        return index != NOT_FOUND ? entries_.data() + index : end();
+    }
+
+    [[nodiscard]] const_iterator find(Symbol key) const {
+        const uint32_t index = Find(key);
+        return index != NOT_FOUND ? entries_.data() + index : end();
+    }
+
+    [[nodiscard]] size_t count(Symbol key) const {
+        return Find(key) != NOT_FOUND ? 1 : 0;
+    }
+
+    // Добавляет элемент, если ключа ещё нет. Возвращает итератор на элемент с этим ключом
+    // и признак добавления
+    std::pair<iterator, bool> insert(value_type item) {
+        if (const uint32_t index = Find(item.first); index != NOT_FOUND) {
+            return {entries_.data() + index, false};
+        }
+        return {&Append(item.first, std::move(item.second)), true};
+    }
+
+    [[nodiscard]] iterator begin() {
+        return entries_.data();
+    }
+    [[nodiscard]] iterator end() {
+        return entries_.data() + entries_.size();
+    }
+    [[nodiscard]] const_iterator begin() const {
+        return entries_.data();
+    }
+    [[nodiscard]] const_iterator end() const {
+        return entries_.data() + entries_.size();
+    }
+
+    [[nodiscard]] size_t size() const {
+        return entries_.size();
+    }
+
+    [[nodiscard]] bool empty() const {
+        return entries_.empty();
+    }
+
+    void clear() {
+        entries_.clear();
+        slots_.clear();
+    }
+
+private:
+    static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+    // Слот индекса. Свободный слот имеет номер NOT_FOUND
+    struct Slot {
+        Symbol key;
+        uint32_t index = NOT_FOUND;
+    };
+
+    uint32_t Find(Symbol key) const {
+        if (slots_.empty()) {
+            for (size_t i = 0; i < entries_.size(); ++i) {
+                if (entries_[i].first == key) {
+                    return static_cast<uint32_t>(i);
+                }
+            }
+            return NOT_FOUND;
+        }
+        const size_t mask = slots_.size() - 1;
+        for (size_t i = key.Hash() & mask;; i = (i + 1) & mask) {
+            const Slot& slot = slots_[i];
+            if (slot.index == NOT_FOUND || slot.key == key) {
+                return slot.index;
+            }
+        }
+    }
+
+    value_type& Append(Symbol key, Value value) {
+        const auto index = static_cast<uint32_t>(entries_.size());
+        entries_.emplace_back(key, std::move(value));
+        if (!slots_.empty() && entries_.size() * 2 <= slots_.size()) {
+            Place(key, index);
+        } else if (entries_.size() > LINEAR_LIMIT) {
+            Rebuild();
+        }
+        return entries_.back();
+    }
+
+    // Строит индекс заново, оставляя занятой не больше половины слотов
+    void Rebuild() {
+        size_t capacity = LINEAR_LIMIT * 4;
+        while (capacity < entries_.size() * 2) {
+            capacity *= 2;
+        }
+        slots_.assign(capacity, Slot{});
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            Place(entries_[i].first, static_cast<uint32_t>(i));
+        }
+    }
+
+    void Place(Symbol key, uint32_t index) {
+        const size_t mask = slots_.size() - 1;
+        size_t i = key.Hash() & mask;
+        while (slots_[i].index != NOT_FOUND) {
+            i = (i + 1) & mask;
+        }
+        slots_[i] = Slot{key, index};
+    }
+
+    std::vector<value_type> entries_;
+    std::vector<Slot> slots_;
+};
+
+}  // namespace intern
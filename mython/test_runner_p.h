@@ -1,7 +1,12 @@
 ﻿#pragma once
 
+#include "lexer.h"
+#include "parse.h"
+#include "statement.h"
+
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
 #include <sstream>
 #include <stdexcept>
@@ -163,4 +168,31 @@ private:
         Assert(false, __assert_private_os.str());               \
     }
 
+// Разбирает текст программы на Mython
+inline std::unique_ptr<ast::Statement> ParseProgramFromString(const std::string& program) {
+    std::istringstream is(program);
+    parse::Lexer lexer(is);
+    return ParseProgram(lexer);
+}
+
+// Выполняет программу в пустом окружении и возвращает её вывод
+inline std::string RunProgram(ast::Statement& program) {
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    program.Execute(closure, context);
+    return context.output.str();
+}
+
+// Разбирает и выполняет программу. Если задан prepare, программа выполняется
+// в представлении, которое он строит из дерева (например, flat::Flatten или vm::Compile)
+inline std::string RunProgram(
+    const std::string& program,
+    std::unique_ptr<ast::Statement> (*prepare)(std::unique_ptr<ast::Statement>) = nullptr) {
+    auto tree = ParseProgramFromString(program);
+    if (prepare != nullptr) {
+        tree = prepare(std::move(tree));
+    }
+    return RunProgram(*tree);
+}
+
 #define EOF_GUARD
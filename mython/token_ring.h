@@ -0,0 +1,62 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace parse {
+
+/*
+ * Кольцевой буфер без блокировок для одного писателя и одного читателя.
+ * Писатель и читатель держат у себя копию чужого индекса и перечитывают
+ * разделяемый атомарный индекс, только когда буфер по этой копии кажется полным (пустым).
+ * Capacity должна быть степенью двойки
+ */
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+
+public:
+    // Вызывается только писателем. Возвращает false, если буфер заполнен
+    bool TryPush(T value) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ == Capacity) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ == Capacity) {
+                return false;
+            }
+        }
+        slots_[tail & MASK] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Вызывается только читателем. Возвращает false, если буфер пуст
+    bool TryPop(T& value) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+        value = std::move(slots_[head & MASK]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static constexpr size_t MASK = Capacity - 1;
+    // Индексы писателя и читателя лежат в разных кеш-линиях, чтобы потоки не мешали друг другу
+    static constexpr size_t CACHE_LINE = 64;
+
+    alignas(CACHE_LINE) std::atomic<size_t> head_ = 0;  // следующий слот для чтения
+    size_t tail_cache_ = 0;                              // копия tail_ у читателя
+    alignas(CACHE_LINE) std::atomic<size_t> tail_ = 0;  // следующий слот для записи
+    size_t head_cache_ = 0;                              // копия head_ у писателя
+    alignas(CACHE_LINE) std::array<T, Capacity> slots_;
+};
+
+}  // namespace parse
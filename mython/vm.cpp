@@ -0,0 +1,1385 @@
+﻿#include "vm.h"
+
+#include <atomic>
+#include <iostream>
+#include <unordered_map>
+
+// Переход по таблице адресов обработчиков (computed goto) - расширение GCC и Clang.
+// MYTHON_VM_SWITCH_DISPATCH принудительно включает переносимый вариант на switch
+#if defined(__GNUC__) && !defined(MYTHON_VM_SWITCH_DISPATCH)
+#define MYTHON_VM_COMPUTED_GOTO 1
+#endif
+
+using namespace std;
+
+namespace vm {
+
+using ast::flat::NodeKind;
+using ast::flat::NO_NODE;
+using runtime::Closure;
+using runtime::Context;
+using runtime::ObjectHolder;
+
+namespace {
+
+const intern::Symbol INIT_METHOD{"__init__"sv};
+const intern::Symbol SELF_NAME{"self"sv};
+
+// Регистр переменной метода, которой ещё не присвоено значение, указывает на этот объект
+runtime::Bool unbound_value{false};
+const ObjectHolder UNBOUND = ObjectHolder::Share(unbound_value);
+
+/*
+ * Компилирует одну функцию. Значение каждого выражения вычисляется в заданный регистр,
+ * временные значения занимают регистры выше него и освобождаются после выражения
+ */
+class FunctionCompiler {
+public:
+    explicit FunctionCompiler(Program& program)
+        : program_(program)
+        , pool_(*program.pool) {
+    }
+
+    // Компилирует узел root плоского кода как функцию и возвращает её номер.
+    // Переменные тела метода method по возможности размещаются в первых регистрах кадра
+    uint32_t Build(uint32_t root, const runtime::Method* method = nullptr) {
+        const auto index = static_cast<uint32_t>(program_.functions.size());
+        program_.functions.emplace_back();
+
+        const ast::flat::Node& node = pool_.nodes[root];
+        if (node.kind == NodeKind::METHOD_BODY && method != nullptr) {
+            ResolveLocals(node.a, *method);
+        }
+        next_register_ = register_count_ = static_cast<uint32_t>(function_.locals.size());
+
+        const uint32_t result = Alloc();
+        if (node.kind == NodeKind::METHOD_BODY) {
+            // Без инструкции return тело метода возвращает None
+            function_.method_body = true;
+            Compile(node.a, result);
+            Emit(Op::LOAD_NONE, result);
+        } else {
+            Compile(root, result);
+        }
+        Emit(Op::RETURN, result);
+
+        function_.register_count = register_count_;
+        program_.functions[index] = std::move(function_);
+        return index;
+    }
+
+private:
+    /*
+     * Сопоставляет переменным метода регистры: self - 0, параметры - следующие по порядку,
+     * остальным переменным - регистры в порядке первого упоминания. Переменные метода видны
+     * только в нём, поэтому все имена в теле - локальные. Тела с узлами, которые выполняются
+     * через дерево и работают с Closure, оставляют поиск по имени
+     */
+    void ResolveLocals(uint32_t body, const runtime::Method& method) {
+        AddLocal(SELF_NAME);
+        for (size_t i = 0; i < method.formal_params.size(); ++i) {
+            // Параметр с именем self или повторённое имя - это последний такой параметр
+            function_.locals.push_back(method.formal_params[i]);
+            locals_[method.formal_params[i].Id()] = static_cast<uint32_t>(i + 1);
+        }
+        if (!CollectLocals(body)) {
+            function_.locals.clear();
+            locals_.clear();
+        }
+    }
+
+    uint32_t AddLocal(intern::Symbol name) {
+        const auto [it, inserted]
+            = locals_.emplace(name.Id(), static_cast<uint32_t>(function_.locals.size()));
+        if (inserted) {
+            function_.locals.push_back(name);
+        }
+        return it->second;
+    }
+
+    bool CollectList(uint32_t list_offset) {
+        const uint32_t* list = &pool_.lists[list_offset];
+        for (uint32_t i = 1; i <= list[0]; ++i) {
+            if (!CollectLocals(list[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Заводит регистры для переменных поддерева. false, если в нём есть узлы,
+    // которым нужен Closure
+    bool CollectLocals(uint32_t index) {
+        const ast::flat::Node& node = pool_.nodes[index];
+        switch (node.kind) {
+            case NodeKind::CONST:
+            case NodeKind::NONE:
+                return true;
+            case NodeKind::VARIABLE:
+                AddLocal(pool_.symbols[node.a]);
+                return true;
+            case NodeKind::ASSIGNMENT:
+                AddLocal(pool_.symbols[node.a]);
+                return CollectLocals(node.b);
+            case NodeKind::FIELD_ASSIGNMENT:
+                return CollectLocals(node.a) && CollectLocals(node.c);
+            case NodeKind::PRINT_ONE:
+            case NodeKind::STRINGIFY:
+            case NodeKind::NOT:
+            case NodeKind::RETURN:
+                return CollectLocals(node.a);
+            case NodeKind::PRINT:
+            case NodeKind::COMPOUND:
+                return CollectList(node.a);
+            case NodeKind::METHOD_CALL:
+                return CollectLocals(node.a) && CollectList(node.c);
+            case NodeKind::NEW_INSTANCE:
+                return CollectList(node.b);
+            case NodeKind::ADD:
+            case NodeKind::SUB:
+            case NodeKind::MULT:
+            case NodeKind::DIV:
+            case NodeKind::OR:
+            case NodeKind::AND:
+            case NodeKind::COMPARISON:
+                return CollectLocals(node.a) && CollectLocals(node.b);
+            case NodeKind::IF_ELSE:
+                return CollectLocals(node.a) && CollectLocals(node.b)
+                       && (node.c == NO_NODE || CollectLocals(node.c));
+            case NodeKind::METHOD_BODY:
+            case NodeKind::OPAQUE:
+                return false;
+        }
+        return false;
+    }
+
+    uint32_t Alloc() {
+        const uint32_t reg = next_register_++;
+        register_count_ = max(register_count_, next_register_);
+        return reg;
+    }
+
+    uint32_t Emit(Op op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0) {
+        function_.code.push_back(Instr{op, a, b, c});
+        return static_cast<uint32_t>(function_.code.size() - 1);
+    }
+
+    uint32_t Here() const {
+        return static_cast<uint32_t>(function_.code.size());
+    }
+
+    // Компилирует узел так, чтобы его значение оказалось в регистре dst
+    void Compile(uint32_t index, uint32_t dst) {
+        const uint32_t mark = next_register_;
+        const ast::flat::Node& node = pool_.nodes[index];
+        switch (node.kind) {
+            case NodeKind::CONST:
+                Emit(Op::LOAD_CONST, dst, node.a);
+                break;
+            case NodeKind::NONE:
+                Emit(Op::LOAD_NONE, dst);
+                break;
+            case NodeKind::VARIABLE:
+                if (function_.locals.empty()) {
+                    Emit(Op::LOAD_VAR, dst, node.a, node.b);
+                    break;
+                }
+                Emit(Op::LOAD_LOCAL, dst, locals_.at(pool_.symbols[node.a].Id()));
+                if (node.b > 1) {
+                    Emit(Op::LOAD_FIELDS, dst, node.a + 1, node.b - 1);
+                }
+                break;
+            case NodeKind::ASSIGNMENT:
+                if (CompileLocalIncrement(node)) {
+                    Emit(Op::MOVE, dst, locals_.at(pool_.symbols[node.a].Id()));
+                    break;
+                }
+                Compile(node.b, dst);
+                if (function_.locals.empty()) {
+                    Emit(Op::STORE_VAR, node.a, dst);
+                } else {
+                    Emit(Op::MOVE, locals_.at(pool_.symbols[node.a].Id()), dst);
+                }
+                break;
+            case NodeKind::FIELD_ASSIGNMENT: {
+                // Значение вычисляется, только если слева экземпляр класса
+                const uint32_t object = Alloc();
+                Compile(node.a, object);
+                const uint32_t skip = Emit(Op::JUMP_IF_NOT_INSTANCE, object);
+                if (IsFieldIncrement(node)) {
+                    // v.f = v.f + operand: операнд проверяется после чтения поля, как в дереве
+                    const uint32_t operand = pool_.nodes[node.c].b;
+                    if (pool_.nodes[operand].kind == NodeKind::CONST) {
+                        Emit(Op::LOAD_CONST, dst, pool_.nodes[operand].a);
+                    } else {
+                        Emit(Op::MOVE, dst, LocalRegister(operand));
+                    }
+                    Emit(Op::ADD_TO_FIELD, object, node.b, dst);
+                } else {
+                    Compile(node.c, dst);
+                    Emit(Op::STORE_FIELD, object, node.b, dst);
+                }
+                const uint32_t done = Emit(Op::JUMP);
+                function_.code[skip].b = Here();
+                Emit(Op::LOAD_NONE, dst);
+                function_.code[done].a = Here();
+                break;
+            }
+            case NodeKind::PRINT_ONE:
+                // Как и Print(argument), выражение вычисляется повторно для результата
+                Compile(node.a, dst);
+                Emit(Op::PRINT, dst, 0);
+                Emit(Op::NEWLINE);
+                Compile(node.a, dst);
+                break;
+            case NodeKind::PRINT: {
+                const uint32_t* list = &pool_.lists[node.a];
+                for (uint32_t i = 1; i <= list[0]; ++i) {
+                    Compile(list[i], dst);
+                    Emit(Op::PRINT, dst, i > 1 ? 1 : 0);
+                }
+                Emit(Op::NEWLINE);
+                Emit(Op::LOAD_NONE, dst);
+                break;
+            }
+            case NodeKind::METHOD_CALL:
+                CompileMethodCall(node, dst, Op::CALL_METHOD);
+                break;
+            case NodeKind::NEW_INSTANCE: {
+                // Аргументы вычисляются, только если есть подходящий __init__
+                Emit(Op::NEW_INSTANCE, dst, node.a);
+                const uint32_t arguments = Alloc();
+                const auto site = static_cast<uint32_t>(program_.call_sites.size());
+                program_.call_sites.push_back({INIT_METHOD, 0, pool_.lists[node.b]});
+                const uint32_t skip = Emit(Op::JUMP_IF_NO_METHOD, dst, site);
+                program_.call_sites[site].first_arg = CompileArgumentList(node.b);
+                Emit(Op::CALL_METHOD, arguments, dst, site);
+                function_.code[skip].c = Here();
+                break;
+            }
+            case NodeKind::STRINGIFY:
+                Compile(node.a, dst);
+                Emit(Op::STRINGIFY, dst, dst);
+                break;
+            case NodeKind::ADD:
+                CompileBinary(Op::ADD, node, dst);
+                break;
+            case NodeKind::SUB:
+                CompileBinary(Op::SUB, node, dst);
+                break;
+            case NodeKind::MULT:
+                CompileBinary(Op::MULT, node, dst);
+                break;
+            case NodeKind::DIV:
+                CompileBinary(Op::DIV, node, dst);
+                break;
+            case NodeKind::COMPARISON: {
+                Compile(node.a, dst);
+                const uint32_t rhs = Alloc();
+                Compile(node.b, rhs);
+                Emit(Op::COMPARE, dst, rhs, node.c);
+                break;
+            }
+            case NodeKind::OR:
+            case NodeKind::AND: {
+                // Если значения lhs достаточно для ответа, rhs не вычисляется
+                Compile(node.a, dst);
+                const uint32_t skip = Emit(
+                    node.kind == NodeKind::OR ? Op::JUMP_IF_TRUE : Op::JUMP_IF_FALSE, dst);
+                Compile(node.b, dst);
+                function_.code[skip].b = Here();
+                Emit(Op::TO_BOOL, dst, dst);
+                break;
+            }
+            case NodeKind::NOT:
+                Compile(node.a, dst);
+                Emit(Op::NOT, dst, dst);
+                break;
+            case NodeKind::COMPOUND: {
+                const uint32_t* list = &pool_.lists[node.a];
+                for (uint32_t i = 1; i <= list[0]; ++i) {
+                    // Значение инструкции блока не используется, копировать его в dst незачем
+                    const ast::flat::Node& statement = pool_.nodes[list[i]];
+                    if (statement.kind != NodeKind::ASSIGNMENT
+                        || !CompileLocalIncrement(statement)) {
+                        Compile(list[i], dst);
+                    }
+                }
+                Emit(Op::LOAD_NONE, dst);
+                break;
+            }
+            case NodeKind::METHOD_BODY: {
+                // Вложенное тело метода - отдельная функция со своим return
+                const uint32_t function = FunctionCompiler(program_).Build(index);
+                Emit(Op::CALL_FUNCTION, dst, function);
+                break;
+            }
+            case NodeKind::RETURN: {
+                const ast::flat::Node& value = pool_.nodes[node.a];
+                if (function_.method_body && value.kind == NodeKind::VARIABLE
+                    && !function_.locals.empty() && value.b > 1) {
+                    Emit(Op::RETURN_FIELDS, locals_.at(pool_.symbols[value.a].Id()), value.a + 1,
+                         value.b - 1);
+                    break;
+                }
+                if (function_.method_body && value.kind == NodeKind::METHOD_CALL
+                    && !function_.locals.empty()) {
+                    CompileMethodCall(value, dst, Op::TAIL_CALL);
+                    Emit(Op::RETURN, dst);
+                    break;
+                }
+                Compile(node.a, dst);
+                Emit(function_.method_body ? Op::RETURN : Op::THROW_RETURN, dst);
+                break;
+            }
+            case NodeKind::IF_ELSE: {
+                const uint32_t to_else = CompileJumpIfFalse(node.a, dst);
+                Compile(node.b, dst);
+                const uint32_t done = Emit(Op::JUMP);
+                SetJumpTarget(to_else, Here());
+                if (node.c != NO_NODE) {
+                    Compile(node.c, dst);
+                } else {
+                    Emit(Op::LOAD_NONE, dst);
+                }
+                function_.code[done].a = Here();
+                break;
+            }
+            case NodeKind::OPAQUE:
+                Emit(Op::OPAQUE, dst, node.a);
+                break;
+        }
+        next_register_ = mark;
+    }
+
+    // call - CALL_METHOD либо TAIL_CALL
+    void CompileMethodCall(const ast::flat::Node& node, uint32_t dst, Op call) {
+        // Аргументы вычисляются, только если объект - экземпляр класса
+        const uint32_t mark = next_register_;
+        const uint32_t object = Alloc();
+        Compile(node.a, object);
+        const uint32_t skip = Emit(Op::JUMP_IF_NOT_INSTANCE, object);
+        const uint32_t site = CompileArguments(pool_.method_sites[node.b].method, node.c);
+        Emit(call, dst, object, site);
+        const uint32_t done = Emit(Op::JUMP);
+        function_.code[skip].b = Here();
+        Emit(Op::LOAD_NONE, dst);
+        function_.code[done].a = Here();
+        next_register_ = mark;
+    }
+
+    void CompileBinary(Op op, const ast::flat::Node& node, uint32_t dst) {
+        const ast::flat::Node& rhs_node = pool_.nodes[node.b];
+        if ((op == Op::ADD || op == Op::SUB) && rhs_node.kind == NodeKind::CONST
+            && LocalRegister(node.a) != NO_NODE) {
+            Emit(op == Op::ADD ? Op::ADD_CONST : Op::SUB_CONST, dst, LocalRegister(node.a),
+                 rhs_node.a);
+            return;
+        }
+        Compile(node.a, dst);
+        const uint32_t rhs = Alloc();
+        Compile(node.b, rhs);
+        Emit(op, dst, dst, rhs);
+    }
+
+    // Присваивание x = x + k или x = x - k переменной метода x: результат пишется
+    // сразу в её ячейку без промежуточного регистра. Возвращает false для иных форм
+    bool CompileLocalIncrement(const ast::flat::Node& node) {
+        if (function_.locals.empty()) {
+            return false;
+        }
+        const ast::flat::Node& value = pool_.nodes[node.b];
+        if ((value.kind != NodeKind::ADD && value.kind != NodeKind::SUB)
+            || pool_.nodes[value.b].kind != NodeKind::CONST) {
+            return false;
+        }
+        const uint32_t local = locals_.at(pool_.symbols[node.a].Id());
+        if (LocalRegister(value.a) != local) {
+            return false;
+        }
+        Emit(value.kind == NodeKind::ADD ? Op::ADD_CONST : Op::SUB_CONST, local, local,
+             pool_.nodes[value.b].a);
+        return true;
+    }
+
+    // Ячейка переменной метода, если узел - её значение без полей, иначе NO_NODE
+    uint32_t LocalRegister(uint32_t index) const {
+        const ast::flat::Node& node = pool_.nodes[index];
+        if (function_.locals.empty() || node.kind != NodeKind::VARIABLE || node.b != 1) {
+            return NO_NODE;
+        }
+        return locals_.at(pool_.symbols[node.a].Id());
+    }
+
+    // Операнд суперкоманды: константа или переменная метода
+    bool IsSimpleOperand(uint32_t index) const {
+        return pool_.nodes[index].kind == NodeKind::CONST || LocalRegister(index) != NO_NODE;
+    }
+
+    // Регистр со значением простого операнда: ячейка переменной либо reg с константой
+    uint32_t CompileSimpleOperand(uint32_t index, uint32_t reg) {
+        const uint32_t local = LocalRegister(index);
+        if (local != NO_NODE) {
+            return local;
+        }
+        Emit(Op::LOAD_CONST, reg, pool_.nodes[index].a);
+        return reg;
+    }
+
+    // Присваивание v.f = v.f + x, где v и x - переменные метода или x - константа
+    bool IsFieldIncrement(const ast::flat::Node& node) const {
+        const uint32_t object = LocalRegister(node.a);
+        const ast::flat::Node& value = pool_.nodes[node.c];
+        if (object == NO_NODE || value.kind != NodeKind::ADD || !IsSimpleOperand(value.b)) {
+            return false;
+        }
+        const ast::flat::Node& lhs = pool_.nodes[value.a];
+        return lhs.kind == NodeKind::VARIABLE && lhs.b == 2
+               && pool_.symbols[lhs.a] == pool_.symbols[pool_.nodes[node.a].a]
+               && pool_.symbols[lhs.a + 1] == pool_.symbols[node.b];
+    }
+
+    // Вычисляет условие и выдаёт переход при его ложности, адрес которого задаёт
+    // SetJumpTarget. Сравнение простых операндов выполняется вместе с переходом
+    uint32_t CompileJumpIfFalse(uint32_t condition, uint32_t dst) {
+        const ast::flat::Node& node = pool_.nodes[condition];
+        if (node.kind != NodeKind::COMPARISON || !IsSimpleOperand(node.a)
+            || !IsSimpleOperand(node.b)) {
+            Compile(condition, dst);
+            return Emit(Op::JUMP_IF_FALSE, dst);
+        }
+        const uint32_t mark = next_register_;
+        const uint32_t lhs = CompileSimpleOperand(node.a, dst);
+        const uint32_t rhs = CompileSimpleOperand(node.b, Alloc());
+        next_register_ = mark;
+        const auto op = static_cast<uint8_t>(static_cast<uint8_t>(Op::JUMP_UNLESS_EQUAL) + node.c);
+        return Emit(static_cast<Op>(op), lhs, rhs);
+    }
+
+    void SetJumpTarget(uint32_t jump, uint32_t target) {
+        Instr& instr = function_.code[jump];
+        (instr.op == Op::JUMP_IF_FALSE ? instr.b : instr.c) = target;
+    }
+
+    // Вычисляет аргументы в подряд идущие регистры и возвращает номер первого
+    uint32_t CompileArgumentList(uint32_t list_offset) {
+        const uint32_t* list = &pool_.lists[list_offset];
+        const uint32_t first = next_register_;
+        for (uint32_t i = 1; i <= list[0]; ++i) {
+            Alloc();
+        }
+        for (uint32_t i = 1; i <= list[0]; ++i) {
+            Compile(list[i], first + i - 1);
+        }
+        return first;
+    }
+
+    // Вычисляет аргументы вызова и возвращает номер места вызова
+    uint32_t CompileArguments(intern::Symbol method, uint32_t list_offset) {
+        const uint32_t first = CompileArgumentList(list_offset);
+        program_.call_sites.push_back({method, first, pool_.lists[list_offset]});
+        return static_cast<uint32_t>(program_.call_sites.size() - 1);
+    }
+
+    Program& program_;
+    const ast::flat::Code& pool_;
+    Function function_;
+    // Регистры переменных метода по номеру имени
+    unordered_map<uint32_t, uint32_t> locals_;
+    uint32_t next_register_ = 0;
+    uint32_t register_count_ = 0;
+};
+
+// Регистры выполняемой функции: массив регистров её записи в стеке вызовов машины
+using Registers = ObjectHolder*;
+
+// Общий для всех потоков: его задают до выполнения, а читает каждый вызов
+atomic<size_t> max_call_depth{DEFAULT_MAX_CALL_DEPTH};
+
+/*
+ * Запись стека вызовов машины. Стек лежит в куче: вызов метода байт-кода из байт-кода
+ * не углубляет стек C++, а кладёт запись вызываемой функции, и Loop продолжает
+ * с её первой команды. Глубина рекурсии Mython ограничена max_call_depth, а не стеком потока
+ */
+struct Activation {
+    vector<ObjectHolder> registers;
+    const Function* function = nullptr;
+    // Команда CALL_METHOD вызывающей функции, ждущая результат; nullptr у первой записи Loop
+    const Instr* return_to = nullptr;
+};
+
+// Записи переиспользуются, как кадры runtime::Frame, и их регистры не выделяются заново
+class CallStack {
+public:
+    Activation& Push(const Function& function) {
+        if (depth_ >= max_call_depth.load(memory_order_relaxed)) {
+            throw runtime_error("Maximum call depth exceeded"s);
+        }
+        if (depth_ == frames_.size()) {
+            frames_.push_back(make_unique<Activation>());
+        }
+        Activation& frame = *frames_[depth_++];
+        frame.function = &function;
+        frame.registers.resize(function.register_count);
+        return frame;
+    }
+
+    void Pop() {
+        frames_[--depth_]->registers.clear();
+        if (depth_ == 0 && frames_.size() > POOLED_ACTIVATIONS) {
+            frames_.resize(POOLED_ACTIVATIONS);
+        }
+    }
+
+    Activation& Top() {
+        return *frames_[depth_ - 1];
+    }
+
+    [[nodiscard]] size_t Depth() const {
+        return depth_;
+    }
+
+private:
+    // Сколько записей стек сохраняет после выхода из всех вызовов.
+    // Записи, созданные сверх этого глубокой рекурсией, освобождаются
+    static constexpr size_t POOLED_ACTIVATIONS = 128;
+
+    vector<unique_ptr<Activation>> frames_;
+    size_t depth_ = 0;
+};
+
+thread_local CallStack call_stack;
+
+// Снимает записи, положенные после создания, в том числе при исключении
+class CallStackScope {
+public:
+    explicit CallStackScope(CallStack& stack)
+        : stack_(stack)
+        , depth_(stack.Depth()) {
+    }
+
+    CallStackScope(const CallStackScope&) = delete;
+    CallStackScope& operator=(const CallStackScope&) = delete;
+
+    ~CallStackScope() {
+        while (stack_.Depth() > depth_) {
+            stack_.Pop();
+        }
+    }
+
+private:
+    CallStack& stack_;
+    size_t depth_;
+};
+
+/*
+ * Команды, создающие временные объекты, выполняются отдельными функциями.
+ * Иначе их временные значения занимают место в кадре цикла машины,
+ * и на каждый вызов метода Mython уходит больше стека
+ */
+
+[[gnu::noinline]] void LoadVariable(const ast::flat::Code& pool, const Instr& instr,
+                                    Registers regs, Closure& closure) {
+    regs[instr.a] = ast::LookupVariable(closure, &pool.symbols[instr.b], instr.c,
+                                        &pool.field_caches[instr.b]);
+}
+
+[[gnu::noinline]] void LoadFields(const ast::flat::Code& pool, const Instr& instr,
+                                  Registers regs) {
+    regs[instr.a] = ast::LookupFields(regs[instr.a], &pool.symbols[instr.b], instr.c,
+                                      &pool.field_caches[instr.b]);
+}
+
+[[noreturn, gnu::noinline]] void ThrowUndefined() {
+    // Тот же текст, что и у ошибки поиска по имени
+    throw runtime_error("value undefined"s);
+}
+
+[[gnu::noinline]] void StoreVariable(const ast::flat::Code& pool, const Instr& instr,
+                                     Registers regs, Closure& closure) {
+    closure[pool.symbols[instr.a]] = regs[instr.b];
+}
+
+[[gnu::noinline]] void StoreField(const ast::flat::Code& pool, const Instr& instr,
+                                  Registers regs) {
+    auto* instance = regs[instr.a].TryAs<runtime::ClassInstance>();
+    instance->Fields().Assign(pool.symbols[instr.b], pool.field_caches[instr.b]) = regs[instr.c];
+}
+
+[[gnu::noinline]] void Print(const Instr& instr, Registers regs, Context& context) {
+    if (instr.b != 0) {
+        context.GetOutputStream() << " ";
+    }
+    ast::PrintValue(regs[instr.a], context);
+}
+
+[[gnu::noinline]] void NewInstance(const ast::flat::Code& pool, const Instr& instr,
+                                   Registers regs) {
+    regs[instr.a] = ObjectHolder::Own(runtime::ClassInstance(*pool.classes[instr.b]));
+}
+
+[[gnu::noinline]] void CallMethod(const Program& program, const Instr& instr, Registers regs,
+                                  Context& context) {
+    const CallSite& site = program.call_sites[instr.c];
+    runtime::Frame frame;
+    vector<ObjectHolder>& args = frame.Values();
+    for (uint32_t i = 0; i < site.arg_count; ++i) {
+        args.push_back(std::move(regs[site.first_arg + i]));
+    }
+    auto* instance = regs[instr.b].TryAs<runtime::ClassInstance>();
+    regs[instr.a] = instance->Call(site.cache, site.method, args, context);
+}
+
+// Функция вызываемого метода, если его тело - функция той же программы с переменными
+// в ячейках кадра. Такой метод выполняется в стеке вызовов машины; иначе результат - nullptr
+const Function* FindCallee(const Program& program, const Instr& instr, Registers regs) {
+    const CallSite& site = program.call_sites[instr.c];
+    const runtime::Class& cls = regs[instr.b].As<runtime::ClassInstance>().GetClass();
+    const runtime::Method* method = site.cache.Find(cls, site.method, site.arg_count);
+    const auto* body = method != nullptr ? dynamic_cast<const VmStatement*>(method->body.get())
+                                         : nullptr;
+    if (body == nullptr || &body->GetProgram() != &program) {
+        return nullptr;
+    }
+    const Function& callee = program.functions[body->GetFunction()];
+    return callee.locals.empty() ? nullptr : &callee;
+}
+
+// Заполняет регистры вызываемой функции, как RunMethod: self, аргументы, затем UNBOUND
+void BindArguments(const Function& callee, Registers callee_regs, ObjectHolder self,
+                   ObjectHolder* args, uint32_t arg_count) {
+    callee_regs[0] = std::move(self);
+    for (uint32_t i = 0; i < arg_count; ++i) {
+        callee_regs[i + 1] = std::move(args[i]);
+    }
+    for (size_t i = arg_count + 1; i < callee.locals.size(); ++i) {
+        callee_regs[i] = UNBOUND;
+    }
+}
+
+// Кладёт в стек запись метода, вызываемого командой instr, если он выполняется машиной.
+// Иначе стек не меняется и результат - nullptr
+[[gnu::noinline]] Activation* EnterCall(const Program& program, const Instr& instr,
+                                        Registers regs, CallStack& stack) {
+    const Function* callee = FindCallee(program, instr, regs);
+    if (callee == nullptr) {
+        return nullptr;
+    }
+    Activation& frame = stack.Push(*callee);
+    frame.return_to = &instr;
+    const CallSite& site = program.call_sites[instr.c];
+    BindArguments(*callee, frame.registers.data(), regs[instr.b], regs + site.first_arg,
+                  site.arg_count);
+    return &frame;
+}
+
+// Хвостовой вызов: запись frame заполняется для вызываемого метода и выполняет его
+// вместо текущей функции. Если метод не выполняется машиной, запись не меняется
+[[gnu::noinline]] bool EnterTailCall(const Program& program, const Instr& instr,
+                                     Activation& frame) {
+    const Function* callee = FindCallee(program, instr, frame.registers.data());
+    if (callee == nullptr) {
+        return false;
+    }
+    const CallSite& site = program.call_sites[instr.c];
+    runtime::Frame values_frame;
+    vector<ObjectHolder>& values = values_frame.Values();
+    for (uint32_t i = 0; i < site.arg_count; ++i) {
+        values.push_back(std::move(frame.registers[site.first_arg + i]));
+    }
+    ObjectHolder self = std::move(frame.registers[instr.b]);
+    frame.registers.clear();
+    frame.registers.resize(callee->register_count);
+    frame.function = callee;
+    BindArguments(*callee, frame.registers.data(), std::move(self), values.data(),
+                  site.arg_count);
+    return true;
+}
+
+// Снимает запись вызванного метода и передаёт value в регистр результата вызова.
+// Возвращает запись вызывающей функции
+[[gnu::noinline]] Activation& ReturnToCaller(CallStack& stack, ObjectHolder value) {
+    const Instr& call = *stack.Top().return_to;
+    stack.Pop();
+    Activation& caller = stack.Top();
+    caller.registers[call.a] = std::move(value);
+    return caller;
+}
+
+[[gnu::noinline]] bool HasMethod(const CallSite& site, const ObjectHolder& object) {
+    const runtime::Class& cls = object.As<runtime::ClassInstance>().GetClass();
+    return site.cache.Find(cls, site.method, site.arg_count) != nullptr;
+}
+
+[[gnu::noinline]] void Stringify(const Instr& instr, Registers regs) {
+    regs[instr.a] = ast::StringifyValue(regs[instr.b]);
+}
+
+bool AreNumbers(const ObjectHolder& lhs, const ObjectHolder& rhs) {
+    return lhs.GetType() == runtime::ObjectType::NUMBER
+           && rhs.GetType() == runtime::ObjectType::NUMBER;
+}
+
+int NumberValue(const ObjectHolder& value) {
+    return value.As<runtime::Number>().GetValue();
+}
+
+bool CompareNumbers(runtime::CompareOp op, int lhs, int rhs) {
+    using runtime::CompareOp;
+    switch (op) {
+        case CompareOp::EQUAL:
+            return runtime::ApplyCompareOp<CompareOp::EQUAL>(lhs, rhs);
+        case CompareOp::NOT_EQUAL:
+            return runtime::ApplyCompareOp<CompareOp::NOT_EQUAL>(lhs, rhs);
+        case CompareOp::LESS:
+            return runtime::ApplyCompareOp<CompareOp::LESS>(lhs, rhs);
+        case CompareOp::GREATER:
+            return runtime::ApplyCompareOp<CompareOp::GREATER>(lhs, rhs);
+        case CompareOp::LESS_OR_EQUAL:
+            return runtime::ApplyCompareOp<CompareOp::LESS_OR_EQUAL>(lhs, rhs);
+        default:
+            return runtime::ApplyCompareOp<CompareOp::GREATER_OR_EQUAL>(lhs, rhs);
+    }
+}
+
+// Общая форма команды ADD .. COMPARE или любой её специализации
+Op GenericOp(Op op) {
+    switch (op) {
+        case Op::ADD:
+        case Op::ADD_NUMBERS:
+        case Op::ADD_STRINGS:
+        case Op::ADD_GENERIC:
+            return Op::ADD_GENERIC;
+        case Op::SUB:
+        case Op::SUB_NUMBERS:
+        case Op::SUB_GENERIC:
+            return Op::SUB_GENERIC;
+        case Op::MULT:
+        case Op::MULT_NUMBERS:
+        case Op::MULT_GENERIC:
+            return Op::MULT_GENERIC;
+        case Op::DIV:
+        case Op::DIV_NUMBERS:
+        case Op::DIV_GENERIC:
+            return Op::DIV_GENERIC;
+        default:
+            return Op::COMPARE_GENERIC;
+    }
+}
+
+// Форма команды op, специализированная под числа
+Op NumbersOp(Op op) {
+    switch (op) {
+        case Op::ADD:
+            return Op::ADD_NUMBERS;
+        case Op::SUB:
+            return Op::SUB_NUMBERS;
+        case Op::MULT:
+            return Op::MULT_NUMBERS;
+        case Op::DIV:
+            return Op::DIV_NUMBERS;
+        default:
+            return Op::COMPARE_NUMBERS;
+    }
+}
+
+[[gnu::noinline]] void SetNumber(ObjectHolder& reg, int value) {
+    reg = ObjectHolder::Own(runtime::Number(value));
+}
+
+// Выполняет любую форму команды ADD .. COMPARE общим путём
+[[gnu::noinline]] void Arithmetic(const Instr& instr, Registers regs, Context& context) {
+    const Op op = GenericOp(instr.op);
+    if (op == Op::COMPARE_GENERIC) {
+        const bool result = runtime::CompareValues(static_cast<runtime::CompareOp>(instr.c),
+                                                   regs[instr.a], regs[instr.b], context);
+        regs[instr.a] = ObjectHolder::Own(runtime::Bool(result));
+        return;
+    }
+    const ObjectHolder& lhs = regs[instr.b];
+    const ObjectHolder& rhs = regs[instr.c];
+    switch (op) {
+        case Op::ADD_GENERIC:
+            regs[instr.a] = ast::AddValues(lhs, rhs, context);
+            break;
+        case Op::SUB_GENERIC:
+            regs[instr.a] = ast::SubValues(lhs, rhs);
+            break;
+        case Op::MULT_GENERIC:
+            regs[instr.a] = ast::MultValues(lhs, rhs);
+            break;
+        default:
+            regs[instr.a] = ast::DivValues(lhs, rhs);
+            break;
+    }
+}
+
+// Первое выполнение команды ADD .. COMPARE: переписывает её в форму для типов аргументов
+[[gnu::noinline]] void Quicken(const Instr& instr, Registers regs, Context& context) {
+    const bool compare = instr.op == Op::COMPARE;
+    const ObjectHolder& lhs = regs[compare ? instr.a : instr.b];
+    const ObjectHolder& rhs = regs[compare ? instr.b : instr.c];
+    switch (Quickening::Specialize(lhs, rhs, instr.op == Op::ADD)) {
+        case Specialization::NUMBERS:
+            instr.op = NumbersOp(instr.op);
+            break;
+        case Specialization::STRINGS:
+            instr.op = Op::ADD_STRINGS;
+            break;
+        default:
+            instr.op = GenericOp(instr.op);
+            break;
+    }
+    Arithmetic(instr, regs, context);
+}
+
+// Аргументы не подошли специализированной форме команды: переписывает её в общую
+[[gnu::noinline]] void Deoptimize(const Instr& instr, Registers regs, Context& context) {
+    Quickening::Deoptimize();
+    instr.op = GenericOp(instr.op);
+    Arithmetic(instr, regs, context);
+}
+
+[[gnu::noinline]] void AddStrings(const Instr& instr, Registers regs, Context& context) {
+    const ObjectHolder& lhs = regs[instr.b];
+    const ObjectHolder& rhs = regs[instr.c];
+    if (lhs.GetType() != runtime::ObjectType::STRING
+        || rhs.GetType() != runtime::ObjectType::STRING) {
+        Deoptimize(instr, regs, context);
+        return;
+    }
+    regs[instr.a] = ObjectHolder::Own(runtime::String(lhs.As<runtime::String>().GetValue()
+                                                      + rhs.As<runtime::String>().GetValue()));
+}
+
+// Общий путь ADD_CONST и SUB_CONST
+[[gnu::noinline]] void ArithmeticConst(const ast::flat::Code& pool, const Instr& instr,
+                                       Registers regs, Context& context) {
+    const ObjectHolder& lhs = regs[instr.b];
+    if (lhs.Get() == &unbound_value) {
+        ThrowUndefined();
+    }
+    const ObjectHolder& rhs = pool.constants[instr.c];
+    regs[instr.a] = instr.op == Op::ADD_CONST ? ast::AddValues(lhs, rhs, context)
+                                              : ast::SubValues(lhs, rhs);
+}
+
+[[gnu::noinline]] void AddToField(const ast::flat::Code& pool, const Instr& instr,
+                                  Registers regs, Context& context) {
+    const intern::Symbol name = pool.symbols[instr.b];
+    runtime::FieldCache& cache = pool.field_caches[instr.b];
+    auto* instance = regs[instr.a].TryAs<runtime::ClassInstance>();
+    const ObjectHolder* field = instance->Fields().Find(name, cache);
+    if (field == nullptr) {
+        throw out_of_range("No field "s + name.Name());
+    }
+    // __add__ может изменить поля объекта, поэтому значение поля копируется
+    const ObjectHolder lhs = *field;
+    ObjectHolder& value = regs[instr.c];
+    if (value.Get() == &unbound_value) {
+        ThrowUndefined();
+    }
+    if (AreNumbers(lhs, value)) {
+        value = ObjectHolder::Own(runtime::Number(NumberValue(lhs) + NumberValue(value)));
+    } else {
+        value = ast::AddValues(lhs, value, context);
+    }
+    instance->Fields().Assign(name, cache) = value;
+}
+
+[[gnu::noinline]] ObjectHolder ReturnFields(const ast::flat::Code& pool, const Instr& instr,
+                                            Registers regs) {
+    if (regs[instr.a].Get() == &unbound_value) {
+        ThrowUndefined();
+    }
+    return ast::LookupFields(regs[instr.a], &pool.symbols[instr.b], instr.c,
+                             &pool.field_caches[instr.b]);
+}
+
+// Общий путь команд JUMP_UNLESS_*
+[[gnu::noinline]] bool CompareForJump(runtime::CompareOp op, const ObjectHolder& lhs,
+                                      const ObjectHolder& rhs, Context& context) {
+    if (lhs.Get() == &unbound_value || rhs.Get() == &unbound_value) {
+        ThrowUndefined();
+    }
+    return runtime::CompareValues(op, lhs, rhs, context);
+}
+
+[[gnu::noinline]] void SetBool(ObjectHolder& reg, bool value) {
+    reg = ObjectHolder::Own(runtime::Bool(value));
+}
+
+[[gnu::noinline]] void SetNone(ObjectHolder& reg) {
+    reg = ObjectHolder::None();
+}
+
+[[gnu::noinline]] void CallFunction(const Program& program, const Instr& instr, Registers regs,
+                                    Closure& closure, Context& context) {
+    regs[instr.a] = Run(program, instr.b, closure, context);
+}
+
+[[gnu::noinline]] void ExecuteOpaque(const ast::flat::Code& pool, const Instr& instr,
+                                     Registers regs, Closure& closure, Context& context) {
+    regs[instr.a] = pool.opaque[instr.b]->Execute(closure, context);
+}
+
+[[noreturn, gnu::noinline]] void ThrowReturn(ObjectHolder& value) {
+    throw ast::ReturnException(std::move(value));
+}
+
+/*
+ * Выполняет функцию записи base - вершины стека вызовов. Вызовы методов машины
+ * кладут записи в стек и выполняются этим же циклом; RETURN записи base завершает его.
+ * tail_calls - запись base принадлежит только этому выполнению, и TAIL_CALL может
+ * заменить её функцию
+ */
+ObjectHolder Loop(const Program& program, Activation& base, Closure& closure, Context& context,
+                  bool tail_calls = false) {
+    const ast::flat::Code& pool = *program.pool;
+    CallStack& stack = call_stack;
+    Activation* frame = &base;
+    const Instr* code = base.function->code.data();
+    Registers regs = base.registers.data();
+    const Instr* pc = code;
+
+#ifdef MYTHON_VM_COMPUTED_GOTO
+    // Адреса обработчиков в порядке значений Op
+    static const void* const HANDLERS[] = {
+        &&do_LOAD_CONST,    &&do_LOAD_NONE,           &&do_LOAD_VAR,
+        &&do_LOAD_LOCAL,    &&do_LOAD_FIELDS,         &&do_STORE_VAR,
+        &&do_MOVE,          &&do_STORE_FIELD,         &&do_PRINT,
+        &&do_NEWLINE,       &&do_NEW_INSTANCE,        &&do_CALL_METHOD,
+        &&do_TAIL_CALL,     &&do_STRINGIFY,           &&do_ADD,
+        &&do_SUB,           &&do_MULT,                &&do_DIV,
+        &&do_COMPARE,
+        &&do_ADD_NUMBERS,   &&do_ADD_STRINGS,         &&do_SUB_NUMBERS,
+        &&do_MULT_NUMBERS,  &&do_DIV_NUMBERS,         &&do_COMPARE_NUMBERS,
+        &&do_ADD_GENERIC,   &&do_SUB_GENERIC,         &&do_MULT_GENERIC,
+        &&do_DIV_GENERIC,   &&do_COMPARE_GENERIC,
+        &&do_ADD_CONST,     &&do_SUB_CONST,           &&do_ADD_TO_FIELD,
+        &&do_RETURN_FIELDS, &&do_JUMP_UNLESS_EQUAL,   &&do_JUMP_UNLESS_NOT_EQUAL,
+        &&do_JUMP_UNLESS_LESS, &&do_JUMP_UNLESS_GREATER, &&do_JUMP_UNLESS_LESS_OR_EQUAL,
+        &&do_JUMP_UNLESS_GREATER_OR_EQUAL,
+        &&do_TO_BOOL,       &&do_NOT,                 &&do_JUMP,
+        &&do_JUMP_IF_FALSE, &&do_JUMP_IF_TRUE,        &&do_JUMP_IF_NOT_INSTANCE,
+        &&do_JUMP_IF_NO_METHOD, &&do_CALL_FUNCTION,   &&do_OPAQUE,
+        &&do_RETURN,        &&do_THROW_RETURN,
+    };
+    static_assert(size(HANDLERS) == static_cast<size_t>(Op::THROW_RETURN) + 1);
+#define VM_CASE(name) do_##name:
+#define VM_NEXT() goto* HANDLERS[static_cast<uint8_t>((++pc)->op)]
+#define VM_JUMP(target)                                    \
+    pc = code + (target);                                  \
+    goto* HANDLERS[static_cast<uint8_t>(pc->op)]
+    goto* HANDLERS[static_cast<uint8_t>(pc->op)];
+#else
+#define VM_CASE(name) case Op::name:
+#define VM_NEXT() \
+    ++pc;         \
+    continue
+#define VM_JUMP(target)   \
+    pc = code + (target); \
+    continue
+    for (;;) {
+        switch (pc->op) {
+#endif
+
+    VM_CASE(LOAD_CONST) {
+        regs[pc->a] = pool.constants[pc->b];
+        VM_NEXT();
+    }
+    VM_CASE(LOAD_NONE) {
+        SetNone(regs[pc->a]);
+        VM_NEXT();
+    }
+    VM_CASE(LOAD_VAR) {
+        LoadVariable(pool, *pc, regs, closure);
+        VM_NEXT();
+    }
+    VM_CASE(LOAD_LOCAL) {
+        if (regs[pc->b].Get() == &unbound_value) {
+            ThrowUndefined();
+        }
+        regs[pc->a] = regs[pc->b];
+        VM_NEXT();
+    }
+    VM_CASE(LOAD_FIELDS) {
+        LoadFields(pool, *pc, regs);
+        VM_NEXT();
+    }
+    VM_CASE(STORE_VAR) {
+        StoreVariable(pool, *pc, regs, closure);
+        VM_NEXT();
+    }
+    VM_CASE(MOVE) {
+        regs[pc->a] = regs[pc->b];
+        VM_NEXT();
+    }
+    VM_CASE(STORE_FIELD) {
+        StoreField(pool, *pc, regs);
+        VM_NEXT();
+    }
+    VM_CASE(PRINT) {
+        Print(*pc, regs, context);
+        VM_NEXT();
+    }
+    VM_CASE(NEWLINE) {
+        context.GetOutputStream() << endl;
+        VM_NEXT();
+    }
+    VM_CASE(NEW_INSTANCE) {
+        NewInstance(pool, *pc, regs);
+        VM_NEXT();
+    }
+    VM_CASE(CALL_METHOD) {
+        if (Activation* callee = EnterCall(program, *pc, regs, stack)) {
+            frame = callee;
+            code = frame->function->code.data();
+            regs = frame->registers.data();
+            VM_JUMP(0);
+        }
+        CallMethod(program, *pc, regs, context);
+        VM_NEXT();
+    }
+    VM_CASE(TAIL_CALL) {
+        if (tail_calls || frame != &base) {
+            if (EnterTailCall(program, *pc, *frame)) {
+                code = frame->function->code.data();
+                regs = frame->registers.data();
+                VM_JUMP(0);
+            }
+        }
+        CallMethod(program, *pc, regs, context);
+        VM_NEXT();
+    }
+    VM_CASE(STRINGIFY) {
+        Stringify(*pc, regs);
+        VM_NEXT();
+    }
+    VM_CASE(ADD)
+    VM_CASE(SUB)
+    VM_CASE(MULT)
+    VM_CASE(DIV)
+    VM_CASE(COMPARE) {
+        Quicken(*pc, regs, context);
+        VM_NEXT();
+    }
+    VM_CASE(ADD_NUMBERS) {
+        if (AreNumbers(regs[pc->b], regs[pc->c])) {
+            SetNumber(regs[pc->a], NumberValue(regs[pc->b]) + NumberValue(regs[pc->c]));
+        } else {
+            Deoptimize(*pc, regs, context);
+        }
+        VM_NEXT();
+    }
+    VM_CASE(ADD_STRINGS) {
+        AddStrings(*pc, regs, context);
+        VM_NEXT();
+    }
+    VM_CASE(SUB_NUMBERS) {
+        if (AreNumbers(regs[pc->b], regs[pc->c])) {
+            SetNumber(regs[pc->a], NumberValue(regs[pc->b]) - NumberValue(regs[pc->c]));
+        } else {
+            Deoptimize(*pc, regs, context);
+        }
+        VM_NEXT();
+    }
+    VM_CASE(MULT_NUMBERS) {
+        if (AreNumbers(regs[pc->b], regs[pc->c])) {
+            SetNumber(regs[pc->a], NumberValue(regs[pc->b]) * NumberValue(regs[pc->c]));
+        } else {
+            Deoptimize(*pc, regs, context);
+        }
+        VM_NEXT();
+    }
+    VM_CASE(DIV_NUMBERS) {
+        if (!AreNumbers(regs[pc->b], regs[pc->c])) {
+            Deoptimize(*pc, regs, context);
+        } else if (NumberValue(regs[pc->c]) == 0) {
+            // деление на ноль не деоптимизирует команду: ошибку выбрасывает общий путь
+            Arithmetic(*pc, regs, context);
+        } else {
+            SetNumber(regs[pc->a], NumberValue(regs[pc->b]) / NumberValue(regs[pc->c]));
+        }
+        VM_NEXT();
+    }
+    VM_CASE(COMPARE_NUMBERS) {
+        if (AreNumbers(regs[pc->a], regs[pc->b])) {
+            SetBool(regs[pc->a], CompareNumbers(static_cast<runtime::CompareOp>(pc->c),
+                                                NumberValue(regs[pc->a]),
+                                                NumberValue(regs[pc->b])));
+        } else {
+            Deoptimize(*pc, regs, context);
+        }
+        VM_NEXT();
+    }
+    VM_CASE(ADD_GENERIC)
+    VM_CASE(SUB_GENERIC)
+    VM_CASE(MULT_GENERIC)
+    VM_CASE(DIV_GENERIC)
+    VM_CASE(COMPARE_GENERIC) {
+        Arithmetic(*pc, regs, context);
+        VM_NEXT();
+    }
+    VM_CASE(ADD_CONST) {
+        if (AreNumbers(regs[pc->b], pool.constants[pc->c])) {
+            SetNumber(regs[pc->a], NumberValue(regs[pc->b]) + NumberValue(pool.constants[pc->c]));
+        } else {
+            ArithmeticConst(pool, *pc, regs, context);
+        }
+        VM_NEXT();
+    }
+    VM_CASE(SUB_CONST) {
+        if (AreNumbers(regs[pc->b], pool.constants[pc->c])) {
+            SetNumber(regs[pc->a], NumberValue(regs[pc->b]) - NumberValue(pool.constants[pc->c]));
+        } else {
+            ArithmeticConst(pool, *pc, regs, context);
+        }
+        VM_NEXT();
+    }
+    VM_CASE(ADD_TO_FIELD) {
+        AddToField(pool, *pc, regs, context);
+        VM_NEXT();
+    }
+    VM_CASE(RETURN_FIELDS) {
+        if (frame == &base) {
+            return ReturnFields(pool, *pc, regs);
+        }
+        const Instr* call = frame->return_to;
+        frame = &ReturnToCaller(stack, ReturnFields(pool, *pc, regs));
+        code = frame->function->code.data();
+        regs = frame->registers.data();
+        pc = call;
+        VM_NEXT();
+    }
+    VM_CASE(JUMP_UNLESS_EQUAL)
+    VM_CASE(JUMP_UNLESS_NOT_EQUAL)
+    VM_CASE(JUMP_UNLESS_LESS)
+    VM_CASE(JUMP_UNLESS_GREATER)
+    VM_CASE(JUMP_UNLESS_LESS_OR_EQUAL)
+    VM_CASE(JUMP_UNLESS_GREATER_OR_EQUAL) {
+        const auto op = static_cast<runtime::CompareOp>(
+            static_cast<uint8_t>(pc->op) - static_cast<uint8_t>(Op::JUMP_UNLESS_EQUAL));
+        const ObjectHolder& lhs = regs[pc->a];
+        const ObjectHolder& rhs = regs[pc->b];
+        if (!(AreNumbers(lhs, rhs) ? CompareNumbers(op, NumberValue(lhs), NumberValue(rhs))
+                                   : CompareForJump(op, lhs, rhs, context))) {
+            VM_JUMP(pc->c);
+        }
+        VM_NEXT();
+    }
+    VM_CASE(TO_BOOL) {
+        SetBool(regs[pc->a], runtime::IsTrue(regs[pc->b]));
+        VM_NEXT();
+    }
+    VM_CASE(NOT) {
+        SetBool(regs[pc->a], !runtime::IsTrue(regs[pc->b]));
+        VM_NEXT();
+    }
+    VM_CASE(JUMP) {
+        VM_JUMP(pc->a);
+    }
+    VM_CASE(JUMP_IF_FALSE) {
+        if (!runtime::IsTrue(regs[pc->a])) {
+            VM_JUMP(pc->b);
+        }
+        VM_NEXT();
+    }
+    VM_CASE(JUMP_IF_TRUE) {
+        if (runtime::IsTrue(regs[pc->a])) {
+            VM_JUMP(pc->b);
+        }
+        VM_NEXT();
+    }
+    VM_CASE(JUMP_IF_NOT_INSTANCE) {
+        if (regs[pc->a].TryAs<runtime::ClassInstance>() == nullptr) {
+            VM_JUMP(pc->b);
+        }
+        VM_NEXT();
+    }
+    VM_CASE(JUMP_IF_NO_METHOD) {
+        const CallSite& site = program.call_sites[pc->b];
+        if (!HasMethod(site, regs[pc->a])) {
+            VM_JUMP(pc->c);
+        }
+        VM_NEXT();
+    }
+    VM_CASE(CALL_FUNCTION) {
+        CallFunction(program, *pc, regs, closure, context);
+        VM_NEXT();
+    }
+    VM_CASE(OPAQUE) {
+        ExecuteOpaque(pool, *pc, regs, closure, context);
+        VM_NEXT();
+    }
+    VM_CASE(RETURN) {
+        if (frame == &base) {
+            return std::move(regs[pc->a]);
+        }
+        const Instr* call = frame->return_to;
+        frame = &ReturnToCaller(stack, std::move(regs[pc->a]));
+        code = frame->function->code.data();
+        regs = frame->registers.data();
+        pc = call;
+        VM_NEXT();
+    }
+    VM_CASE(THROW_RETURN) {
+        ThrowReturn(regs[pc->a]);
+    }
+
+#ifndef MYTHON_VM_COMPUTED_GOTO
+        }
+    }
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP
+}
+
+// Компилирует переведённый код и заменяет байт-кодом тела переведённых методов.
+// Возвращает программу и номер функции корня дерева (NO_NODE, если корня нет)
+pair<shared_ptr<const Program>, uint32_t> Install(ast::flat::Lowered lowered) {
+    auto program = make_shared<Program>();
+    program->pool = make_shared<const ast::flat::Code>(std::move(lowered.code));
+
+    uint32_t root = NO_NODE;
+    if (lowered.root != NO_NODE) {
+        root = FunctionCompiler(*program).Build(lowered.root);
+    }
+    vector<uint32_t> method_functions;
+    method_functions.reserve(lowered.methods.size());
+    for (const auto& method : lowered.methods) {
+        method_functions.push_back(FunctionCompiler(*program).Build(method.root, method.method));
+    }
+
+    shared_ptr<const Program> result = std::move(program);
+    for (size_t i = 0; i < lowered.methods.size(); ++i) {
+        runtime::Method& method = *lowered.methods[i].method;
+        method.body = make_unique<VmStatement>(result, method_functions[i], std::move(method.body));
+    }
+    return {std::move(result), root};
+}
+
+unique_ptr<ast::Statement> Build(ast::Statement& tree, unique_ptr<ast::Statement> source) {
+    auto [program, root] = Install(ast::flat::Lower(tree));
+    return make_unique<VmStatement>(std::move(program), root, std::move(source));
+}
+
+}  // namespace
+
+thread_local Quickening::Statistics Quickening::statistics_;
+
+Specialization Quickening::Specialize(const ObjectHolder& lhs, const ObjectHolder& rhs,
+                                      bool allow_strings) {
+    const Specialization result = Choose(lhs, rhs, allow_strings);
+    if (result != Specialization::GENERIC) {
+        ++statistics_.specialized;
+    }
+    return result;
+}
+
+Specialization Quickening::Deoptimize() {
+    ++statistics_.deoptimized;
+    return Specialization::GENERIC;
+}
+
+void SetMaxCallDepth(size_t depth) {
+    max_call_depth.store(depth, memory_order_relaxed);
+}
+
+size_t GetMaxCallDepth() {
+    return max_call_depth.load(memory_order_relaxed);
+}
+
+ObjectHolder Run(const Program& program, uint32_t function, Closure& closure, Context& context) {
+    const Function& code = program.functions[function];
+    CallStackScope scope(call_stack);
+    Activation& frame = call_stack.Push(code);
+    Registers regs = frame.registers.data();
+    if (!code.locals.empty()) {
+        // Метод с переменными в регистрах выполняется с готовым Closure:
+        // переменные переносятся в регистры и после выполнения обратно
+        for (size_t i = 0; i < code.locals.size(); ++i) {
+            const auto it = closure.find(code.locals[i]);
+            regs[i] = it != closure.end() ? it->second : UNBOUND;
+        }
+        ObjectHolder result = Loop(program, frame, closure, context);
+        for (size_t i = 0; i < code.locals.size(); ++i) {
+            if (regs[i].Get() != &unbound_value) {
+                closure[code.locals[i]] = regs[i];
+            }
+        }
+        return result;
+    }
+    if (!code.method_body) {
+        return Loop(program, frame, closure, context);
+    }
+    try {
+        return Loop(program, frame, closure, context);
+    } catch (ast::ReturnException& r) {
+        // return из узла, выполненного через исходное дерево
+        return r.obj_;
+    }
+}
+
+ObjectHolder RunMethod(const Program& program, uint32_t function, const ObjectHolder& self,
+                       const vector<ObjectHolder>& args, Context& context) {
+    const Function& code = program.functions[function];
+    CallStackScope scope(call_stack);
+    Activation& frame = call_stack.Push(code);
+    Registers regs = frame.registers.data();
+    regs[0] = self;
+    for (size_t i = 0; i < args.size(); ++i) {
+        regs[i + 1] = args[i];
+    }
+    for (size_t i = args.size() + 1; i < code.locals.size(); ++i) {
+        regs[i] = UNBOUND;
+    }
+    // В таком теле нет узлов, выполняемых через дерево, поэтому Closure ему не нужен,
+    // а ReturnException перехватывать не нужно
+    thread_local Closure no_closure;
+    return Loop(program, frame, no_closure, context, true);
+}
+
+VmStatement::VmStatement(shared_ptr<const Program> program, uint32_t function,
+                         unique_ptr<ast::Statement> source)
+    : source_(std::move(source))
+    , program_(std::move(program))
+    , function_(function) {
+}
+
+ObjectHolder VmStatement::Execute(Closure& closure, Context& context) {
+    return Run(*program_, function_, closure, context);
+}
+
+ObjectHolder VmStatement::ExecuteMethod(const ObjectHolder& self,
+                                        const vector<intern::Symbol>& params,
+                                        const vector<ObjectHolder>& args, Context& context) {
+    if (program_->functions[function_].locals.empty()) {
+        return Executable::ExecuteMethod(self, params, args, context);
+    }
+    return RunMethod(*program_, function_, self, args, context);
+}
+
+unique_ptr<ast::Statement> Compile(unique_ptr<ast::Statement> tree) {
+    ast::Statement& root = *tree;
+    return Build(root, std::move(tree));
+}
+
+unique_ptr<ast::Statement> Compile(ast::Statement& tree) {
+    return Build(tree, nullptr);
+}
+
+void CompileMethods(runtime::Class& cls) {
+    Install(ast::flat::LowerMethods(cls));
+}
+
+string_view DispatchName() {
+#ifdef MYTHON_VM_COMPUTED_GOTO
+    return "computed-goto"sv;
+#else
+    return "switch"sv;
+#endif
+}
+
+}  // namespace vm
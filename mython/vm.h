@@ -0,0 +1,230 @@
+﻿#pragma once
+
+#include "flat_ast.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace vm {
+
+/*
+ * Команды регистровой машины. Операнды a, b, c - номера регистров кадра,
+ * индексы в пулах плоского кода (Program::pool) либо адреса переходов
+ */
+enum class Op : uint8_t {
+    LOAD_CONST,            // a = pool.constants[b]
+    LOAD_NONE,             // a = None
+    LOAD_VAR,              // a = значение цепочки имён pool.symbols[b .. b + c)
+    LOAD_LOCAL,            // a = локальная переменная в ячейке b; ошибка, если ей не присвоено
+    LOAD_FIELDS,           // a = значение цепочки полей a.pool.symbols[b .. b + c)
+    STORE_VAR,             // переменная pool.symbols[a] = b
+    MOVE,                  // a = b
+    STORE_FIELD,           // поле pool.symbols[b] объекта a = c
+    PRINT,                 // выводит a, перед ним пробел, если b != 0
+    NEWLINE,               // выводит конец строки
+    NEW_INSTANCE,          // a = новый экземпляр класса pool.classes[b]
+    CALL_METHOD,           // a = вызов у объекта b метода по месту вызова call_sites[c]
+    TAIL_CALL,             // CALL_METHOD перед return: метод байт-кода с переменными в ячейках
+                           // выполняется вместо текущей функции в её же кадре
+    STRINGIFY,             // a = str(b)
+    ADD,                   // a = b + c
+    SUB,                   // a = b - c
+    MULT,                  // a = b * c
+    DIV,                   // a = b / c
+    COMPARE,               // a = сравнение a и b операцией runtime::CompareOp(c)
+    // Формы команд ADD .. COMPARE, в которые они переписываются при первом выполнении
+    // по типам аргументов (см. Quickening). Специализированная форма при аргументах
+    // других типов переписывается в общую
+    ADD_NUMBERS,           // ADD над числами
+    ADD_STRINGS,           // ADD над строками
+    SUB_NUMBERS,           // SUB над числами
+    MULT_NUMBERS,          // MULT над числами
+    DIV_NUMBERS,           // DIV над числами
+    COMPARE_NUMBERS,       // COMPARE над числами
+    ADD_GENERIC,           // ADD с разбором типов аргументов
+    SUB_GENERIC,           // SUB с разбором типов аргументов
+    MULT_GENERIC,          // MULT с разбором типов аргументов
+    DIV_GENERIC,           // DIV с разбором типов аргументов
+    COMPARE_GENERIC,       // COMPARE с разбором типов аргументов
+    // Суперкоманды: частые сочетания команд, выполняемые за один переход.
+    // Ячейка локальной переменной в операнде проверяется так же, как в LOAD_LOCAL
+    ADD_CONST,             // a = локальная переменная в ячейке b + pool.constants[c]
+    SUB_CONST,             // a = локальная переменная в ячейке b - pool.constants[c]
+    ADD_TO_FIELD,          // c = поле pool.symbols[b] объекта a + c, и это же значение - полю
+    RETURN_FIELDS,         // return цепочки полей pool.symbols[b .. b + c) переменной в ячейке a
+    // Переход на c, если сравнение a и b ложно. Порядок команд - как у runtime::CompareOp
+    JUMP_UNLESS_EQUAL,
+    JUMP_UNLESS_NOT_EQUAL,
+    JUMP_UNLESS_LESS,
+    JUMP_UNLESS_GREATER,
+    JUMP_UNLESS_LESS_OR_EQUAL,
+    JUMP_UNLESS_GREATER_OR_EQUAL,
+    TO_BOOL,               // a = Bool(b)
+    NOT,                   // a = Bool(not b)
+    JUMP,                  // переход на a
+    JUMP_IF_FALSE,         // переход на b, если a ложно
+    JUMP_IF_TRUE,          // переход на b, если a истинно
+    JUMP_IF_NOT_INSTANCE,  // переход на b, если a - не экземпляр класса
+    JUMP_IF_NO_METHOD,     // переход на c, если у a нет метода места вызова call_sites[b]
+    CALL_FUNCTION,         // a = результат функции functions[b] с тем же замыканием
+    OPAQUE,                // a = pool.opaque[b]->Execute
+    RETURN,                // завершает функцию с результатом a
+    THROW_RETURN,          // return вне тела метода: выбрасывает ReturnException со значением a
+};
+
+// Команда фиксированного размера. Команды ADD .. COMPARE переписываются при выполнении,
+// поэтому op объявлен mutable
+struct Instr {
+    mutable Op op;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t c = 0;
+};
+
+// Операнды вызова метода, не поместившиеся в команду.
+// Аргументы лежат в регистрах first_arg .. first_arg + arg_count - 1.
+// Кеш поиска метода меняется при выполнении, поэтому объявлен mutable
+struct CallSite {
+    intern::Symbol method;
+    uint32_t first_arg;
+    uint32_t arg_count;
+    mutable runtime::MethodCache cache = {};
+};
+
+// Функция: тело метода либо программа верхнего уровня
+struct Function {
+    std::vector<Instr> code;
+    uint32_t register_count = 0;
+    // Тело метода перехватывает ReturnException узлов, выполняемых через дерево
+    bool method_body = false;
+    // Имена переменных метода, размещённых в первых регистрах кадра: self, параметры,
+    // затем остальные локальные переменные. Если пусто, переменные ищутся по имени в Closure
+    std::vector<intern::Symbol> locals;
+};
+
+// Байт-код программы. Константы, имена, классы и узлы без байт-кода берутся из плоского кода
+struct Program {
+    std::shared_ptr<const ast::flat::Code> pool;
+    std::vector<Function> functions;
+    std::vector<CallSite> call_sites;
+};
+
+// Наибольшая глубина стека вызовов машины по умолчанию
+inline constexpr size_t DEFAULT_MAX_CALL_DEPTH = 100000;
+
+// Задаёт наибольшую глубину стека вызовов машины, общую для всех потоков. Вызовы методов
+// байт-кода из байт-кода не расходуют стек потока, а вызов сверх этой глубины выбрасывает
+// std::runtime_error. Вызовы через операторы runtime и методы других движков по-прежнему
+// идут по стеку потока
+void SetMaxCallDepth(size_t depth);
+size_t GetMaxCallDepth();
+
+// Типы аргументов, под которые специализирована команда
+enum class Specialization : uint8_t {
+    NUMBERS,        // оба аргумента - числа
+    STRINGS,        // оба аргумента - строки
+    GENERIC,        // общий путь с разбором типов аргументов
+};
+
+/*
+ * Самоспециализация команд ADD .. COMPARE (quickening). При первом выполнении команда
+ * переписывается под типы аргументов и дальше проверяет только их, не разбирая все возможные
+ * сочетания типов. Если аргументы впервые не подошли, команда деоптимизируется и навсегда
+ * переходит на общий путь
+ */
+class Quickening {
+public:
+    // Специализированные и деоптимизированные команды потока
+    struct Statistics {
+        uint64_t specialized = 0;
+        uint64_t deoptimized = 0;
+    };
+
+    // Специализация под типы lhs и rhs. Специализация STRINGS выбирается, только если
+    // allow_strings
+    static Specialization Choose(const runtime::ObjectHolder& lhs,
+                                 const runtime::ObjectHolder& rhs, bool allow_strings) {
+        const runtime::ObjectType type = lhs.GetType();
+        if (type != rhs.GetType()) {
+            return Specialization::GENERIC;
+        }
+        if (type == runtime::ObjectType::NUMBER) {
+            return Specialization::NUMBERS;
+        }
+        if (allow_strings && type == runtime::ObjectType::STRING) {
+            return Specialization::STRINGS;
+        }
+        return Specialization::GENERIC;
+    }
+
+    // Выбирает специализацию при первом выполнении команды и учитывает её в статистике
+    static Specialization Specialize(const runtime::ObjectHolder& lhs,
+                                     const runtime::ObjectHolder& rhs, bool allow_strings);
+    // Учитывает деоптимизацию в статистике и возвращает GENERIC
+    static Specialization Deoptimize();
+
+    [[nodiscard]] static Statistics& GetStatistics() {
+        return statistics_;
+    }
+
+private:
+    static thread_local Statistics statistics_;
+};
+
+
+// Выполняет функцию function программы program
+runtime::ObjectHolder Run(const Program& program, uint32_t function, runtime::Closure& closure,
+                          runtime::Context& context);
+
+// Выполняет метод, переменные которого размещены в регистрах кадра (locals не пуст)
+runtime::ObjectHolder RunMethod(const Program& program, uint32_t function,
+                                const runtime::ObjectHolder& self,
+                                const std::vector<runtime::ObjectHolder>& args,
+                                runtime::Context& context);
+
+// Инструкция, выполняемая виртуальной машиной
+class VmStatement : public ast::flat::CompiledStatement {
+public:
+    // source - исходное дерево, на узлы которого может ссылаться пул программы
+    VmStatement(std::shared_ptr<const Program> program, uint32_t function,
+                std::unique_ptr<ast::Statement> source);
+
+    runtime::ObjectHolder Execute(runtime::Closure& closure, runtime::Context& context) override;
+
+    // Метод с переменными в ячейках кадра вызывается без построения Closure
+    runtime::ObjectHolder ExecuteMethod(const runtime::ObjectHolder& self,
+                                        const std::vector<intern::Symbol>& params,
+                                        const std::vector<runtime::ObjectHolder>& args,
+                                        runtime::Context& context) override;
+
+    [[nodiscard]] const Program& GetProgram() const {
+        return *program_;
+    }
+
+    [[nodiscard]] uint32_t GetFunction() const {
+        return function_;
+    }
+
+private:
+    std::unique_ptr<ast::Statement> source_;
+    std::shared_ptr<const Program> program_;
+    uint32_t function_;
+};
+
+// Компилирует дерево в байт-код. Тела методов классов, объявленных в дереве,
+// тоже заменяются байт-кодом. Результат владеет исходным деревом
+std::unique_ptr<ast::Statement> Compile(std::unique_ptr<ast::Statement> tree);
+
+// То же, но дерево остаётся у вызывающего и должно пережить результат
+std::unique_ptr<ast::Statement> Compile(ast::Statement& tree);
+
+// Компилирует в байт-код тела собственных методов класса cls
+void CompileMethods(runtime::Class& cls);
+
+// Способ выбора следующей команды, с которым собрана машина: "computed-goto" или "switch"
+std::string_view DispatchName();
+
+}  // namespace vm
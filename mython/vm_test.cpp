@@ -0,0 +1,324 @@
+﻿#include "test_runner_p.h"
+#include "vm.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace vm {
+
+namespace {
+
+const string CLASSES_PROGRAM = R"(
+class Point:
+  def __init__(x, y):
+    self.x = x
+    self.y = y
+
+  def __str__():
+    return '(' + str(self.x) + ', ' + str(self.y) + ')'
+
+  def __eq__(other):
+    return self.x == other.x and self.y == other.y
+
+class Walker:
+  def __init__():
+    self.pos = Point(0, 0)
+    self.steps = 0
+
+  def step(dx, dy):
+    self.pos = Point(self.pos.x + dx, self.pos.y + dy)
+    self.steps = self.steps + 1
+    if self.steps > 2:
+      return 'far'
+    return 'near'
+
+class Fib:
+  def calc(n):
+    if n < 2:
+      return n
+    return self.calc(n - 1) + self.calc(n - 2)
+
+w = Walker()
+print w.step(1, 2), w.step(3, 4), w.step(-1, 0), w.pos, w.steps
+print w.pos == Point(3, 6), w.pos != Point(3, 6), not w.steps, None or 'x', 0 and 1
+f = Fib()
+print f.calc(12), 100 / 7 * 2 - 3
+n = 5
+n.x = 1
+print 'end'
+)";
+
+void TestInstructionLayout() {
+    static_assert(sizeof(Instr) == 16);
+    ASSERT(!DispatchName().empty());
+
+    auto compiled = Compile(ParseProgramFromString(CLASSES_PROGRAM));
+    const auto& statement = dynamic_cast<const VmStatement&>(*compiled);
+    const Program& program = statement.GetProgram();
+    const Function& root = program.functions.at(statement.GetFunction());
+
+    ASSERT(!root.method_body);
+    ASSERT(root.register_count > 0);
+    ASSERT(root.code.back().op == Op::RETURN);
+    // Переходы не выходят за пределы функции
+    for (const Function& function : program.functions) {
+        for (const Instr& instr : function.code) {
+            if (instr.op == Op::JUMP) {
+                ASSERT(instr.a <= function.code.size());
+            } else if (instr.op == Op::JUMP_IF_FALSE || instr.op == Op::JUMP_IF_TRUE
+                       || instr.op == Op::JUMP_IF_NOT_INSTANCE) {
+                ASSERT(instr.b <= function.code.size());
+            } else if (instr.op >= Op::JUMP_UNLESS_EQUAL
+                       && instr.op <= Op::JUMP_UNLESS_GREATER_OR_EQUAL) {
+                ASSERT(instr.c <= function.code.size());
+            }
+        }
+    }
+}
+
+void TestMethodBodiesAreCompiled() {
+    auto compiled = Compile(ParseProgramFromString(CLASSES_PROGRAM));
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    compiled->Execute(closure, context);
+
+    const auto* cls = closure.at("Point"s).TryAs<runtime::Class>();
+    ASSERT(cls != nullptr);
+    for (const char* name : {"__init__", "__str__", "__eq__"}) {
+        const runtime::Method* method = cls->GetMethod(name);
+        ASSERT(method != nullptr);
+        const auto* body = dynamic_cast<const VmStatement*>(method->body.get());
+        ASSERT(body != nullptr);
+        ASSERT(body->GetProgram().functions.at(body->GetFunction()).method_body);
+    }
+}
+
+void TestProgramsMatchTree() {
+    const string expected = "near near far (3, 6) 3\n"
+                            "True False False True False\n"
+                            "144 25\n"
+                            "end\n"s;
+    ASSERT_EQUAL(RunProgram(CLASSES_PROGRAM), expected);
+    ASSERT_EQUAL(RunProgram(CLASSES_PROGRAM, Compile), expected);
+}
+
+void TestMethodLocalsUseRegisters() {
+    const string program = R"(
+class Adder:
+  def add(a, b):
+    total = a + b
+    self.last = total
+    return total
+
+  def pick(flag):
+    if flag:
+      value = 'set'
+    return value
+
+a = Adder()
+print a.add(2, 3), a.last, a.pick(1)
+)";
+    ASSERT_EQUAL(RunProgram(program, Compile), "5 5 set\n"s);
+    ASSERT_THROWS(RunProgram(program + "a.pick(0)\n"s, Compile), runtime_error);
+
+    auto compiled = Compile(ParseProgramFromString(program));
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    compiled->Execute(closure, context);
+    auto* cls = closure.at("Adder"s).TryAs<runtime::Class>();
+    const runtime::Method* add = cls->GetMethod("add");
+    const auto& body = dynamic_cast<const VmStatement&>(*add->body);
+    const Function& function = body.GetProgram().functions.at(body.GetFunction());
+
+    // self, параметры, затем локальные переменные; поиска по имени в теле нет
+    ASSERT_EQUAL(function.locals.size(), 4U);
+    ASSERT(function.locals[0] == intern::Symbol("self"));
+    ASSERT(function.locals[1] == intern::Symbol("a"));
+    ASSERT(function.locals[3] == intern::Symbol("total"));
+    for (const Instr& instr : function.code) {
+        ASSERT(instr.op != Op::LOAD_VAR && instr.op != Op::STORE_VAR);
+    }
+
+    // Тело можно выполнить и с готовым Closure: переменные возвращаются в него
+    runtime::Closure call_closure{{"self"s, closure.at("a"s)},
+                                  {"a"s, runtime::ObjectHolder::Own(runtime::Number(4))},
+                                  {"b"s, runtime::ObjectHolder::Own(runtime::Number(6))}};
+    const auto result = add->body->Execute(call_closure, context);
+    ASSERT_EQUAL(result.TryAs<runtime::Number>()->GetValue(), 10);
+    ASSERT_EQUAL(call_closure.at("total"s).TryAs<runtime::Number>()->GetValue(), 10);
+}
+
+void TestSuperinstructions() {
+    const string program = R"(
+class Counter:
+  def __init__():
+    self.count = 0
+    self.text = ''
+
+  def add(step, limit):
+    if step < limit:
+      self.count = self.count + step
+      self.text = self.text + 'x'
+    n = step
+    n = n + 1
+    return self.count
+
+  def get():
+    return self.count
+
+  def undefined(flag):
+    if flag:
+      k = 1
+    if k < 2:
+      return k - 1
+
+c = Counter()
+print c.add(2, 5), c.add(7, 5), c.add(1, 5), c.text, c.get(), c.undefined(1)
+)";
+    const string expected = "2 2 3 xx 3 0\n"s;
+    ASSERT_EQUAL(RunProgram(program), expected);
+    ASSERT_EQUAL(RunProgram(program, Compile), expected);
+    ASSERT_THROWS(RunProgram(program + "c.undefined(0)\n"s, Compile), runtime_error);
+
+    auto compiled = Compile(ParseProgramFromString(program));
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    compiled->Execute(closure, context);
+    const auto* cls = closure.at("Counter"s).TryAs<runtime::Class>();
+    const auto count = [cls](const char* method, Op op) {
+        const auto& body = dynamic_cast<const VmStatement&>(*cls->GetMethod(method)->body);
+        const Function& function = body.GetProgram().functions.at(body.GetFunction());
+        return count_if(function.code.begin(), function.code.end(),
+                        [op](const Instr& instr) { return instr.op == op; });
+    };
+    ASSERT_EQUAL(count("add", Op::JUMP_UNLESS_LESS), 1);
+    ASSERT_EQUAL(count("add", Op::ADD_TO_FIELD), 2);
+    ASSERT_EQUAL(count("add", Op::ADD_CONST), 1);
+    ASSERT_EQUAL(count("add", Op::MOVE), 2);
+    ASSERT_EQUAL(count("add", Op::RETURN_FIELDS), 1);
+    ASSERT_EQUAL(count("add", Op::JUMP_IF_FALSE), 0);
+    ASSERT_EQUAL(count("get", Op::RETURN_FIELDS), 1);
+    ASSERT_EQUAL(count("undefined", Op::SUB_CONST), 1);
+}
+
+void TestQuickening() {
+    runtime::DummyContext context;
+    ast::Add add(make_unique<ast::VariableValue>("x"s), make_unique<ast::VariableValue>("y"s));
+    // Специализация хранится в команде, поэтому программа компилируется один раз
+    const auto compiled = Compile(add);
+
+    auto& stats = Quickening::GetStatistics();
+    const Quickening::Statistics before = stats;
+    runtime::Closure closure = {{"x"s, runtime::ObjectHolder::Own(runtime::Number{2})},
+                                {"y"s, runtime::ObjectHolder::Own(runtime::Number{40})}};
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQUAL(compiled->Execute(closure, context).TryAs<runtime::Number>()->GetValue(),
+                     42);
+    }
+    ASSERT_EQUAL(stats.specialized - before.specialized, 1u);
+    ASSERT_EQUAL(stats.deoptimized, before.deoptimized);
+
+    // Аргументы другого типа возвращают команду на общий путь, результат от этого не меняется
+    closure["x"s] = runtime::ObjectHolder::Own(runtime::String{"4"s});
+    closure["y"s] = runtime::ObjectHolder::Own(runtime::String{"2"s});
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_EQUAL(compiled->Execute(closure, context).TryAs<runtime::String>()->GetValue(),
+                     "42"s);
+    }
+    closure["y"s] = runtime::ObjectHolder::Own(runtime::Number{2});
+    ASSERT_THROWS(compiled->Execute(closure, context), runtime_error);
+
+    ASSERT_EQUAL(stats.specialized - before.specialized, 1u);
+    ASSERT_EQUAL(stats.deoptimized - before.deoptimized, 1u);
+}
+
+void TestTailCalls() {
+    // Без хвостовых вызовов такая глубина рекурсии переполнила бы стек
+    const string program = R"(
+class Counter:
+  def __init__():
+    self.calls = 0
+
+  def count(n):
+    if n == 0:
+      return self.calls
+    self.calls = self.calls + 1
+    return self.count(n - 1)
+
+  def even(n):
+    if n == 0:
+      return True
+    return self.odd(n - 1)
+
+  def odd(n):
+    if n == 0:
+      return False
+    return self.even(n - 1)
+
+  def missing():
+    return self.count()
+
+c = Counter()
+x = 1
+print c.count(200000), c.even(100001), x.count(1)
+)";
+    ASSERT_EQUAL(RunProgram(program), "200000 False None\n"s);
+    ASSERT_EQUAL(RunProgram(program, Compile), "200000 False None\n"s);
+    ASSERT_THROWS(RunProgram(program + "c.missing()\n"s, Compile), runtime_error);
+}
+
+void TestDeepRecursion() {
+    // Вызовы не в хвостовой позиции кладут записи в стек вызовов машины, а не в стек потока
+    const string program = R"(
+class Summator:
+  def sum(n):
+    if n == 0:
+      return 0
+    return n + self.sum(n - 1)
+
+s = Summator()
+print s.sum(50000)
+)";
+    ASSERT_EQUAL(RunProgram(program, Compile), "1250025000\n"s);
+
+    const size_t max_call_depth = GetMaxCallDepth();
+    SetMaxCallDepth(1000);
+    ASSERT_THROWS(RunProgram(program, Compile), runtime_error);
+    SetMaxCallDepth(max_call_depth);
+    // После ошибки стек вызовов пуст, и выполнение продолжается
+    ASSERT_EQUAL(RunProgram(program, Compile), "1250025000\n"s);
+}
+
+void TestRuntimeErrors() {
+    ASSERT_THROWS(RunProgram("x = 'a' + 1\n"s, Compile), runtime_error);
+    ASSERT_THROWS(RunProgram("print y\n"s, Compile), runtime_error);
+    ASSERT_THROWS(RunProgram("x = 1 / 0\n"s, Compile), runtime_error);
+    ASSERT_THROWS(RunProgram("class A:\n  def f():\n    return 1\n\na = A()\na.g()\n"s, Compile),
+                  runtime_error);
+}
+
+void TestReturnOutsideMethod() {
+    ast::Return statement(make_unique<ast::NumericConst>(1));
+    auto compiled = Compile(statement);
+    runtime::DummyContext context;
+    runtime::Closure closure;
+    ASSERT_THROWS(compiled->Execute(closure, context), ast::ReturnException);
+}
+
+}  // namespace
+
+void RunVmTests(TestRunner& tr) {
+    RUN_TEST(tr, vm::TestInstructionLayout);
+    RUN_TEST(tr, vm::TestMethodBodiesAreCompiled);
+    RUN_TEST(tr, vm::TestProgramsMatchTree);
+    RUN_TEST(tr, vm::TestMethodLocalsUseRegisters);
+    RUN_TEST(tr, vm::TestSuperinstructions);
+    RUN_TEST(tr, vm::TestQuickening);
+    RUN_TEST(tr, vm::TestTailCalls);
+    RUN_TEST(tr, vm::TestDeepRecursion);
+    RUN_TEST(tr, vm::TestRuntimeErrors);
+    RUN_TEST(tr, vm::TestReturnOutsideMethod);
+}
+
+}  // namespace vm